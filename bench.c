@@ -0,0 +1,650 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark driver for the diff pipeline; generates pairs of synthetic
+ * zones and times each stage of the comparison separately, printing the
+ * results as CSV so that runs of different versions can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <ldns/ldns.h>
+#include "dns_zonesplit.h"
+#include "dns_zonehash.h"
+#include "dns_zonetok.h"
+#include "dns_zonestore.h"
+#include "dns_zoneout.h"
+#include "dns_zonegen.h"
+
+/* Origin of the generated zones */
+#define ZD_BENCH_ORIGIN		"bench.test."
+
+/* Stages that are timed */
+enum
+{
+	ZD_BENCH_PARSE,
+	ZD_BENCH_CANON,
+	ZD_BENCH_WIRE,
+	ZD_BENCH_HASH,
+	ZD_BENCH_APPEND,
+	ZD_BENCH_SORT,
+	ZD_BENCH_TOKENIZE,
+	ZD_BENCH_MERGE,
+	ZD_BENCH_OUTPUT,
+	ZD_BENCH_STAGES
+};
+
+static const char* zd_bench_stage_names[ZD_BENCH_STAGES] =
+{
+	"parse",
+	"canonicalize",
+	"wire",
+	"hash",
+	"append",
+	"sort",
+	"tokenize",
+	"merge",
+	"output"
+};
+
+/* Time and number of records processed per stage */
+typedef struct _zd_bench_result
+{
+	double	seconds[ZD_BENCH_STAGES];
+	size_t	count[ZD_BENCH_STAGES];
+}
+zd_bench_result;
+
+/* Differences collected by the merge stage, for the output stage */
+typedef struct _zd_bench_diffs
+{
+	const zd_rec**	recs;
+	int*		remove;
+	size_t		count;
+	size_t		capacity;
+}
+zd_bench_diffs;
+
+void usage(void)
+{
+	printf("ldns-zonediff-bench\n");
+	printf("Copyright (C) 2018 SURFnet bv\n");
+	printf("All rights reserved (see LICENSE for more information)\n\n");
+	printf("Usage:\n");
+	printf("\tldns-zonediff-bench [-n <sizes>] [-c <changes>] [-H <hash>]\n");
+	printf("\tldns-zonediff-bench -h\n");
+	printf("\n");
+	printf("\tldns-zonediff-bench generates pairs of synthetic zones and\n");
+	printf("\ttimes each stage of the comparison separately. The results\n");
+	printf("\tare written to stdout as CSV with the columns:\n");
+	printf("\trecords,change_pct,stage,count,seconds,per_sec\n");
+	printf("\n");
+	printf("Optional arguments:\n");
+	printf("\t-n   Comma-separated list of zone sizes in records\n");
+	printf("\t     (default: 10000,100000)\n");
+	printf("\t-c   Comma-separated list of percentages of records\n");
+	printf("\t     that differ between the zones (default: 1,10)\n");
+	printf("\t-H   Fingerprint records using <hash>, either fp128\n");
+	printf("\t     (fast, default) or sha256\n");
+	printf("\t-h   Print this help message\n");
+}
+
+/* Return the current time in seconds */
+static double zd_bench_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/*
+ * Write a pair of zones with the specified number of records; change_pct
+ * percent of the records differ, split evenly between removals, additions
+ * and TTL changes
+ */
+static int zd_bench_write_zones(const char* left_file, const char* right_file, const size_t records, const int change_pct)
+{
+	zd_gen_opts	opts	= { 0 };
+	FILE*		left	= fopen(left_file, "w");
+	FILE*		right	= fopen(right_file, "w");
+	int		rv	= 0;
+
+	opts.origin = ZD_BENCH_ORIGIN;
+	opts.shape = ZD_GEN_HOSTS;
+	opts.records = records;
+	opts.add_ratio = change_pct * 100 / 3;
+	opts.del_ratio = change_pct * 100 / 3;
+	opts.ttl_ratio = change_pct * 100 / 3;
+	opts.serial_bump = 1;
+
+	if ((left == NULL) || (right == NULL))
+	{
+		rv = errno;
+
+		fprintf(stderr, "Failed to create zone files in the temporary directory\n");
+	}
+	else
+	{
+		rv = zd_gen_zones(&opts, left, right);
+	}
+
+	if ((left != NULL) && (fclose(left) != 0) && (rv == 0)) rv = EIO;
+	if ((right != NULL) && (fclose(right) != 0) && (rv == 0)) rv = EIO;
+
+	return rv;
+}
+
+/* Load a zone through the ldns parser, timing each stage */
+static int zd_bench_load(const char* zone_file, const int hash_alg, dnsz_zone* zone, zd_bench_result* res)
+{
+	FILE*		zone_fd		= fopen(zone_file, "r");
+	ldns_rr**	rrs		= NULL;
+	ldns_rr**	pre_rrs		= NULL;
+	uint8_t**	wires		= NULL;
+	size_t*		wire_sizes	= NULL;
+	unsigned char*	digests		= NULL;
+	size_t		hash_size	= zd_hash_size(hash_alg);
+	size_t		count		= 0;
+	size_t		capacity	= ZD_ZONE_INITIAL_SIZE;
+	size_t		i		= 0;
+	ldns_rr*	cur_rr		= NULL;
+	ldns_rdf*	origin		= NULL;
+	ldns_rdf*	prev		= NULL;
+	uint32_t	ttl		= 0;
+	int		line_no		= 0;
+	int		rv		= 0;
+	double		start		= 0;
+
+	if (zone_fd == NULL)
+	{
+		fprintf(stderr, "Failed to open zone file %s\n", zone_file);
+
+		return errno;
+	}
+
+	if ((rrs = (ldns_rr**) malloc(capacity * sizeof(ldns_rr*))) == NULL)
+	{
+		fclose(zone_fd);
+
+		return ENOMEM;
+	}
+
+	/* Parsing */
+	start = zd_bench_now();
+
+	while (!feof(zone_fd))
+	{
+		if (ldns_rr_new_frm_fp_l(&cur_rr, zone_fd, &ttl, &origin, &prev, &line_no) != LDNS_STATUS_OK)
+		{
+			continue;
+		}
+
+		/* The SOA is compared separately and not part of the zone data */
+		if (ldns_rr_get_type(cur_rr) == LDNS_RR_TYPE_SOA)
+		{
+			ldns_rr_free(cur_rr);
+			continue;
+		}
+
+		if (count == capacity)
+		{
+			ldns_rr**	new_rrs	= (ldns_rr**) realloc(rrs, 2 * capacity * sizeof(ldns_rr*));
+
+			if (new_rrs == NULL)
+			{
+				ldns_rr_free(cur_rr);
+				rv = ENOMEM;
+				goto cleanup;
+			}
+
+			rrs = new_rrs;
+			capacity *= 2;
+		}
+
+		rrs[count++] = cur_rr;
+	}
+
+	res->seconds[ZD_BENCH_PARSE] += zd_bench_now() - start;
+	res->count[ZD_BENCH_PARSE] += count;
+
+	if (((pre_rrs = (ldns_rr**) calloc(count, sizeof(ldns_rr*))) == NULL) ||
+	    ((wires = (uint8_t**) calloc(count, sizeof(uint8_t*))) == NULL) ||
+	    ((wire_sizes = (size_t*) calloc(count, sizeof(size_t))) == NULL) ||
+	    ((digests = (unsigned char*) malloc(count * hash_size + 1)) == NULL))
+	{
+		rv = ENOMEM;
+		goto cleanup;
+	}
+
+	/* Canonicalisation and clone with a fixed TTL */
+	start = zd_bench_now();
+
+	for (i = 0; i < count; i++)
+	{
+		ldns_rr2canonical(rrs[i]);
+
+		if ((pre_rrs[i] = ldns_rr_clone(rrs[i])) == NULL)
+		{
+			rv = ENOMEM;
+			goto cleanup;
+		}
+
+		ldns_rr_set_ttl(pre_rrs[i], LDNS_DEFAULT_TTL);
+	}
+
+	res->seconds[ZD_BENCH_CANON] += zd_bench_now() - start;
+	res->count[ZD_BENCH_CANON] += count;
+
+	/* Wire conversion */
+	start = zd_bench_now();
+
+	for (i = 0; i < count; i++)
+	{
+		if (ldns_rr2wire(&wires[i], pre_rrs[i], LDNS_SECTION_ANSWER, &wire_sizes[i]) != LDNS_STATUS_OK)
+		{
+			rv = EINVAL;
+			goto cleanup;
+		}
+	}
+
+	res->seconds[ZD_BENCH_WIRE] += zd_bench_now() - start;
+	res->count[ZD_BENCH_WIRE] += count;
+
+	/* Hashing */
+	start = zd_bench_now();
+
+	for (i = 0; i < count; i++)
+	{
+		if (zd_hash(hash_alg, wires[i], wire_sizes[i], &digests[i * hash_size]) != 0)
+		{
+			rv = EINVAL;
+			goto cleanup;
+		}
+	}
+
+	res->seconds[ZD_BENCH_HASH] += zd_bench_now() - start;
+	res->count[ZD_BENCH_HASH] += count;
+
+	/* Appending to the zone */
+	start = zd_bench_now();
+
+	for (i = 0; i < count; i++)
+	{
+		if ((rv = zd_zone_add(zone, &digests[i * hash_size], wires[i], wire_sizes[i], ldns_rr_ttl(rrs[i]))) != 0)
+		{
+			goto cleanup;
+		}
+	}
+
+	res->seconds[ZD_BENCH_APPEND] += zd_bench_now() - start;
+	res->count[ZD_BENCH_APPEND] += count;
+
+	/* Sorting */
+	start = zd_bench_now();
+
+	zd_zone_sort(zone, zd_hash_needs_verify(hash_alg));
+
+	res->seconds[ZD_BENCH_SORT] += zd_bench_now() - start;
+	res->count[ZD_BENCH_SORT] += count;
+
+cleanup:
+	for (i = 0; i < count; i++)
+	{
+		ldns_rr_free(rrs[i]);
+
+		if (pre_rrs != NULL) ldns_rr_free(pre_rrs[i]);
+		if (wires != NULL) free(wires[i]);
+	}
+
+	free(rrs);
+	free(pre_rrs);
+	free(wires);
+	free(wire_sizes);
+	free(digests);
+
+	if (origin != NULL) ldns_rdf_deep_free(origin);
+	if (prev != NULL) ldns_rdf_deep_free(prev);
+
+	fclose(zone_fd);
+
+	return rv;
+}
+
+/* Time the built-in tokenizer on a zone, which replaces the first stages */
+static int zd_bench_tokenize(const char* zone_file, zd_bench_result* res)
+{
+	zd_map		map	= { 0 };
+	zd_chunk	chunk	= { .start = 0, .end = -1, .line_no = 0 };
+	zd_tok*		tok	= NULL;
+	zd_tok_rr	rec	= { 0 };
+	size_t		count	= 0;
+	int		rv	= 0;
+	double		start	= 0;
+
+	if ((rv = zd_map_file(zone_file, &map)) != 0)
+	{
+		fprintf(stderr, "Failed to map zone file %s\n", zone_file);
+
+		return rv;
+	}
+
+	start = zd_bench_now();
+
+	if ((tok = zd_tok_new(&map, &chunk, NULL, 0, NULL)) == NULL)
+	{
+		zd_unmap_file(&map);
+
+		return ENOMEM;
+	}
+
+	while ((rv = zd_tok_next(tok, &rec)) == LDNS_STATUS_OK)
+	{
+		if (rec.rr != NULL) ldns_rr_free(rec.rr);
+
+		count++;
+	}
+
+	res->seconds[ZD_BENCH_TOKENIZE] += zd_bench_now() - start;
+	res->count[ZD_BENCH_TOKENIZE] += count;
+
+	zd_tok_free(tok);
+	zd_unmap_file(&map);
+
+	return (rv == ZD_TOK_END) ? 0 : rv;
+}
+
+/* Record a difference found by the merge */
+static int zd_bench_add_diff(zd_bench_diffs* diffs, const zd_rec* rec, const int remove)
+{
+	if (diffs->count == diffs->capacity)
+	{
+		size_t		capacity	= diffs->capacity ? 2 * diffs->capacity : ZD_ZONE_INITIAL_SIZE;
+		const zd_rec**	recs		= (const zd_rec**) realloc(diffs->recs, capacity * sizeof(zd_rec*));
+		int*		remove_flags	= NULL;
+
+		if (recs == NULL) return ENOMEM;
+
+		diffs->recs = recs;
+
+		if ((remove_flags = (int*) realloc(diffs->remove, capacity * sizeof(int))) == NULL) return ENOMEM;
+
+		diffs->remove = remove_flags;
+		diffs->capacity = capacity;
+	}
+
+	diffs->recs[diffs->count] = rec;
+	diffs->remove[diffs->count] = remove;
+	diffs->count++;
+
+	return 0;
+}
+
+/* Collect the differences; the zones are in memory, so records stay valid */
+static int zd_bench_diff(const zd_rec* rr2del, const zd_rec* rr2add, void* arg)
+{
+	zd_bench_diffs*	diffs	= (zd_bench_diffs*) arg;
+	int		rv	= 0;
+
+	if ((rr2del != NULL) && ((rv = zd_bench_add_diff(diffs, rr2del, 1)) != 0))
+	{
+		return rv;
+	}
+
+	if (rr2add != NULL)
+	{
+		rv = zd_bench_add_diff(diffs, rr2add, 0);
+	}
+
+	return rv;
+}
+
+/* Run the benchmark for one zone size and change ratio */
+static int zd_bench_run(const char* dir, const size_t records, const int change_pct, const int hash_alg)
+{
+	char		left_file[4096];
+	char		right_file[4096];
+	dnsz_zone	left		= { .hash_size = zd_hash_size(hash_alg) };
+	dnsz_zone	right		= { .hash_size = zd_hash_size(hash_alg) };
+	zd_bench_result	res		= { { 0 } };
+	zd_bench_diffs	diffs		= { 0 };
+	zd_out		out		= { 0 };
+	int		null_fd		= -1;
+	int		rv		= 0;
+	int		i		= 0;
+	size_t		j		= 0;
+	double		start		= 0;
+
+	snprintf(left_file, sizeof(left_file), "%s/left.zone", dir);
+	snprintf(right_file, sizeof(right_file), "%s/right.zone", dir);
+
+	if (((rv = zd_bench_write_zones(left_file, right_file, records, change_pct)) != 0) ||
+	    ((rv = zd_bench_load(left_file, hash_alg, &left, &res)) != 0) ||
+	    ((rv = zd_bench_load(right_file, hash_alg, &right, &res)) != 0) ||
+	    ((rv = zd_bench_tokenize(left_file, &res)) != 0) ||
+	    ((rv = zd_bench_tokenize(right_file, &res)) != 0))
+	{
+		goto cleanup;
+	}
+
+	/* Merge loop */
+	start = zd_bench_now();
+
+	if ((rv = zd_zone_merge(&left, &right, zd_hash_needs_verify(hash_alg), zd_bench_diff, &diffs)) != 0)
+	{
+		goto cleanup;
+	}
+
+	res.seconds[ZD_BENCH_MERGE] = zd_bench_now() - start;
+	res.count[ZD_BENCH_MERGE] = left.count + right.count;
+
+	/* Output formatting */
+	if ((null_fd = open("/dev/null", O_WRONLY)) < 0)
+	{
+		rv = errno;
+		goto cleanup;
+	}
+
+	if ((rv = zd_out_init(&out, null_fd)) != 0)
+	{
+		goto cleanup;
+	}
+
+	start = zd_bench_now();
+
+	for (j = 0; j < diffs.count; j++)
+	{
+		ldns_rr*	rr	= zd_rec2rr(diffs.recs[j]);
+
+		if (rr == NULL)
+		{
+			rv = ENOMEM;
+			goto cleanup;
+		}
+
+		zd_out_rr(&out, ZD_BENCH_ORIGIN, rr, diffs.remove[j], 0);
+
+		ldns_rr_free(rr);
+	}
+
+	if ((rv = zd_out_free(&out)) != 0)
+	{
+		goto cleanup;
+	}
+
+	res.seconds[ZD_BENCH_OUTPUT] = zd_bench_now() - start;
+	res.count[ZD_BENCH_OUTPUT] = diffs.count;
+
+	for (i = 0; i < ZD_BENCH_STAGES; i++)
+	{
+		printf("%zu,%d,%s,%zu,%.6f,%.0f\n",
+			records,
+			change_pct,
+			zd_bench_stage_names[i],
+			res.count[i],
+			res.seconds[i],
+			(res.seconds[i] > 0) ? (double) res.count[i] / res.seconds[i] : 0.0);
+	}
+
+	fflush(stdout);
+
+cleanup:
+	zd_out_free(&out);
+
+	if (null_fd >= 0) close(null_fd);
+
+	free(diffs.recs);
+	free(diffs.remove);
+
+	zd_free_zone(&left);
+	zd_free_zone(&right);
+
+	unlink(left_file);
+	unlink(right_file);
+
+	return rv;
+}
+
+/* Parse a comma-separated list of numbers; returns the number of entries or -1 */
+static int zd_bench_list(const char* str, unsigned long* values, const int max_values)
+{
+	const char*	p	= str;
+	char*		end	= NULL;
+	int		count	= 0;
+
+	while (*p != '\0')
+	{
+		if (count == max_values) return -1;
+
+		values[count++] = strtoul(p, &end, 10);
+
+		if ((end == p) || ((*end != ',') && (*end != '\0'))) return -1;
+
+		p = (*end == ',') ? end + 1 : end;
+	}
+
+	return count;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned long	sizes[16]	= { 10000, 100000 };
+	unsigned long	changes[16]	= { 1, 10 };
+	int		size_count	= 2;
+	int		change_count	= 2;
+	int		hash_alg	= ZD_HASH_FP128;
+	const char*	tmpdir		= getenv("TMPDIR");
+	char		dir[4096];
+	int		c		= 0;
+	int		i		= 0;
+	int		j		= 0;
+	int		rv		= 0;
+
+	while ((c = getopt(argc, argv, "n:c:H:h")) != -1)
+	{
+		switch(c)
+		{
+		case 'n':
+			if ((size_count = zd_bench_list(optarg, sizes, 16)) <= 0)
+			{
+				fprintf(stderr, "Invalid list of zone sizes specified\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 'c':
+			change_count = zd_bench_list(optarg, changes, 16);
+
+			for (i = 0; i < change_count; i++)
+			{
+				if (changes[i] > 100) change_count = -1;
+			}
+
+			if (change_count <= 0)
+			{
+				fprintf(stderr, "Invalid list of change percentages specified\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 'H':
+			hash_alg = zd_hash_by_name(optarg);
+
+			if (hash_alg < 0)
+			{
+				fprintf(stderr, "Unknown fingerprint algorithm %s\n", optarg);
+				usage();
+				exit(1);
+			}
+			break;
+		case 'h':
+		default:
+			usage();
+			return 0;
+		}
+	}
+
+	snprintf(dir, sizeof(dir), "%s/ldns-zonediff-bench.XXXXXX", (tmpdir != NULL) ? tmpdir : "/tmp");
+
+	if (mkdtemp(dir) == NULL)
+	{
+		fprintf(stderr, "Failed to create a temporary directory in %s\n", (tmpdir != NULL) ? tmpdir : "/tmp");
+
+		return 1;
+	}
+
+	printf("records,change_pct,stage,count,seconds,per_sec\n");
+
+	for (i = 0; (rv == 0) && (i < size_count); i++)
+	{
+		for (j = 0; (rv == 0) && (j < change_count); j++)
+		{
+			rv = zd_bench_run(dir, (size_t) sizes[i], (int) changes[j], hash_alg);
+		}
+	}
+
+	rmdir(dir);
+
+	if (rv != 0)
+	{
+		fprintf(stderr, "Benchmark failed (%s)\n", strerror(rv));
+
+		return 1;
+	}
+
+	return 0;
+}
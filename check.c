@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+
+/*
+ * Consistency check for the built-in tokenizer; generates zones of every
+ * shape that ldns-zonediff-gen emits and loads each of them through both
+ * the tokenizer and the ldns parser. The fingerprints must match, so that
+ * the zones compare equal across parsers, and the differences between
+ * the generated pairs of zones must be identical for both parsers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ldns/ldns.h>
+#include "dns_zonediff.h"
+#include "dns_zonehash.h"
+#include "dns_zonegen.h"
+
+/* Origin of the generated zones */
+#define ZD_CHECK_ORIGIN		"check.test."
+
+/* Differences between two zones, formatted as text */
+typedef struct _zd_check_diffs
+{
+	char**	lines;
+	size_t	count;
+	size_t	capacity;
+}
+zd_check_diffs;
+
+void usage(void)
+{
+	printf("ldns-zonediff-check\n");
+	printf("Copyright (C) 2018 SURFnet bv\n");
+	printf("All rights reserved (see LICENSE for more information)\n\n");
+	printf("Usage:\n");
+	printf("\tldns-zonediff-check [-n <records>] [-s <seed>]\n");
+	printf("\tldns-zonediff-check -h\n");
+	printf("\n");
+	printf("\tldns-zonediff-check generates pairs of zones of every shape\n");
+	printf("\tand verifies that the built-in tokenizer and the ldns parser\n");
+	printf("\tproduce identical fingerprints and differences.\n");
+	printf("\n");
+	printf("Optional arguments:\n");
+	printf("\t-n   Approximate number of records per zone (default: 2000)\n");
+	printf("\t-s   Seed for the generator (default: 0)\n");
+	printf("\t-h   Print this help message\n");
+}
+
+/* Write a pair of zones of the specified shape */
+static int zd_check_write_zones(const char* left_file, const char* right_file, const int shape, const size_t records, const uint64_t seed)
+{
+	zd_gen_opts	opts	= { 0 };
+	FILE*		left	= fopen(left_file, "w");
+	FILE*		right	= fopen(right_file, "w");
+	int		rv	= 0;
+
+	opts.origin = ZD_CHECK_ORIGIN;
+	opts.shape = shape;
+	opts.records = records;
+	opts.seed = seed;
+	opts.add_ratio = 500;
+	opts.del_ratio = 500;
+	opts.ttl_ratio = 500;
+	opts.serial_bump = 1;
+
+	if ((left == NULL) || (right == NULL))
+	{
+		rv = errno;
+
+		fprintf(stderr, "Failed to create zone files in the temporary directory\n");
+	}
+	else
+	{
+		rv = zd_gen_zones(&opts, left, right);
+	}
+
+	if ((left != NULL) && (fclose(left) != 0) && (rv == 0)) rv = EIO;
+	if ((right != NULL) && (fclose(right) != 0) && (rv == 0)) rv = EIO;
+
+	return rv;
+}
+
+/* Format a difference as a line of text and collect it */
+static int zd_check_collect(const int change, const ldns_rr* old_rr, const ldns_rr* new_rr, void* arg)
+{
+	zd_check_diffs*	diffs		= (zd_check_diffs*) arg;
+	char*		old_str		= (old_rr != NULL) ? ldns_rr2str(old_rr) : NULL;
+	char*		new_str		= (new_rr != NULL) ? ldns_rr2str(new_rr) : NULL;
+	const char*	old_text	= (old_str != NULL) ? old_str : "-\n";
+	const char*	new_text	= (new_str != NULL) ? new_str : "-\n";
+	size_t		len		= strlen(old_text) + strlen(new_text) + 16;
+	char*		line		= NULL;
+	int		rv		= 0;
+
+	if (((old_rr != NULL) && (old_str == NULL)) || ((new_rr != NULL) && (new_str == NULL)) ||
+	    ((line = (char*) malloc(len)) == NULL))
+	{
+		rv = ENOMEM;
+	}
+	else
+	{
+		snprintf(line, len, "%d %s| %s", change, old_text, new_text);
+	}
+
+	free(old_str);
+	free(new_str);
+
+	if (rv != 0) return rv;
+
+	if (diffs->count == diffs->capacity)
+	{
+		size_t	capacity	= diffs->capacity ? 2 * diffs->capacity : 256;
+		char**	lines		= (char**) realloc(diffs->lines, capacity * sizeof(char*));
+
+		if (lines == NULL)
+		{
+			free(line);
+
+			return ENOMEM;
+		}
+
+		diffs->lines = lines;
+		diffs->capacity = capacity;
+	}
+
+	diffs->lines[diffs->count++] = line;
+
+	return 0;
+}
+
+static void zd_check_diffs_free(zd_check_diffs* diffs)
+{
+	size_t	i	= 0;
+
+	for (i = 0; i < diffs->count; i++)
+	{
+		free(diffs->lines[i]);
+	}
+
+	free(diffs->lines);
+
+	memset(diffs, 0, sizeof(zd_check_diffs));
+}
+
+/*
+ * Check that a zone loaded through the tokenizer equals the same zone
+ * loaded through the ldns parser; returns the number of failures
+ */
+static int zd_check_same(const char* zone_file, const zd_zone* tok_zone, const zd_zone* ldns_zone, const zd_opts* opts)
+{
+	zd_check_diffs	diffs				= { 0 };
+	unsigned char	tok_digest[ZD_ZONEMD_SIZE]	= { 0 };
+	unsigned char	ldns_digest[ZD_ZONEMD_SIZE]	= { 0 };
+	int		failures			= 0;
+	int		rv				= 0;
+
+	if (zd_zone_count(tok_zone) != zd_zone_count(ldns_zone))
+	{
+		fprintf(stderr, "%s: tokenizer loaded %d records, ldns loaded %d\n", zone_file, zd_zone_count(tok_zone), zd_zone_count(ldns_zone));
+		failures++;
+	}
+
+	if ((zd_zone_zonemd(tok_zone, tok_digest) != zd_zone_zonemd(ldns_zone, ldns_digest)) ||
+	    (memcmp(tok_digest, ldns_digest, ZD_ZONEMD_SIZE) != 0))
+	{
+		fprintf(stderr, "%s: zone digests differ between the tokenizer and ldns\n", zone_file);
+		failures++;
+	}
+
+	if ((rv = zd_diff_zones(tok_zone, ldns_zone, opts, zd_check_collect, &diffs)) != 0)
+	{
+		fprintf(stderr, "%s: failed to compare zones (%s)\n", zone_file, strerror(rv));
+		failures++;
+	}
+	else if (diffs.count > 0)
+	{
+		fprintf(stderr, "%s: %zu records have different fingerprints, first:\n%s", zone_file, diffs.count, diffs.lines[0]);
+		failures++;
+	}
+
+	zd_check_diffs_free(&diffs);
+
+	return failures;
+}
+
+/*
+ * Check both parsers on one pair of generated zones; returns the number
+ * of failures
+ */
+static int zd_check_run(const char* dir, const int shape, const int hash_alg, const size_t records, const uint64_t seed)
+{
+	char		left_file[4096];
+	char		right_file[4096];
+	zd_opts		opts		= { 0 };
+	zd_zone*	left[2]		= { NULL, NULL };
+	zd_zone*	right[2]	= { NULL, NULL };
+	zd_check_diffs	diffs[2]	= { { 0 }, { 0 } };
+	size_t		i		= 0;
+	int		failures	= 0;
+	int		parser		= 0;
+	int		rv		= 0;
+
+	snprintf(left_file, sizeof(left_file), "%s/left.zone", dir);
+	snprintf(right_file, sizeof(right_file), "%s/right.zone", dir);
+
+	/* Compare every record the generator emits */
+	opts.origin = ZD_CHECK_ORIGIN;
+	opts.include_sigs = 1;
+	opts.include_keys = 1;
+	opts.include_nsecs = 1;
+	opts.include_delegs = 1;
+	opts.include_serial = 1;
+	opts.threads = 1;
+	opts.hash_alg = hash_alg;
+	opts.zonemd = 1;
+
+	if ((rv = zd_check_write_zones(left_file, right_file, shape, records, seed)) != 0)
+	{
+		fprintf(stderr, "Failed to generate zones (%s)\n", strerror(rv));
+		failures++;
+		goto cleanup;
+	}
+
+	for (parser = 0; parser < 2; parser++)
+	{
+		opts.ldns_parser = parser;
+
+		if (((rv = zd_zone_load(left_file, &opts, &left[parser])) != 0) ||
+		    ((rv = zd_zone_load(right_file, &opts, &right[parser])) != 0))
+		{
+			fprintf(stderr, "Failed to load zones with the %s (%s)\n", parser ? "ldns parser" : "tokenizer", strerror(rv));
+			failures++;
+			goto cleanup;
+		}
+
+		if ((rv = zd_diff_zones(left[parser], right[parser], &opts, zd_check_collect, &diffs[parser])) != 0)
+		{
+			fprintf(stderr, "Failed to compare zones with the %s (%s)\n", parser ? "ldns parser" : "tokenizer", strerror(rv));
+			failures++;
+			goto cleanup;
+		}
+	}
+
+	failures += zd_check_same(left_file, left[0], left[1], &opts);
+	failures += zd_check_same(right_file, right[0], right[1], &opts);
+
+	if (diffs[0].count != diffs[1].count)
+	{
+		fprintf(stderr, "Tokenizer found %zu differences, ldns found %zu\n", diffs[0].count, diffs[1].count);
+		failures++;
+	}
+
+	for (i = 0; (i < diffs[0].count) && (i < diffs[1].count); i++)
+	{
+		if (strcmp(diffs[0].lines[i], diffs[1].lines[i]) != 0)
+		{
+			fprintf(stderr, "Difference %zu differs between parsers:\ntokenizer: %sldns:      %s", i, diffs[0].lines[i], diffs[1].lines[i]);
+			failures++;
+			break;
+		}
+	}
+
+cleanup:
+	for (parser = 0; parser < 2; parser++)
+	{
+		zd_zone_free(left[parser]);
+		zd_zone_free(right[parser]);
+		zd_check_diffs_free(&diffs[parser]);
+	}
+
+	unlink(left_file);
+	unlink(right_file);
+
+	printf("%s shape %d, %s: %zu records\n", failures ? "FAIL" : "ok  ", shape, (hash_alg == ZD_HASH_FP128) ? "fp128" : "sha256", records);
+
+	return failures;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t		records		= 2000;
+	uint64_t	seed		= 0;
+	const char*	tmpdir		= getenv("TMPDIR");
+	char		dir[4096];
+	char*		end		= NULL;
+	int		c		= 0;
+	int		shape		= 0;
+	int		failures	= 0;
+
+	while ((c = getopt(argc, argv, "n:s:h")) != -1)
+	{
+		switch(c)
+		{
+		case 'n':
+			records = strtoul(optarg, &end, 10);
+
+			if ((end == optarg) || (*end != '\0'))
+			{
+				fprintf(stderr, "Invalid number of records specified\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 's':
+			seed = strtoull(optarg, &end, 10);
+
+			if ((end == optarg) || (*end != '\0'))
+			{
+				fprintf(stderr, "Invalid seed specified\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 'h':
+		default:
+			usage();
+			return 0;
+		}
+	}
+
+	snprintf(dir, sizeof(dir), "%s/ldns-zonediff-check.XXXXXX", (tmpdir != NULL) ? tmpdir : "/tmp");
+
+	if (mkdtemp(dir) == NULL)
+	{
+		fprintf(stderr, "Failed to create a temporary directory in %s\n", (tmpdir != NULL) ? tmpdir : "/tmp");
+
+		return 1;
+	}
+
+	for (shape = 0; shape < ZD_GEN_SHAPES; shape++)
+	{
+		failures += zd_check_run(dir, shape, ZD_HASH_FP128, records, seed);
+		failures += zd_check_run(dir, shape, ZD_HASH_SHA256, records, seed);
+	}
+
+	rmdir(dir);
+
+	if (failures > 0)
+	{
+		fprintf(stderr, "%d checks failed\n", failures);
+
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include "dns_zonearena.h"
+
+/* Allocations are rounded up to a multiple of this */
+#define ZD_ARENA_ALIGN		8
+
+struct _zd_arena_block
+{
+	zd_arena_block*	next;
+	size_t		size;
+	size_t		used;
+	uint64_t	data[];
+};
+
+/* Allocate size bytes, aligned to 8 bytes, or return NULL */
+void* zd_arena_alloc(zd_arena* arena, const size_t size)
+{
+	assert(arena != NULL);
+
+	const size_t	rounded	= (size + ZD_ARENA_ALIGN - 1) & ~(ZD_ARENA_ALIGN - 1);
+	zd_arena_block*	block	= arena->head;
+	void*		rv	= NULL;
+
+	if ((block == NULL) || (block->size - block->used < rounded))
+	{
+		/* Oversized allocations get a block of their own */
+		const size_t	block_size	= (rounded > ZD_ARENA_BLOCK_SIZE) ? rounded : ZD_ARENA_BLOCK_SIZE;
+
+		if ((block = (zd_arena_block*) malloc(sizeof(zd_arena_block) + block_size)) == NULL)
+		{
+			return NULL;
+		}
+
+		block->size = block_size;
+		block->used = 0;
+
+		/* Keep filling the current block if the new one is oversized */
+		if ((arena->head != NULL) && (block_size > ZD_ARENA_BLOCK_SIZE))
+		{
+			block->next = arena->head->next;
+			arena->head->next = block;
+		}
+		else
+		{
+			block->next = arena->head;
+			arena->head = block;
+		}
+
+		arena->total += block_size;
+	}
+
+	rv = (unsigned char*) block->data + block->used;
+	block->used += rounded;
+	arena->used += rounded;
+
+	return rv;
+}
+
+/* Move all allocations from one arena to another, leaving it empty */
+void zd_arena_move(zd_arena* to, zd_arena* from)
+{
+	assert(to != NULL);
+	assert(from != NULL);
+
+	zd_arena_block*	tail	= from->head;
+
+	if (tail == NULL) return;
+
+	/* The blocks of from go behind the current block of to */
+	while (tail->next != NULL)
+	{
+		tail = tail->next;
+	}
+
+	if (to->head == NULL)
+	{
+		to->head = from->head;
+	}
+	else
+	{
+		tail->next = to->head->next;
+		to->head->next = from->head;
+	}
+
+	to->total += from->total;
+	to->used += from->used;
+
+	from->head = NULL;
+	from->total = 0;
+	from->used = 0;
+}
+
+/* Release all memory held by an arena */
+void zd_arena_free(zd_arena* arena)
+{
+	assert(arena != NULL);
+
+	zd_arena_block*	block	= arena->head;
+
+	while (block != NULL)
+	{
+		zd_arena_block*	next	= block->next;
+
+		free(block);
+		block = next;
+	}
+
+	arena->head = NULL;
+	arena->total = 0;
+	arena->used = 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#ifndef _LDNS_ZONEDIFF_DNS_ZONEARENA_H
+#define _LDNS_ZONEDIFF_DNS_ZONEARENA_H
+
+#include <stddef.h>
+
+/* Size of the blocks an arena allocates from */
+#define ZD_ARENA_BLOCK_SIZE	(4 * 1024 * 1024)
+
+typedef struct _zd_arena_block zd_arena_block;
+
+/*
+ * Bump allocator for data that lives as long as a zone; there is no way
+ * to free individual allocations, only the arena as a whole
+ */
+typedef struct _zd_arena
+{
+	zd_arena_block*	head;
+	size_t		total;		/* Bytes allocated from the system */
+	size_t		used;		/* Bytes handed out */
+}
+zd_arena;
+
+/* Allocate size bytes, aligned to 8 bytes, or return NULL */
+void* zd_arena_alloc(zd_arena* arena, const size_t size);
+
+/* Move all allocations from one arena to another, leaving it empty */
+void zd_arena_move(zd_arena* to, zd_arena* from);
+
+/* Release all memory held by an arena */
+void zd_arena_free(zd_arena* arena);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONEARENA_H */
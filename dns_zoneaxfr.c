@@ -0,0 +1,656 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <ldns/ldns.h>
+#include "dns_zoneaxfr.h"
+#include "dns_zonecomp.h"
+
+/* Largest RR in wire format: owner, fixed fields and RDATA */
+#define ZD_AXFR_WIRE_MAX	(LDNS_MAX_DOMAINLEN + 1 + 10 + 65535)
+
+/* Size of a DNS message header */
+#define ZD_AXFR_HEADER_SIZE	12
+
+/* Amount of data read from a stream at a time */
+#define ZD_AXFR_READ_SIZE	(1024 * 1024)
+
+/* Returned by the RDATA decoders if ldns should decode the record instead */
+#define ZD_AXFR_FALLBACK	-1
+
+struct _zd_axfr
+{
+	const uint8_t*	data;
+	size_t		size;
+	size_t		pos;
+	size_t		end;
+	int		msg_no;
+	const uint8_t*	msg;
+	size_t		msg_len;
+	size_t		rr_pos;
+	unsigned int	an_left;
+	int		first;
+	uint8_t		wire[ZD_AXFR_WIRE_MAX];
+	size_t		wire_len;
+};
+
+/* Read all data from a stream into memory */
+static int zd_axfr_read_fp(FILE* fp, zd_map* map)
+{
+	char*	data	= NULL;
+	size_t	size	= 0;
+	size_t	cap	= 0;
+	size_t	n	= 0;
+
+	for (;;)
+	{
+		if (size == cap)
+		{
+			char*	new_data	= (char*) realloc(data, cap + ZD_AXFR_READ_SIZE);
+
+			if (new_data == NULL)
+			{
+				free(data);
+
+				return ENOMEM;
+			}
+
+			data = new_data;
+			cap += ZD_AXFR_READ_SIZE;
+		}
+
+		if ((n = fread(&data[size], 1, cap - size, fp)) == 0)
+		{
+			if (ferror(fp))
+			{
+				free(data);
+
+				return EIO;
+			}
+
+			break;
+		}
+
+		size += n;
+	}
+
+	map->data = data;
+	map->size = size;
+
+	return 0;
+}
+
+/* Read AXFR data from a file, or from stdin if the file is "-" */
+int zd_axfr_read(const char* zone_file, zd_axfr_data* data)
+{
+	assert(zone_file != NULL);
+	assert(data != NULL);
+
+	FILE*	fp		= NULL;
+	int	compressed	= ZD_COMP_NONE;
+	int	rv		= 0;
+
+	data->mapped = 0;
+
+	if (strcmp(zone_file, "-") == 0)
+	{
+		return zd_axfr_read_fp(stdin, &data->map);
+	}
+
+	/* Regular files are mapped unless they are compressed; anything else
+	 * is read until it ends */
+	if (((compressed = zd_comp_detect(zone_file)) == ZD_COMP_NONE) &&
+	    ((rv = zd_map_file(zone_file, &data->map)) != ENODEV))
+	{
+		data->mapped = (rv == 0);
+
+		return rv;
+	}
+
+	fp = (compressed != ZD_COMP_NONE) ? zd_comp_fopen(zone_file, compressed) : fopen(zone_file, "rb");
+
+	if (fp == NULL)
+	{
+		return errno;
+	}
+
+	rv = zd_axfr_read_fp(fp, &data->map);
+
+	/* Corrupt compressed data only shows when closing */
+	if ((fclose(fp) != 0) && (rv == 0))
+	{
+		zd_axfr_release(data);
+
+		rv = EIO;
+	}
+
+	return rv;
+}
+
+/* Release the data returned by zd_axfr_read() */
+void zd_axfr_release(zd_axfr_data* data)
+{
+	assert(data != NULL);
+
+	if (data->mapped)
+	{
+		zd_unmap_file(&data->map);
+	}
+	else
+	{
+		free((void*) data->map.data);
+	}
+
+	data->map.data = NULL;
+	data->map.size = 0;
+	data->mapped = 0;
+}
+
+/* Read a two-byte integer in network byte order */
+static inline uint16_t zd_axfr_get16(const uint8_t* p)
+{
+	return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+/*
+ * Split AXFR data in at most max_chunks ranges of whole messages, each
+ * about the same size
+ */
+int zd_axfr_split(const zd_map* map, const int max_chunks, zd_chunk** chunks, int* chunk_count)
+{
+	assert(map != NULL);
+	assert(max_chunks > 0);
+	assert(chunks != NULL);
+	assert(chunk_count != NULL);
+
+	const uint8_t*	data	= (const uint8_t*) map->data;
+	zd_chunk*	c	= (zd_chunk*) calloc(max_chunks, sizeof(zd_chunk));
+	size_t		pos	= 0;
+	int		msg_no	= 0;
+	int		n	= 1;
+
+	*chunks = NULL;
+	*chunk_count = 0;
+
+	if (c == NULL)
+	{
+		return ENOMEM;
+	}
+
+	c[0].start = 0;
+
+	while (pos < map->size)
+	{
+		/* Start a new range at the first message past its share of the data */
+		if ((n < max_chunks) && (pos > (size_t) c[n - 1].start) && (pos >= map->size / max_chunks * n))
+		{
+			c[n - 1].end = (off_t) pos;
+			c[n].start = (off_t) pos;
+			c[n].line_no = msg_no;
+			n++;
+		}
+
+		if ((map->size - pos < 2) || (map->size - pos - 2 < zd_axfr_get16(&data[pos])))
+		{
+			free(c);
+
+			return EINVAL;
+		}
+
+		pos += 2 + zd_axfr_get16(&data[pos]);
+		msg_no++;
+	}
+
+	c[n - 1].end = (off_t) map->size;
+
+	*chunks = c;
+	*chunk_count = n;
+
+	return 0;
+}
+
+/* Create a reader for the answer records in a range of AXFR data */
+zd_axfr* zd_axfr_new(const zd_map* map, const zd_chunk* chunk)
+{
+	assert(map != NULL);
+	assert(chunk != NULL);
+
+	zd_axfr*	t	= (zd_axfr*) malloc(sizeof(zd_axfr));
+
+	if (t == NULL) return NULL;
+
+	t->data = (const uint8_t*) map->data;
+	t->size = map->size;
+	t->pos = (size_t) chunk->start;
+	t->end = (chunk->end < 0) ? map->size : (size_t) chunk->end;
+	t->msg_no = chunk->line_no;
+	t->msg = NULL;
+	t->msg_len = 0;
+	t->rr_pos = 0;
+	t->an_left = 0;
+	t->first = (chunk->start == 0);
+	t->wire_len = 0;
+
+	return t;
+}
+
+/* Free a reader */
+void zd_axfr_free(zd_axfr* t)
+{
+	free(t);
+}
+
+/* Return the number of the current message in the data, counting from 1 */
+int zd_axfr_msg_no(const zd_axfr* t)
+{
+	return t->msg_no;
+}
+
+/* Move past the name at *pos in the current message; returns 0 on success */
+static int zd_axfr_skip_name(const zd_axfr* t, size_t* pos)
+{
+	size_t	p	= *pos;
+
+	while (p < t->msg_len)
+	{
+		if ((t->msg[p] & 0xc0) == 0xc0)
+		{
+			*pos = p + 2;
+
+			return 0;
+		}
+
+		if (t->msg[p] == 0)
+		{
+			*pos = p + 1;
+
+			return 0;
+		}
+
+		p += 1 + t->msg[p];
+	}
+
+	return 1;
+}
+
+/* Move on to the next message in the range that has answer records */
+static int zd_axfr_next_msg(zd_axfr* t)
+{
+	unsigned int	qd_count	= 0;
+	size_t		len		= 0;
+
+	while (t->an_left == 0)
+	{
+		if (t->pos >= t->end) return ZD_TOK_END;
+
+		/* The range only holds whole messages, see zd_axfr_split() */
+		len = zd_axfr_get16(&t->data[t->pos]);
+
+		t->msg = &t->data[t->pos + 2];
+		t->msg_len = len;
+		t->pos += 2 + len;
+		t->msg_no++;
+
+		if (len < ZD_AXFR_HEADER_SIZE) return LDNS_STATUS_WIRE_INCOMPLETE_HEADER;
+
+		/* A transfer that failed part way cannot be compared */
+		if (LDNS_RCODE_WIRE(t->msg) != LDNS_RCODE_NOERROR) return LDNS_STATUS_ERR;
+
+		qd_count = LDNS_QDCOUNT(t->msg);
+		t->an_left = LDNS_ANCOUNT(t->msg);
+		t->rr_pos = ZD_AXFR_HEADER_SIZE;
+
+		/* Skip the question, if the message repeats it */
+		for (; qd_count > 0; qd_count--)
+		{
+			if ((zd_axfr_skip_name(t, &t->rr_pos) != 0) || (t->rr_pos + 4 > t->msg_len))
+			{
+				return LDNS_STATUS_WIRE_INCOMPLETE_QUESTION;
+			}
+
+			t->rr_pos += 4;
+		}
+	}
+
+	return LDNS_STATUS_OK;
+}
+
+/*
+ * Decompress the name at *pos in the current message and append it to the
+ * record, in lower case if asked to; *pos moves past the name as stored
+ */
+static int zd_axfr_put_name(zd_axfr* t, size_t* pos, const int lower)
+{
+	const uint8_t*	msg	= t->msg;
+	uint8_t*	out	= &t->wire[t->wire_len];
+	size_t		p	= *pos;
+	size_t		len	= 0;
+	size_t		target	= 0;
+	size_t		i	= 0;
+	int		jumped	= 0;
+	uint8_t		c	= 0;
+
+	if (sizeof(t->wire) - t->wire_len < LDNS_MAX_DOMAINLEN + 1) return LDNS_STATUS_PACKET_OVERFLOW;
+
+	for (;;)
+	{
+		if (p >= t->msg_len) return LDNS_STATUS_PACKET_OVERFLOW;
+
+		c = msg[p];
+
+		if ((c & 0xc0) == 0xc0)
+		{
+			if (p + 1 >= t->msg_len) return LDNS_STATUS_PACKET_OVERFLOW;
+
+			target = ((c & 0x3f) << 8) | msg[p + 1];
+
+			/* Only pointing backwards guarantees that decompressing ends */
+			if (target >= p) return LDNS_STATUS_INVALID_POINTER;
+
+			if (!jumped)
+			{
+				*pos = p + 2;
+				jumped = 1;
+			}
+
+			p = target;
+			continue;
+		}
+
+		if ((c & 0xc0) != 0) return LDNS_STATUS_LABEL_OVERFLOW;
+
+		if (len + 1 + c > LDNS_MAX_DOMAINLEN) return LDNS_STATUS_DOMAINNAME_OVERFLOW;
+
+		if (p + 1 + c > t->msg_len) return LDNS_STATUS_PACKET_OVERFLOW;
+
+		out[len++] = c;
+
+		for (i = 0; i < c; i++)
+		{
+			out[len] = msg[p + 1 + i];
+
+			if (lower && (out[len] >= 'A') && (out[len] <= 'Z')) out[len] += 'a' - 'A';
+
+			len++;
+		}
+
+		p += 1 + c;
+
+		if (c == 0) break;
+	}
+
+	if (!jumped) *pos = p;
+
+	t->wire_len += len;
+
+	return LDNS_STATUS_OK;
+}
+
+/* Append part of the RDATA to the record as it is */
+static int zd_axfr_put(zd_axfr* t, size_t* pos, const size_t rd_end, const size_t len)
+{
+	if ((*pos + len > rd_end) || (t->wire_len + len > sizeof(t->wire))) return LDNS_STATUS_WIRE_RDATA_ERR;
+
+	memcpy(&t->wire[t->wire_len], &t->msg[*pos], len);
+
+	t->wire_len += len;
+	*pos += len;
+
+	return LDNS_STATUS_OK;
+}
+
+/* Return 1 if ldns knows of a domain name in the RDATA of a type */
+static int zd_axfr_has_names(const uint16_t type)
+{
+	const ldns_rr_descriptor*	desc	= ldns_rr_descript(type);
+	size_t				max	= 0;
+	size_t				i	= 0;
+
+	if (desc == NULL) return 0;
+
+	/* Variable length RDATA repeats the type of its last field */
+	max = ldns_rr_descriptor_maximum(desc);
+
+	for (i = 0; (i < max) && (i < 64); i++)
+	{
+		if (ldns_rr_descriptor_field_type(desc, i) == LDNS_RDF_TYPE_DNAME) return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Decode the RDATA of a type we know how to handle; names are lower case
+ * in canonical form, except for the next name of NSEC (RFC 6840)
+ */
+static int zd_axfr_rdata(zd_axfr* t, const uint16_t type, size_t pos, const size_t rd_end)
+{
+	int	rv	= LDNS_STATUS_OK;
+
+	switch(type)
+	{
+	case LDNS_RR_TYPE_NS:
+	case LDNS_RR_TYPE_CNAME:
+	case LDNS_RR_TYPE_DNAME:
+	case LDNS_RR_TYPE_PTR:
+		rv = zd_axfr_put_name(t, &pos, 1);
+		break;
+	case LDNS_RR_TYPE_MX:
+		if ((rv = zd_axfr_put(t, &pos, rd_end, 2)) != LDNS_STATUS_OK) return rv;
+
+		rv = zd_axfr_put_name(t, &pos, 1);
+		break;
+	case LDNS_RR_TYPE_SRV:
+		if ((rv = zd_axfr_put(t, &pos, rd_end, 6)) != LDNS_STATUS_OK) return rv;
+
+		rv = zd_axfr_put_name(t, &pos, 1);
+		break;
+	case LDNS_RR_TYPE_SOA:
+		if (((rv = zd_axfr_put_name(t, &pos, 1)) != LDNS_STATUS_OK) ||
+		    ((rv = zd_axfr_put_name(t, &pos, 1)) != LDNS_STATUS_OK))
+		{
+			return rv;
+		}
+
+		rv = zd_axfr_put(t, &pos, rd_end, 20);
+		break;
+	case LDNS_RR_TYPE_RRSIG:
+		if (((rv = zd_axfr_put(t, &pos, rd_end, 18)) != LDNS_STATUS_OK) ||
+		    ((rv = zd_axfr_put_name(t, &pos, 1)) != LDNS_STATUS_OK))
+		{
+			return rv;
+		}
+
+		rv = (pos <= rd_end) ? zd_axfr_put(t, &pos, rd_end, rd_end - pos) : LDNS_STATUS_WIRE_RDATA_ERR;
+		break;
+	case LDNS_RR_TYPE_NSEC:
+		if ((rv = zd_axfr_put_name(t, &pos, 0)) != LDNS_STATUS_OK) return rv;
+
+		rv = (pos <= rd_end) ? zd_axfr_put(t, &pos, rd_end, rd_end - pos) : LDNS_STATUS_WIRE_RDATA_ERR;
+		break;
+	default:
+		if (zd_axfr_has_names(type)) return ZD_AXFR_FALLBACK;
+
+		/* Without names, the RDATA is in canonical form already */
+		rv = zd_axfr_put(t, &pos, rd_end, rd_end - pos);
+		break;
+	}
+
+	if ((rv == LDNS_STATUS_OK) && (pos != rd_end))
+	{
+		return LDNS_STATUS_WIRE_RDATA_ERR;
+	}
+
+	return rv;
+}
+
+/* Let ldns decode the record at rr_pos, for types with less common layouts */
+static int zd_axfr_ldns(zd_axfr* t, const size_t rr_pos, zd_tok_rr* rec)
+{
+	size_t		pos		= rr_pos;
+	ldns_rr*	rr		= NULL;
+	uint8_t*	wire		= NULL;
+	size_t		wire_size	= 0;
+	int		rv		= 0;
+
+	if ((rv = ldns_wire2rr(&rr, t->msg, t->msg_len, &pos, LDNS_SECTION_ANSWER)) != LDNS_STATUS_OK)
+	{
+		return rv;
+	}
+
+	ldns_rr2canonical(rr);
+
+	if ((rv = ldns_rr2wire(&wire, rr, LDNS_SECTION_ANSWER, &wire_size)) != LDNS_STATUS_OK)
+	{
+		ldns_rr_free(rr);
+
+		return rv;
+	}
+
+	if (wire_size > sizeof(t->wire))
+	{
+		free(wire);
+		ldns_rr_free(rr);
+
+		return LDNS_STATUS_ERR;
+	}
+
+	memcpy(t->wire, wire, wire_size);
+	free(wire);
+
+	t->wire_len = wire_size;
+
+	rec->ttl_ofs = ldns_rdf_size(ldns_rr_owner(rr)) + 4;
+	rec->rr = rr;
+
+	return LDNS_STATUS_OK;
+}
+
+/* Read the next record in the range */
+int zd_axfr_next(zd_axfr* t, zd_tok_rr* rec)
+{
+	assert(t != NULL);
+	assert(rec != NULL);
+
+	size_t		rr_pos	= 0;
+	size_t		pos	= 0;
+	size_t		rd_end	= 0;
+	size_t		fixed	= 0;
+	uint16_t	type	= 0;
+	int		first	= 0;
+	int		rv	= 0;
+
+	rec->rr = NULL;
+
+	if ((rv = zd_axfr_next_msg(t)) != LDNS_STATUS_OK)
+	{
+		return rv;
+	}
+
+	rr_pos = pos = t->rr_pos;
+	t->wire_len = 0;
+
+	if ((rv = zd_axfr_put_name(t, &pos, 1)) != LDNS_STATUS_OK)
+	{
+		return rv;
+	}
+
+	/* Type, class, TTL and RDLENGTH */
+	if (pos + 10 > t->msg_len)
+	{
+		return LDNS_STATUS_PACKET_OVERFLOW;
+	}
+
+	fixed = t->wire_len;
+	type = zd_axfr_get16(&t->msg[pos]);
+	rd_end = pos + 10 + zd_axfr_get16(&t->msg[pos + 8]);
+
+	if (rd_end > t->msg_len)
+	{
+		return LDNS_STATUS_PACKET_OVERFLOW;
+	}
+
+	memcpy(&t->wire[fixed], &t->msg[pos], 8);
+	t->wire_len += 10;
+	pos += 10;
+
+	rec->ttl_ofs = fixed + 4;
+
+	rv = zd_axfr_rdata(t, type, pos, rd_end);
+
+	if (rv == ZD_AXFR_FALLBACK)
+	{
+		rv = zd_axfr_ldns(t, rr_pos, rec);
+	}
+	else if ((rv == LDNS_STATUS_OK) && (t->wire_len - fixed - 10 > 65535))
+	{
+		rv = LDNS_STATUS_WIRE_RDATA_ERR;
+	}
+	else if (rv == LDNS_STATUS_OK)
+	{
+		t->wire[fixed + 8] = (uint8_t) ((t->wire_len - fixed - 10) >> 8);
+		t->wire[fixed + 9] = (uint8_t) (t->wire_len - fixed - 10);
+	}
+
+	if (rv != LDNS_STATUS_OK)
+	{
+		return rv;
+	}
+
+	t->rr_pos = rd_end;
+	t->an_left--;
+
+	first = t->first;
+	t->first = 0;
+
+	/* The transfer ends with the SOA it started with (RFC 5936, 2.2) */
+	if ((type == LDNS_RR_TYPE_SOA) && !first && (t->an_left == 0) && (t->pos >= t->size))
+	{
+		if (rec->rr != NULL)
+		{
+			ldns_rr_free(rec->rr);
+			rec->rr = NULL;
+		}
+
+		return ZD_TOK_END;
+	}
+
+	rec->wire = t->wire;
+	rec->wire_len = t->wire_len;
+	rec->type = type;
+	rec->ttl = ((uint32_t) t->wire[rec->ttl_ofs] << 24) | ((uint32_t) t->wire[rec->ttl_ofs + 1] << 16) |
+	           ((uint32_t) t->wire[rec->ttl_ofs + 2] << 8) | (uint32_t) t->wire[rec->ttl_ofs + 3];
+
+	return LDNS_STATUS_OK;
+}
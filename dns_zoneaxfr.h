@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LDNS_ZONEDIFF_DNS_ZONEAXFR_H
+#define _LDNS_ZONEDIFF_DNS_ZONEAXFR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ldns/ldns.h>
+#include "dns_zonesplit.h"
+#include "dns_zonetok.h"
+
+/*
+ * AXFR data in memory: a stream of DNS messages, each preceded by its
+ * length as a two-byte integer in network byte order (RFC 1035, 4.2.2)
+ */
+typedef struct _zd_axfr_data
+{
+	zd_map	map;
+	int	mapped;
+}
+zd_axfr_data;
+
+typedef struct _zd_axfr zd_axfr;
+
+/*
+ * Read AXFR data from a file, which may be compressed, or from stdin if
+ * the file is "-"; returns 0 on success
+ */
+int zd_axfr_read(const char* zone_file, zd_axfr_data* data);
+
+/* Release the data returned by zd_axfr_read() */
+void zd_axfr_release(zd_axfr_data* data);
+
+/*
+ * Split AXFR data in at most max_chunks ranges of whole messages; the
+ * line_no of each range is the number of messages before it. Returns
+ * EINVAL if the data does not consist of whole messages.
+ */
+int zd_axfr_split(const zd_map* map, const int max_chunks, zd_chunk** chunks, int* chunk_count);
+
+/* Create a reader for the answer records in a range of AXFR data */
+zd_axfr* zd_axfr_new(const zd_map* map, const zd_chunk* chunk);
+
+/* Free a reader */
+void zd_axfr_free(zd_axfr* axfr);
+
+/*
+ * Read the next record in the range, with its names decompressed and in
+ * canonical form; the SOA that closes the transfer ends the data. Returns
+ * LDNS_STATUS_OK, ZD_TOK_END or an ldns error status. The wire data is
+ * valid until the next call.
+ */
+int zd_axfr_next(zd_axfr* axfr, zd_tok_rr* rec);
+
+/* Return the number of the current message in the data, counting from 1 */
+int zd_axfr_msg_no(const zd_axfr* axfr);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONEAXFR_H */
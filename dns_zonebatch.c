@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "dns_zonebatch.h"
+
+/* Initial number of pairs a batch has room for */
+#define ZD_BATCH_INITIAL_SIZE	256
+
+/* A pair of zones to compare and its result */
+typedef struct _zd_batch_job
+{
+	char*	left_zone;
+	char*	right_zone;
+	char*	origin;
+	char*	name;
+	int	name_len;
+	int	line_no;
+	int	rv;
+}
+zd_batch_job;
+
+/* State shared by the workers of a batch */
+typedef struct _zd_batch_state
+{
+	const zd_opts*	opts;
+	const char*	out_dir;
+	zd_batch_job*	jobs;
+	size_t		count;
+	size_t		capacity;
+	size_t		next;
+	pthread_mutex_t	lock;
+}
+zd_batch_state;
+
+/* Free the jobs of a batch */
+static void zd_batch_free(zd_batch_state* batch)
+{
+	size_t	i	= 0;
+
+	for (i = 0; i < batch->count; i++)
+	{
+		free(batch->jobs[i].left_zone);
+		free(batch->jobs[i].right_zone);
+		free(batch->jobs[i].origin);
+	}
+
+	free(batch->jobs);
+}
+
+/* Read the pairs to compare from a manifest */
+static int zd_batch_read(zd_batch_state* batch, const char* manifest)
+{
+	FILE*	fd	= fopen(manifest, "r");
+	char	line[3 * PATH_MAX];
+	int	line_no	= 0;
+
+	if (fd == NULL)
+	{
+		fprintf(stderr, "Failed to open manifest %s\n", manifest);
+
+		return errno;
+	}
+
+	while (fgets(line, sizeof(line), fd) != NULL)
+	{
+		char*		save	= NULL;
+		char*		left	= strtok_r(line, " \t\r\n", &save);
+		char*		right	= (left != NULL) ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+		char*		origin	= (right != NULL) ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+		zd_batch_job*	job	= NULL;
+
+		line_no++;
+
+		if ((left == NULL) || (left[0] == '#')) continue;
+
+		if ((right == NULL) || (strtok_r(NULL, " \t\r\n", &save) != NULL))
+		{
+			fprintf(stderr, "Invalid entry on line %d of manifest %s\n", line_no, manifest);
+
+			fclose(fd);
+
+			return EINVAL;
+		}
+
+		if (batch->count == batch->capacity)
+		{
+			size_t		capacity	= batch->capacity ? 2 * batch->capacity : ZD_BATCH_INITIAL_SIZE;
+			zd_batch_job*	jobs		= (zd_batch_job*) realloc(batch->jobs, capacity * sizeof(zd_batch_job));
+
+			if (jobs == NULL)
+			{
+				fclose(fd);
+
+				return ENOMEM;
+			}
+
+			batch->jobs = jobs;
+			batch->capacity = capacity;
+		}
+
+		job = &batch->jobs[batch->count++];
+
+		memset(job, 0, sizeof(zd_batch_job));
+
+		job->left_zone = strdup(left);
+		job->right_zone = strdup(right);
+		job->origin = (origin != NULL) ? strdup(origin) : NULL;
+		job->line_no = line_no;
+
+		if ((job->left_zone == NULL) || (job->right_zone == NULL) || ((origin != NULL) && (job->origin == NULL)))
+		{
+			fclose(fd);
+
+			return ENOMEM;
+		}
+
+		/* Output is named after the origin or else the file name of the right zone */
+		if (job->origin != NULL)
+		{
+			job->name = job->origin;
+		}
+		else
+		{
+			job->name = strrchr(job->right_zone, '/');
+			job->name = (job->name != NULL) ? job->name + 1 : job->right_zone;
+		}
+
+		/* Leave out the final dot of an origin */
+		job->name_len = (int) strlen(job->name);
+
+		if ((job->name_len > 1) && (job->name[job->name_len - 1] == '.')) job->name_len--;
+	}
+
+	fclose(fd);
+
+	return 0;
+}
+
+/* Order jobs by the name of their output */
+static int zd_batch_name_cmp(const void* a, const void* b)
+{
+	const zd_batch_job*	job_a	= *(const zd_batch_job* const*) a;
+	const zd_batch_job*	job_b	= *(const zd_batch_job* const*) b;
+	int			rv	= memcmp(job_a->name, job_b->name, (job_a->name_len < job_b->name_len) ? job_a->name_len : job_b->name_len);
+
+	if (rv != 0) return rv;
+
+	return (job_a->name_len > job_b->name_len) - (job_a->name_len < job_b->name_len);
+}
+
+/* Make sure that no two pairs write to the same output file */
+static int zd_batch_check_names(zd_batch_state* batch, const char* manifest)
+{
+	zd_batch_job**	sorted	= NULL;
+	size_t		i	= 0;
+	int		rv	= 0;
+
+	if (batch->count < 2) return 0;
+
+	if ((sorted = (zd_batch_job**) malloc(batch->count * sizeof(zd_batch_job*))) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	for (i = 0; i < batch->count; i++)
+	{
+		sorted[i] = &batch->jobs[i];
+	}
+
+	qsort(sorted, batch->count, sizeof(zd_batch_job*), zd_batch_name_cmp);
+
+	for (i = 1; i < batch->count; i++)
+	{
+		if (zd_batch_name_cmp(&sorted[i - 1], &sorted[i]) == 0)
+		{
+			fprintf(stderr, "Entries on lines %d and %d of manifest %s would both be written to %.*s.diff\n",
+				(sorted[i - 1]->line_no < sorted[i]->line_no) ? sorted[i - 1]->line_no : sorted[i]->line_no,
+				(sorted[i - 1]->line_no < sorted[i]->line_no) ? sorted[i]->line_no : sorted[i - 1]->line_no,
+				manifest, sorted[i]->name_len, sorted[i]->name);
+
+			rv = EEXIST;
+		}
+	}
+
+	free(sorted);
+
+	return rv;
+}
+
+/* Copy the contents of a file to stdout */
+static int zd_batch_copy(const int fd)
+{
+	char	buf[65536];
+	ssize_t	len	= 0;
+
+	if (lseek(fd, 0, SEEK_SET) != 0) return errno;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+	{
+		if (fwrite(buf, 1, len, stdout) != (size_t) len) return EIO;
+	}
+
+	return (len < 0) ? errno : (fflush(stdout) != 0) ? EIO : 0;
+}
+
+/*
+ * Compare one pair into a temporary file, which is renamed into the
+ * output directory or copied to stdout in one piece when it is complete
+ */
+static int zd_batch_run_job(zd_batch_state* batch, zd_batch_job* job)
+{
+	zd_opts		opts		= *batch->opts;
+	const char*	tmp_dir		= (batch->out_dir != NULL) ? batch->out_dir : getenv("TMPDIR");
+	const char*	name		= job->name;
+	const int	name_len	= job->name_len;
+	char		tmp_name[PATH_MAX];
+	char		out_name[PATH_MAX];
+	int		diffcount	= 0;
+	int		fd		= -1;
+	int		rv		= 0;
+
+	if (tmp_dir == NULL) tmp_dir = "/tmp";
+
+	if (job->origin != NULL)
+	{
+		opts.origin = job->origin;
+	}
+
+	snprintf(tmp_name, sizeof(tmp_name), "%s/.%.*s.XXXXXX", tmp_dir, name_len, name);
+
+	if ((fd = mkstemp(tmp_name)) < 0)
+	{
+		fprintf(stderr, "Failed to create a temporary file in %s\n", tmp_dir);
+
+		return 2;
+	}
+
+	/* Output to stdout does not need the file to have a name; output
+	 * files get the permissions of a file made by ldns-zonediff > file */
+	if (batch->out_dir == NULL)
+	{
+		unlink(tmp_name);
+		tmp_name[0] = '\0';
+	}
+	else
+	{
+		fchmod(fd, 0644);
+	}
+
+	if (zd_diff_files(job->left_zone, job->right_zone, &opts, fd, &diffcount) != 0)
+	{
+		rv = 2;
+	}
+	else if (batch->out_dir != NULL)
+	{
+		snprintf(out_name, sizeof(out_name), "%s/%.*s.diff", batch->out_dir, name_len, name);
+
+		if (rename(tmp_name, out_name) != 0)
+		{
+			fprintf(stderr, "Failed to write %s\n", out_name);
+
+			rv = 2;
+		}
+		else
+		{
+			tmp_name[0] = '\0';
+		}
+	}
+	else
+	{
+		pthread_mutex_lock(&batch->lock);
+
+		if (zd_batch_copy(fd) != 0)
+		{
+			fprintf(stderr, "Failed to write the differences between %s and %s to standard output\n", job->left_zone, job->right_zone);
+
+			rv = 2;
+		}
+
+		pthread_mutex_unlock(&batch->lock);
+	}
+
+	close(fd);
+
+	if (tmp_name[0] != '\0') unlink(tmp_name);
+
+	if (rv != 0) return rv;
+
+	return (diffcount == 0) ? 0 : 1;
+}
+
+/* Worker thread; takes pairs from the batch until none are left */
+static void* zd_batch_worker(void* arg)
+{
+	zd_batch_state*	batch	= (zd_batch_state*) arg;
+	zd_batch_job*	job	= NULL;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&batch->lock);
+		job = (batch->next < batch->count) ? &batch->jobs[batch->next++] : NULL;
+		pthread_mutex_unlock(&batch->lock);
+
+		if (job == NULL) break;
+
+		job->rv = zd_batch_run_job(batch, job);
+
+		pthread_mutex_lock(&batch->lock);
+		fprintf((batch->out_dir != NULL) ? stdout : stderr, "%d %s %s\n", job->rv, job->left_zone, job->right_zone);
+		pthread_mutex_unlock(&batch->lock);
+	}
+
+	return NULL;
+}
+
+/* Compare all zone pairs listed in a manifest */
+int zd_batch(const char* manifest, const zd_opts* opts, const char* out_dir, const int workers)
+{
+	zd_batch_state	batch		= { 0 };
+	pthread_t*	threads		= NULL;
+	int*		threaded	= NULL;
+	int		rv		= 0;
+	size_t		i		= 0;
+
+	batch.opts = opts;
+	batch.out_dir = out_dir;
+
+	if ((zd_batch_read(&batch, manifest) != 0) ||
+	    ((out_dir != NULL) && (zd_batch_check_names(&batch, manifest) != 0)))
+	{
+		zd_batch_free(&batch);
+
+		return 2;
+	}
+
+	threads = (pthread_t*) calloc(workers, sizeof(pthread_t));
+	threaded = (int*) calloc(workers, sizeof(int));
+
+	if ((threads == NULL) || (threaded == NULL) || (pthread_mutex_init(&batch.lock, NULL) != 0))
+	{
+		free(threads);
+		free(threaded);
+		zd_batch_free(&batch);
+
+		return 2;
+	}
+
+	for (i = 1; i < (size_t) workers; i++)
+	{
+		threaded[i] = (pthread_create(&threads[i], NULL, zd_batch_worker, &batch) == 0);
+	}
+
+	/* This thread works as well, so the batch completes without workers */
+	zd_batch_worker(&batch);
+
+	for (i = 1; i < (size_t) workers; i++)
+	{
+		if (threaded[i]) pthread_join(threads[i], NULL);
+	}
+
+	for (i = 0; i < batch.count; i++)
+	{
+		if (batch.jobs[i].rv > rv) rv = batch.jobs[i].rv;
+	}
+
+	pthread_mutex_destroy(&batch.lock);
+
+	free(threads);
+	free(threaded);
+	zd_batch_free(&batch);
+
+	return rv;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LDNS_ZONEDIFF_DNS_ZONEBATCH_H
+#define _LDNS_ZONEDIFF_DNS_ZONEBATCH_H
+
+#include "dns_zonediff.h"
+
+/*
+ * Compare all zone pairs listed in a manifest, with one line per pair:
+ *
+ *   <left-zone> <right-zone> [<origin>]
+ *
+ * Empty lines and lines starting with '#' are skipped. The pairs are
+ * compared by a pool of worker threads. The output for each pair is
+ * written to <out_dir>/<name>.diff, where name is the origin or else
+ * the file name of the right zone, or to stdout if out_dir is NULL; it
+ * never interleaves with that of other pairs. A manifest in which two
+ * pairs share an output name is rejected if out_dir is set. A line with the exit code
+ * ldns-zonediff would have returned for a pair, followed by the zone
+ * files, goes to stdout if out_dir is set and to stderr otherwise.
+ *
+ * Returns 2 if any pair failed, 1 if any pair differs and 0 otherwise
+ */
+int zd_batch(const char* manifest, const zd_opts* opts, const char* out_dir, const int workers);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONEBATCH_H */
+ 
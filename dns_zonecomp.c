@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+/* fopencookie() is a GNU extension */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <zlib.h>
+#include <lzma.h>
+#include <zstd.h>
+#include "dns_zonecomp.h"
+
+/* Size of the ring buffer between the decompressor and the parser */
+#define ZD_COMP_RING_SIZE	(4 * 1024 * 1024)
+
+/* Amount of data decompressed at a time */
+#define ZD_COMP_BLOCK_SIZE	(256 * 1024)
+
+/* A compressed file that is decompressed on its own thread */
+typedef struct _zd_comp
+{
+	FILE*		in;
+	char*		zone_file;
+	int		format;
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	readable;
+	pthread_cond_t	writable;
+	char*		ring;
+	size_t		head;
+	size_t		count;
+	int		done;
+	int		closed;
+	int		failed;
+	uint8_t		in_buf[ZD_COMP_BLOCK_SIZE];
+	uint8_t		out_buf[ZD_COMP_BLOCK_SIZE];
+}
+zd_comp;
+
+/* Return the compression format of a file */
+int zd_comp_detect(const char* zone_file)
+{
+	unsigned char	magic[6]	= { 0 };
+	size_t		n		= 0;
+	FILE*		f		= fopen(zone_file, "rb");
+
+	if (f == NULL) return ZD_COMP_NONE;
+
+	n = fread(magic, 1, sizeof(magic), f);
+
+	fclose(f);
+
+	if ((n >= 2) && (magic[0] == 0x1f) && (magic[1] == 0x8b))
+	{
+		return ZD_COMP_GZIP;
+	}
+
+	if ((n >= 6) && (memcmp(magic, "\xfd" "7zXZ\0", 6) == 0))
+	{
+		return ZD_COMP_XZ;
+	}
+
+	if ((n >= 4) && (memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0))
+	{
+		return ZD_COMP_ZSTD;
+	}
+
+	return ZD_COMP_NONE;
+}
+
+/*
+ * Add decompressed data to the ring buffer, waiting for the parser to make
+ * room; returns 1 if the parser no longer wants the data
+ */
+static int zd_comp_put(zd_comp* c, const uint8_t* data, size_t len)
+{
+	size_t	tail	= 0;
+	size_t	n	= 0;
+
+	pthread_mutex_lock(&c->lock);
+
+	while (len > 0)
+	{
+		while ((c->count == ZD_COMP_RING_SIZE) && !c->closed)
+		{
+			pthread_cond_wait(&c->writable, &c->lock);
+		}
+
+		if (c->closed) break;
+
+		tail = (c->head + c->count) % ZD_COMP_RING_SIZE;
+		n = ZD_COMP_RING_SIZE - c->count;
+
+		if (n > ZD_COMP_RING_SIZE - tail) n = ZD_COMP_RING_SIZE - tail;
+		if (n > len) n = len;
+
+		memcpy(&c->ring[tail], data, n);
+
+		c->count += n;
+		data += n;
+		len -= n;
+
+		pthread_cond_signal(&c->readable);
+	}
+
+	pthread_mutex_unlock(&c->lock);
+
+	return (len > 0);
+}
+
+/* Decompress gzip data, which may consist of several members */
+static int zd_comp_gzip(zd_comp* c)
+{
+	z_stream	zs;
+	size_t		n	= 0;
+	int		pending	= 0;
+	int		ret	= Z_OK;
+
+	memset(&zs, 0, sizeof(zs));
+
+	/* Accept gzip headers only */
+	if (inflateInit2(&zs, 15 + 16) != Z_OK) return 1;
+
+	for (;;)
+	{
+		/* Only read on once inflate() has nothing left to write */
+		if ((zs.avail_in == 0) && !pending)
+		{
+			if ((n = fread(c->in_buf, 1, sizeof(c->in_buf), c->in)) == 0) break;
+
+			zs.next_in = c->in_buf;
+			zs.avail_in = (uInt) n;
+		}
+
+		if ((ret == Z_STREAM_END) && (inflateReset(&zs) != Z_OK)) break;
+
+		zs.next_out = c->out_buf;
+		zs.avail_out = sizeof(c->out_buf);
+
+		ret = inflate(&zs, Z_NO_FLUSH);
+
+		/* No progress without more input is not an error (see zlib.h) */
+		if ((ret == Z_BUF_ERROR) && (zs.avail_in == 0))
+		{
+			pending = 0;
+			continue;
+		}
+
+		if ((ret != Z_OK) && (ret != Z_STREAM_END)) break;
+
+		/* At the end of a member all of its output has been written */
+		pending = (zs.avail_out == 0) && (ret != Z_STREAM_END);
+
+		if (zd_comp_put(c, c->out_buf, sizeof(c->out_buf) - zs.avail_out)) break;
+	}
+
+	inflateEnd(&zs);
+
+	return c->closed ? 0 : ((ret != Z_STREAM_END) || ferror(c->in));
+}
+
+/* Decompress xz data, which may consist of several streams */
+static int zd_comp_xz(zd_comp* c)
+{
+	lzma_stream	s	= LZMA_STREAM_INIT;
+	lzma_action	action	= LZMA_RUN;
+	lzma_ret	ret	= LZMA_OK;
+
+	if (lzma_stream_decoder(&s, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) return 1;
+
+	for (;;)
+	{
+		if ((s.avail_in == 0) && (action == LZMA_RUN))
+		{
+			s.next_in = c->in_buf;
+			s.avail_in = fread(c->in_buf, 1, sizeof(c->in_buf), c->in);
+
+			if (s.avail_in == 0) action = LZMA_FINISH;
+		}
+
+		s.next_out = c->out_buf;
+		s.avail_out = sizeof(c->out_buf);
+
+		ret = lzma_code(&s, action);
+
+		if ((ret != LZMA_OK) && (ret != LZMA_STREAM_END)) break;
+
+		if (zd_comp_put(c, c->out_buf, sizeof(c->out_buf) - s.avail_out) || (ret == LZMA_STREAM_END)) break;
+	}
+
+	lzma_end(&s);
+
+	return c->closed ? 0 : ((ret != LZMA_STREAM_END) || ferror(c->in));
+}
+
+/* Decompress zstd data, which may consist of several frames */
+static int zd_comp_zstd(zd_comp* c)
+{
+	ZSTD_DCtx*	d	= ZSTD_createDCtx();
+	ZSTD_inBuffer	in	= { NULL, 0, 0 };
+	ZSTD_outBuffer	out	= { NULL, 0, 0 };
+	size_t		ret	= 1;
+	int		stop	= 0;
+
+	if (d == NULL) return 1;
+
+	while (!stop && ((in.size = fread(c->in_buf, 1, sizeof(c->in_buf), c->in)) > 0))
+	{
+		in.src = c->in_buf;
+		in.pos = 0;
+
+		/* A full output buffer may leave data inside the decoder */
+		do
+		{
+			out.dst = c->out_buf;
+			out.size = sizeof(c->out_buf);
+			out.pos = 0;
+
+			ret = ZSTD_decompressStream(d, &out, &in);
+
+			if (ZSTD_isError(ret) || zd_comp_put(c, c->out_buf, out.pos))
+			{
+				stop = 1;
+				break;
+			}
+		}
+		while ((in.pos < in.size) || (out.pos == out.size));
+	}
+
+	ZSTD_freeDCtx(d);
+
+	/* Only a return value of 0 means the last frame is complete */
+	return c->closed ? 0 : ((ret != 0) || ferror(c->in));
+}
+
+/* Thread entry point for decompressing a file */
+static void* zd_comp_run(void* arg)
+{
+	zd_comp*	c	= (zd_comp*) arg;
+	int		failed	= 0;
+
+	switch(c->format)
+	{
+	case ZD_COMP_GZIP:
+		failed = zd_comp_gzip(c);
+		break;
+	case ZD_COMP_XZ:
+		failed = zd_comp_xz(c);
+		break;
+	case ZD_COMP_ZSTD:
+		failed = zd_comp_zstd(c);
+		break;
+	default:
+		failed = 1;
+		break;
+	}
+
+	if (failed)
+	{
+		fprintf(stderr, "Failed to decompress zone file %s\n", c->zone_file);
+	}
+
+	pthread_mutex_lock(&c->lock);
+
+	c->failed = failed;
+	c->done = 1;
+
+	pthread_cond_signal(&c->readable);
+	pthread_mutex_unlock(&c->lock);
+
+	return NULL;
+}
+
+/*
+ * Read decompressed data from the ring buffer; corrupt data ends the file
+ * early, so parsers do not have to tell read errors from the end of file
+ */
+static ssize_t zd_comp_read(void* cookie, char* buf, size_t size)
+{
+	zd_comp*	c	= (zd_comp*) cookie;
+	size_t		n	= 0;
+
+	pthread_mutex_lock(&c->lock);
+
+	while ((c->count == 0) && !c->done)
+	{
+		pthread_cond_wait(&c->readable, &c->lock);
+	}
+
+	n = c->count;
+
+	if (n > ZD_COMP_RING_SIZE - c->head) n = ZD_COMP_RING_SIZE - c->head;
+	if (n > size) n = size;
+
+	memcpy(buf, &c->ring[c->head], n);
+
+	c->head = (c->head + n) % ZD_COMP_RING_SIZE;
+	c->count -= n;
+
+	pthread_cond_signal(&c->writable);
+	pthread_mutex_unlock(&c->lock);
+
+	return (ssize_t) n;
+}
+
+/* Free a decompressor whose thread is not running */
+static void zd_comp_free(zd_comp* c)
+{
+	if (c->in != NULL) fclose(c->in);
+
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->readable);
+	pthread_cond_destroy(&c->writable);
+
+	free(c->ring);
+	free(c->zone_file);
+	free(c);
+}
+
+/* Stop decompressing and wait for the thread; fails if the data was corrupt */
+static int zd_comp_close(void* cookie)
+{
+	zd_comp*	c	= (zd_comp*) cookie;
+	int		failed	= 0;
+
+	pthread_mutex_lock(&c->lock);
+
+	c->closed = 1;
+
+	pthread_cond_signal(&c->writable);
+	pthread_mutex_unlock(&c->lock);
+
+	pthread_join(c->thread, NULL);
+
+	failed = c->failed;
+
+	zd_comp_free(c);
+
+	return failed ? -1 : 0;
+}
+
+/* Open a compressed file for reading */
+FILE* zd_comp_fopen(const char* zone_file, const int format)
+{
+	cookie_io_functions_t	io	= { zd_comp_read, NULL, NULL, zd_comp_close };
+	zd_comp*		c	= (zd_comp*) calloc(1, sizeof(zd_comp));
+	FILE*			fp	= NULL;
+	int			rv	= 0;
+
+	if (c == NULL) return NULL;
+
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->readable, NULL);
+	pthread_cond_init(&c->writable, NULL);
+
+	c->format = format;
+
+	if (((c->ring = (char*) malloc(ZD_COMP_RING_SIZE)) == NULL) || ((c->zone_file = strdup(zone_file)) == NULL))
+	{
+		zd_comp_free(c);
+		errno = ENOMEM;
+
+		return NULL;
+	}
+
+	if ((c->in = fopen(zone_file, "rb")) == NULL)
+	{
+		rv = errno;
+		zd_comp_free(c);
+		errno = rv;
+
+		return NULL;
+	}
+
+	if ((rv = pthread_create(&c->thread, NULL, zd_comp_run, c)) != 0)
+	{
+		zd_comp_free(c);
+		errno = rv;
+
+		return NULL;
+	}
+
+	if ((fp = fopencookie(c, "r", io)) == NULL)
+	{
+		rv = errno;
+		zd_comp_close(c);
+		errno = rv;
+	}
+
+	return fp;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LDNS_ZONEDIFF_DNS_ZONECOMP_H
+#define _LDNS_ZONEDIFF_DNS_ZONECOMP_H
+
+#include <stdio.h>
+
+/* Compression formats of zone files, recognised by their magic bytes */
+#define ZD_COMP_NONE		0
+#define ZD_COMP_GZIP		1
+#define ZD_COMP_XZ		2
+#define ZD_COMP_ZSTD		3
+
+/* Return the compression format of a file; ZD_COMP_NONE if it cannot be read */
+int zd_comp_detect(const char* zone_file);
+
+/*
+ * Open a compressed file for reading; the data is decompressed on its own
+ * thread while it is read. Reading stops early if the data is corrupt,
+ * in which case fclose() fails. Returns NULL and sets errno on failure.
+ */
+FILE* zd_comp_fopen(const char* zone_file, const int format);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONECOMP_H */
@@ -34,515 +34,2161 @@
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
-#include <openssl/evp.h>
+#include <pthread.h>
 #include <ldns/ldns.h>
 #include "dns_zonediff.h"
-#include "utlist.h"
+#include "dns_zonesplit.h"
+#include "dns_zonehash.h"
+#include "dns_zonetok.h"
+#include "dns_zonestore.h"
+#include "dns_zoneindex.h"
+#include "dns_zoneout.h"
+#include "dns_zonestats.h"
+#include "dns_zonemd.h"
+#include "dns_zoneaxfr.h"
+#include "dns_zonecomp.h"
+#include "dns_zoneupdate.h"
+
+/* Parser state and results for one range of a zone file */
+typedef struct _zd_range
+{
+	const char*	zone_file;
+	const zd_opts*	opts;
+	const zd_chunk*	chunk;
+	const zd_map*	map;
+	const zd_map*	buf;
+	int		compressed;
+	size_t		max_memory;
+	dnsz_zone	zone;
+	ldns_rr*	soa;
+	int		soa_line;
+	int		count;
+	int		line_no;
+	char*		zone_name;
+	size_t		filtered[ZD_STATS_TYPES];
+	int		rv;
+}
+zd_range;
+
+/* Reconstruct the owner name that a range inherits from the preceding record */
+static ldns_rdf* zd_chunk_owner(const zd_chunk* chunk, const zd_opts* opts)
+{
+	ldns_rdf*	origin	= NULL;
+	ldns_rdf*	owner	= NULL;
+
+	if (chunk->owner_origin != NULL)
+	{
+		origin = ldns_rdf_new_frm_str(LDNS_RDF_TYPE_DNAME, chunk->owner_origin);
+	}
+	else if (opts->origin != NULL)
+	{
+		origin = ldns_dname_new_frm_str(opts->origin);
+	}
+
+	/* Resolve the name the same way ldns does */
+	if (strcmp(chunk->owner, "@") == 0)
+	{
+		return origin;
+	}
+
+	owner = ldns_dname_new_frm_str(chunk->owner);
+
+	if ((owner != NULL) && (origin != NULL) && !ldns_dname_str_absolute(chunk->owner))
+	{
+		if (ldns_dname_cat(owner, origin) != LDNS_STATUS_OK)
+		{
+			ldns_rdf_deep_free(owner);
+			owner = NULL;
+		}
+	}
+
+	if (origin != NULL)
+	{
+		ldns_rdf_deep_free(origin);
+	}
+
+	return owner;
+}
+
+/* Set up the parser state in effect at the start of a range */
+static void zd_range_state(const zd_chunk* chunk, const zd_opts* opts, ldns_rdf** origin, uint32_t* ttl, ldns_rdf** prev)
+{
+	*origin = NULL;
+	*ttl = 0;
+	*prev = NULL;
+
+	if (chunk->origin != NULL)
+	{
+		*origin = ldns_rdf_new_frm_str(LDNS_RDF_TYPE_DNAME, chunk->origin);
+	}
+	else if (opts->origin != NULL)
+	{
+		*origin = ldns_dname_new_frm_str(opts->origin);
+	}
+
+	if (chunk->ttl != NULL)
+	{
+		const char*	endptr	= NULL;
+
+		*ttl = ldns_str2period(chunk->ttl, &endptr);
+	}
+
+	if (chunk->owner != NULL)
+	{
+		*prev = zd_chunk_owner(chunk, opts);
+	}
+}
+
+/* Check if records of the specified type are left out of the comparison */
+static int zd_skip_type(const ldns_rr_type type, const zd_opts* opts)
+{
+	return	((type == LDNS_RR_TYPE_RRSIG) && !opts->include_sigs) ||
+		((type == LDNS_RR_TYPE_DNSKEY) && !opts->include_keys) ||
+		((type == LDNS_RR_TYPE_DS) && !opts->include_delegs) ||
+		((type == LDNS_RR_TYPE_NSEC) && !opts->include_nsecs) ||
+		((type == LDNS_RR_TYPE_NSEC3) && !opts->include_nsecs) ||
+		((type == LDNS_RR_TYPE_NSEC3PARAM) && !opts->include_nsecs);
+}
+
+/* Have a tokenizer skip the types that are left out before parsing them */
+static void zd_tok_filter(zd_tok* tok, const zd_opts* opts, size_t* filtered)
+{
+	int	type	= 0;
+
+	for (type = 0; type < ZD_STATS_TYPES; type++)
+	{
+		if (zd_skip_type((ldns_rr_type) type, opts))
+		{
+			zd_tok_skip_type(tok, (uint16_t) type, filtered);
+		}
+	}
+}
+
+/* Keep a range within its memory budget by moving sorted runs to disk */
+static int zd_range_budget(zd_range* range)
+{
+	const size_t	mem	= zd_zone_mem(&range->zone);
+	const size_t	runs	= (size_t) range->zone.run_count * ZD_RUN_MEM;
+
+	/* Open runs count against the budget, but records always get at
+	 * least half of it, so that new runs do not keep getting smaller */
+	if ((range->max_memory == 0) || (mem <= range->max_memory) || (mem - runs < range->max_memory / 2))
+	{
+		return 0;
+	}
+
+	return zd_zone_spill(&range->zone, zd_hash_needs_verify(range->opts->hash_alg));
+}
+
+/*
+ * Add a record that one of the readers produced to a range: the SOA is
+ * kept aside as an ldns RR, records of types that are left out are only
+ * counted, and all others are fingerprinted and added to the zone. The
+ * RR of the record, if any, is taken over. pos is the line or, for AXFR
+ * data, the message the record was found in.
+ */
+static int zd_range_add(zd_range* range, zd_hasher* hasher, zd_tok_rr* rec, const int pos)
+{
+	const zd_opts*	opts			= range->opts;
+	const char*	where			= opts->axfr_input ? "in message" : "on line";
+	ldns_rr*	rr			= rec->rr;
+	size_t		wire_pos		= 0;
+	unsigned char	digest[ZD_HASH_MAX_SIZE]	= { 0 };
+	int		rv			= 0;
+
+	rec->rr = NULL;
+
+	if (rec->type == LDNS_RR_TYPE_SOA)
+	{
+		/* The SOA is the only record kept as an ldns RR */
+		if ((rr == NULL) && (ldns_wire2rr(&rr, rec->wire, rec->wire_len, &wire_pos, LDNS_SECTION_ANSWER) != LDNS_STATUS_OK))
+		{
+			fprintf(stderr, "Error converting RR from wire format %s %d of %s, aborting\n", where, pos, range->zone_file);
+
+			return EINVAL;
+		}
+
+		ldns_rr_set_ttl(rr, rec->ttl);
+
+		if (range->soa != NULL)
+		{
+			fprintf(stderr, "Error %s %s, encountered duplicate SOA record %s %d, aborting\n", opts->axfr_input ? "reading AXFR data" : "parsing zone file", range->zone_file, where, pos);
+
+			ldns_rr_free(rr);
+
+			return EINVAL;
+		}
+
+		range->soa = rr;
+		range->soa_line = pos;
+
+		return 0;
+	}
+
+	if (rr != NULL)
+	{
+		ldns_rr_free(rr);
+	}
+
+	if (zd_skip_type(rec->type, opts))
+	{
+		range->filtered[rec->type]++;
+
+		return 0;
+	}
+
+	/* Hash with a fixed TTL so it will not impact hash sorting */
+	zd_wire_mask_ttl(rec->wire, rec->ttl_ofs);
+
+	/* Grouping into RRsets only needs to know which RRset this is */
+	if (zd_hasher_hash(hasher, rec->wire, opts->rrsets ? zd_wire_rrset_len(rec->wire, rec->wire_len) : rec->wire_len, digest) != 0)
+	{
+		fprintf(stderr, "Failed to hash RR %s %d of %s, aborting\n", where, pos, range->zone_file);
+
+		return EINVAL;
+	}
+
+	/* The zone keeps a copy of the wire format with its real TTL */
+	if (((rv = zd_zone_add(&range->zone, digest, rec->wire, rec->wire_len, rec->ttl)) != 0) ||
+	    ((rv = zd_range_budget(range)) != 0))
+	{
+		return rv;
+	}
+
+	range->count++;
+
+	return 0;
+}
+
+/* Load the DNS records in one range of the specified zone file */
+static int zd_load_range(zd_range* range)
+{
+	assert(range != NULL);
+	assert(range->zone_file != NULL);
+	assert(range->opts != NULL);
+	assert(range->chunk != NULL);
+
+	const char*	zone_file		= range->zone_file;
+	const zd_opts*	opts			= range->opts;
+	const zd_chunk*	chunk			= range->chunk;
+	FILE*		zone_fd			= NULL;
+	ldns_rr*	cur_rr			= NULL;
+	ldns_rdf*	origin			= NULL;
+	ldns_rdf*	prev			= NULL;
+	ldns_buffer*	scratch			= NULL;
+	zd_hasher	hasher			= { 0 };
+	zd_tok_rr	rec			= { 0 };
+	int		line_no			= chunk->line_no;
+	int		rv			= 0;
+	uint32_t	ttl			= 0;
+
+	if (range->buf != NULL)
+	{
+		zone_fd = fmemopen((void*) range->buf->data, range->buf->size, "r");
+	}
+	else if (range->compressed != ZD_COMP_NONE)
+	{
+		zone_fd = zd_comp_fopen(zone_file, range->compressed);
+	}
+	else
+	{
+		zone_fd = fopen(zone_file, "r");
+	}
+
+	if (zone_fd == NULL)
+	{
+		rv = errno;
+
+		fprintf(stderr, "Failed to open zone file %s\n", zone_file);
+
+		return rv;
+	}
+
+	/* Every record is serialised into the same buffer and hashed with the same context */
+	if (((scratch = ldns_buffer_new(LDNS_MAX_PACKETLEN)) == NULL) || (zd_hasher_init(&hasher, opts->hash_alg) != 0))
+	{
+		fprintf(stderr, "Failed to set up hashing for zone file %s\n", zone_file);
+
+		if (scratch != NULL) ldns_buffer_free(scratch);
+		fclose(zone_fd);
+
+		return ENOMEM;
+	}
+
+	/* Start out with the parser state in effect at the start of the range */
+	zd_range_state(chunk, opts, &origin, &ttl, &prev);
+
+	if ((chunk->start > 0) && (fseeko(zone_fd, chunk->start, SEEK_SET) != 0))
+	{
+		rv = errno;
+
+		fprintf(stderr, "Failed to seek in zone file %s\n", zone_file);
+
+		goto load_failed;
+	}
+
+	while (!feof(zone_fd) && ((chunk->end < 0) || (ftello(zone_fd) < chunk->end)))
+	{
+		if ((rv = ldns_rr_new_frm_fp_l(&cur_rr, zone_fd, &ttl, &origin, &prev, &line_no)) != LDNS_STATUS_OK)
+		{
+			switch(rv)
+			{
+			case LDNS_STATUS_SYNTAX_EMPTY:
+			case LDNS_STATUS_SYNTAX_TTL:
+			case LDNS_STATUS_SYNTAX_ORIGIN:
+				rv = 0;
+				break;
+			default:
+				fprintf(stderr, "Error parsing zone file %s on line %d, aborting (%s)\n", zone_file, line_no, ldns_get_errorstr_by_id(rv));
+				goto load_failed;
+			}
+			
+			continue;
+		}
+
+		if (cur_rr == NULL) continue;
+
+		ldns_rr2canonical(cur_rr);
+
+		rec.type = ldns_rr_get_type(cur_rr);
+		rec.ttl = ldns_rr_ttl(cur_rr);
+		rec.rr = cur_rr;
+		rec.wire = NULL;
+		rec.wire_len = 0;
+
+		/* Only records that are kept need to be in wire format */
+		if ((rec.type != LDNS_RR_TYPE_SOA) && !zd_skip_type(rec.type, opts))
+		{
+			ldns_buffer_clear(scratch);
+
+			if (ldns_rr2buffer_wire(scratch, cur_rr, LDNS_SECTION_ANSWER) != LDNS_STATUS_OK)
+			{
+				fprintf(stderr, "Error converting RR to wire format on line %d of %s, aborting\n", line_no, zone_file);
+
+				ldns_rr_free(cur_rr);
+				rv = EINVAL;
+				goto load_failed;
+			}
+
+			rec.wire = ldns_buffer_begin(scratch);
+			rec.wire_len = ldns_buffer_position(scratch);
+			rec.ttl_ofs = ldns_rdf_size(ldns_rr_owner(cur_rr)) + 4;
+		}
+
+		if ((rv = zd_range_add(range, &hasher, &rec, line_no)) != 0)
+		{
+			goto load_failed;
+		}
+	}
+
+	range->line_no = line_no;
+
+	if (origin != NULL)
+	{
+		range->zone_name = ldns_rdf2str(origin);
+	}
+
+load_failed:
+	if (origin != NULL)
+	{
+		ldns_rdf_deep_free(origin);
+	}
+
+	if (prev != NULL)
+	{
+		ldns_rdf_deep_free(prev);
+	}
+
+	ldns_buffer_free(scratch);
+	zd_hasher_free(&hasher);
+
+	/* Corrupt compressed data only shows when closing */
+	if ((fclose(zone_fd) != 0) && (rv == 0))
+	{
+		rv = EIO;
+	}
+
+	return rv;
+}
+
+/*
+ * Load the DNS records in one range of a memory-mapped zone file; this
+ * gives the same results as zd_load_range(), but most records are turned
+ * into wire format directly by the tokenizer instead of by ldns
+ */
+static int zd_load_range_mapped(zd_range* range)
+{
+	assert(range != NULL);
+	assert(range->map != NULL);
+
+	const char*	zone_file		= range->zone_file;
+	const zd_opts*	opts			= range->opts;
+	zd_tok*		tok			= NULL;
+	zd_tok_rr	rec			= { 0 };
+	ldns_rdf*	origin			= NULL;
+	ldns_rdf*	prev			= NULL;
+	uint32_t	ttl			= 0;
+	zd_hasher	hasher			= { 0 };
+	int		rv			= 0;
+
+	if (zd_hasher_init(&hasher, opts->hash_alg) != 0)
+	{
+		fprintf(stderr, "Failed to set up hashing for zone file %s\n", zone_file);
+
+		return ENOMEM;
+	}
+
+	zd_range_state(range->chunk, opts, &origin, &ttl, &prev);
+
+	tok = zd_tok_new(range->map, range->chunk, origin, ttl, prev);
+
+	if (prev != NULL)
+	{
+		ldns_rdf_deep_free(prev);
+	}
+
+	if (tok == NULL)
+	{
+		zd_hasher_free(&hasher);
+
+		return ENOMEM;
+	}
+
+	zd_tok_filter(tok, opts, range->filtered);
+
+	while ((rv = zd_tok_next(tok, &rec)) == LDNS_STATUS_OK)
+	{
+		if ((rv = zd_range_add(range, &hasher, &rec, zd_tok_line_no(tok))) != 0)
+		{
+			goto load_failed;
+		}
+	}
+
+	if (rv != ZD_TOK_END)
+	{
+		fprintf(stderr, "Error parsing zone file %s on line %d, aborting (%s)\n", zone_file, zd_tok_line_no(tok), ldns_get_errorstr_by_id(rv));
+		goto load_failed;
+	}
+
+	rv = 0;
+
+	range->line_no = zd_tok_line_no(tok);
+	range->zone_name = zd_tok_origin_str(tok);
+
+load_failed:
+	zd_tok_free(tok);
+	zd_hasher_free(&hasher);
+
+	return rv;
+}
+
+/*
+ * Load the DNS records in one range of AXFR data; the records are already
+ * in wire format, so they go straight to fingerprinting
+ */
+static int zd_load_range_axfr(zd_range* range)
+{
+	assert(range != NULL);
+	assert(range->map != NULL);
+
+	const char*	zone_file		= range->zone_file;
+	const zd_opts*	opts			= range->opts;
+	zd_axfr*	axfr			= NULL;
+	zd_tok_rr	rec			= { 0 };
+	zd_hasher	hasher			= { 0 };
+	int		rv			= 0;
+
+	if (zd_hasher_init(&hasher, opts->hash_alg) != 0)
+	{
+		fprintf(stderr, "Failed to set up hashing for zone file %s\n", zone_file);
+
+		return ENOMEM;
+	}
+
+	if ((axfr = zd_axfr_new(range->map, range->chunk)) == NULL)
+	{
+		zd_hasher_free(&hasher);
+
+		return ENOMEM;
+	}
+
+	while ((rv = zd_axfr_next(axfr, &rec)) == LDNS_STATUS_OK)
+	{
+		if ((rv = zd_range_add(range, &hasher, &rec, zd_axfr_msg_no(axfr))) != 0)
+		{
+			goto load_failed;
+		}
+	}
+
+	if (rv != ZD_TOK_END)
+	{
+		fprintf(stderr, "Error reading AXFR data %s in message %d, aborting (%s)\n", zone_file, zd_axfr_msg_no(axfr), ldns_get_errorstr_by_id(rv));
+		goto load_failed;
+	}
+
+	rv = 0;
+
+load_failed:
+	zd_axfr_free(axfr);
+	zd_hasher_free(&hasher);
+
+	return rv;
+}
+
+/* Thread entry point for zd_load_range(); all results go into the range */
+static void* zd_load_range_run(void* arg)
+{
+	zd_range*	range	= (zd_range*) arg;
+
+	if (range->opts->axfr_input)
+	{
+		range->rv = zd_load_range_axfr(range);
+	}
+	else
+	{
+		range->rv = (range->map != NULL) ? zd_load_range_mapped(range) : zd_load_range(range);
+	}
+
+	return NULL;
+}
+
+/* Records left out after loading, see zd_keep_type() */
+typedef struct _zd_type_filter
+{
+	const zd_opts*	opts;
+	zd_zone_stats*	stats;
+}
+zd_type_filter;
+
+/* Keep the records that zd_skip_type() would not have skipped while loading */
+static int zd_keep_type(const zd_rec* rec, void* arg)
+{
+	zd_type_filter*	filter	= (zd_type_filter*) arg;
+	const size_t	ofs	= zd_wire_rrset_len(rec->wire, rec->len) - 4;
+	const int	type	= (rec->wire[ofs] << 8) | rec->wire[ofs + 1];
+
+	if (!zd_skip_type((ldns_rr_type) type, filter->opts))
+	{
+		return 1;
+	}
+
+	filter->stats->filtered[type]++;
+	filter->stats->records--;
+
+	return 0;
+}
+
+/*
+ * Load a DNS zone from the specified file, or from memory if buf is set;
+ * if zonemd is set, the zone digest is computed before records are left out
+ */
+static int zd_load_zone(const char* zone_file, const zd_map* buf, const zd_opts* opts, char** zone_name, dnsz_zone* zone, ldns_rr** soa, zd_zonemd* zonemd, zd_zone_stats* stats)
+{
+	assert(zone_file != NULL);
+	assert(opts != NULL);
+	assert(zone != NULL);
+	assert(soa != NULL);
+	assert(stats != NULL);
+
+	zd_chunk	whole		= { 0 };
+	zd_chunk*	chunks		= &whole;
+	zd_map		map		= { 0 };
+	int		mapped		= 0;
+	zd_axfr_data	axfr		= { { 0 } };
+	int		compressed	= ZD_COMP_NONE;
+	int		chunk_count	= 1;
+	zd_range*	ranges		= NULL;
+	pthread_t*	threads		= NULL;
+	int*		threaded	= NULL;
+	int		count		= 0;
+	int		i		= 0;
+	int		j		= 0;
+	int		rv		= 0;
+	double		start		= zd_stats_now();
+	zd_opts		all_opts	= *opts;
+	zd_type_filter	filter		= { opts, stats };
+
+	/* The zone digest covers all records, so nothing is left out while loading */
+	all_opts.include_sigs = 1;
+	all_opts.include_keys = 1;
+	all_opts.include_nsecs = 1;
+	all_opts.include_delegs = 1;
+
+	*soa = NULL;
+	memset(zone, 0, sizeof(dnsz_zone));
+	zone->hash_size = zd_hash_size(opts->hash_alg);
+
+	/* Without splitting, a single range covers the entire file */
+	whole.end = -1;
+
+	if (opts->axfr_input)
+	{
+		/* AXFR data is always read into memory and split on message boundaries */
+		if ((buf == NULL) && ((rv = zd_axfr_read(zone_file, &axfr)) != 0))
+		{
+			fprintf(stderr, "Failed to read AXFR data from %s\n", zone_file);
+
+			return rv;
+		}
+
+		if (buf == NULL)
+		{
+			buf = &axfr.map;
+		}
+
+		if ((rv = zd_axfr_split(buf, opts->threads, &chunks, &chunk_count)) != 0)
+		{
+			fprintf(stderr, "AXFR data %s does not consist of whole DNS messages, aborting\n", zone_file);
+
+			zd_axfr_release(&axfr);
+
+			return rv;
+		}
+	}
+	else
+	{
+		/* Compressed zone files are parsed by ldns while they are being
+		 * decompressed, so they cannot be split or mapped */
+		if (buf == NULL)
+		{
+			compressed = zd_comp_detect(zone_file);
+		}
+
+		/* Zone data that is already in memory is parsed as a single range */
+		if ((buf == NULL) && (compressed == ZD_COMP_NONE) && (opts->threads > 1) && ((rv = zd_split_zone(zone_file, opts->threads, &chunks, &chunk_count)) != 0))
+		{
+			return rv;
+		}
+
+		/* Parse straight from memory unless asked to leave it all to ldns;
+		 * files that cannot be mapped are read through ldns instead */
+		if ((buf == NULL) && (compressed == ZD_COMP_NONE) && !opts->ldns_parser)
+		{
+			mapped = (zd_map_file(zone_file, &map) == 0);
+		}
+	}
+
+	ranges = (zd_range*) calloc(chunk_count, sizeof(zd_range));
+	threads = (pthread_t*) calloc(chunk_count, sizeof(pthread_t));
+	threaded = (int*) calloc(chunk_count, sizeof(int));
+
+	if ((ranges == NULL) || (threads == NULL) || (threaded == NULL))
+	{
+		rv = ENOMEM;
+		goto load_done;
+	}
+
+	for (i = 0; i < chunk_count; i++)
+	{
+		ranges[i].zone_file = zone_file;
+		ranges[i].opts = (zonemd != NULL) ? &all_opts : opts;
+		ranges[i].chunk = &chunks[i];
+		ranges[i].map = mapped ? &map : NULL;
+		ranges[i].compressed = compressed;
+
+		if (buf != NULL)
+		{
+			if (opts->ldns_parser && !opts->axfr_input)
+			{
+				ranges[i].buf = buf;
+			}
+			else
+			{
+				ranges[i].map = buf;
+			}
+		}
+
+		/* Both zones load at the same time, so each gets half the budget;
+		 * RRsets and zone digests need all records in memory */
+		ranges[i].max_memory = (opts->rrsets || (zonemd != NULL)) ? 0 : opts->max_memory / 2 / chunk_count;
+		ranges[i].zone.hash_size = zone->hash_size;
+	}
+
+	/* Parse all but the first range on worker threads */
+	for (i = 1; i < chunk_count; i++)
+	{
+		threaded[i] = (pthread_create(&threads[i], NULL, zd_load_range_run, &ranges[i]) == 0);
+	}
+
+	zd_load_range_run(&ranges[0]);
+
+	for (i = 1; i < chunk_count; i++)
+	{
+		if (threaded[i])
+		{
+			pthread_join(threads[i], NULL);
+		}
+		else
+		{
+			zd_load_range_run(&ranges[i]);
+		}
+	}
+
+	/* Concatenate the results in file order */
+	for (i = 0; i < chunk_count; i++)
+	{
+		if ((rv == 0) && (ranges[i].rv != 0))
+		{
+			rv = ranges[i].rv;
+		}
+
+		if ((rv == 0) && (ranges[i].soa != NULL))
+		{
+			if (*soa != NULL)
+			{
+				fprintf(stderr, "Error parsing zone file %s, encountered duplicate SOA record on line %d, aborting\n", zone_file, ranges[i].soa_line);
+
+				rv = EINVAL;
+			}
+			else
+			{
+				*soa = ranges[i].soa;
+				ranges[i].soa = NULL;
+			}
+		}
+
+		if ((rv == 0) && (zd_zone_append(zone, &ranges[i].zone) != 0))
+		{
+			rv = ENOMEM;
+		}
+
+		count += ranges[i].count;
+
+		for (j = 0; j < ZD_STATS_TYPES; j++)
+		{
+			stats->filtered[j] += ranges[i].filtered[j];
+		}
+	}
+
+	/*
+	 * Every run is read at the same time while comparing, so there may
+	 * only be as many as the budget has room for and files can be open
+	 */
+	if ((rv == 0) && (zone->run_count > 0))
+	{
+		size_t	max_runs	= opts->max_memory / 2 / 2 / ZD_RUN_MEM;
+
+		if (max_runs < 2) max_runs = 2;
+		if (max_runs > ZD_RUN_MAX_FANIN) max_runs = ZD_RUN_MAX_FANIN;
+
+		rv = zd_zone_compact(zone, zd_hash_needs_verify(opts->hash_alg), (int) max_runs);
+	}
+
+	if (rv == 0)
+	{
+		stats->records = count;
+		stats->lines = ranges[chunk_count-1].line_no;
+
+		/* The zone name follows from the origin at the end of the file */
+		if (zone_name != NULL)
+		{
+			*zone_name = ranges[chunk_count-1].zone_name;
+			ranges[chunk_count-1].zone_name = NULL;
+
+			/* AXFR data has no origin, the zone is named after its SOA */
+			if ((*zone_name == NULL) && opts->axfr_input && (*soa != NULL))
+			{
+				*zone_name = ldns_rdf2str(ldns_rr_owner(*soa));
+			}
+		}
+	}
+
+load_done:
+	if (ranges != NULL)
+	{
+		for (i = 0; i < chunk_count; i++)
+		{
+			if (ranges[i].soa != NULL) ldns_rr_free(ranges[i].soa);
+
+			zd_free_zone(&ranges[i].zone);
+			free(ranges[i].zone_name);
+		}
+	}
+
+	free(ranges);
+	free(threads);
+	free(threaded);
+
+	if (chunks != &whole)
+	{
+		zd_free_chunks(chunks, chunk_count);
+	}
+
+	if (mapped)
+	{
+		zd_unmap_file(&map);
+	}
+
+	zd_axfr_release(&axfr);
+
+	if (rv != 0)
+	{
+		/* Leave nothing behind for the caller to clean up */
+		zd_free_zone(zone);
+
+		if (*soa != NULL)
+		{
+			ldns_rr_free(*soa);
+			*soa = NULL;
+		}
+
+		return rv;
+	}
+
+	/* Compute the zone digest, then leave out what is not compared */
+	if ((zonemd != NULL) && (*soa != NULL))
+	{
+		if ((rv = zd_zonemd_compute(zone, *soa, opts->threads, zonemd)) != 0)
+		{
+			fprintf(stderr, "Failed to compute the zone digest of %s\n", zone_file);
+		}
+		else
+		{
+			rv = zd_zone_filter(zone, zd_keep_type, &filter);
+		}
+	}
+
+	/* In RRset mode, the records are grouped, so that only the RRsets
+	 * have to be sorted; sorting is left to the caller */
+	if ((rv == 0) && opts->rrsets && ((rv = zd_zone_group(zone, opts->hash_alg)) != 0))
+	{
+		fprintf(stderr, "Failed to group the records of %s into RRsets\n", zone_file);
+	}
+
+	if (rv != 0)
+	{
+		zd_free_zone(zone);
+
+		if (*soa != NULL)
+		{
+			ldns_rr_free(*soa);
+			*soa = NULL;
+		}
+
+		return rv;
+	}
+
+	stats->parse_time = zd_stats_now() - start;
+
+	return 0;
+}
+
+/*
+ * Sort zone data in hash order; if equal hashes do not guarantee equal
+ * records, the records themselves decide the order. Whatever was spilled
+ * to disk or loaded from an index is already sorted.
+ */
+static void zd_sort_zone(dnsz_zone* zone, const zd_opts* opts, zd_zone_stats* stats)
+{
+	double	start	= zd_stats_now();
+
+	zd_zone_sort(zone, zd_hash_needs_verify(opts->hash_alg));
+
+	stats->sort_time += zd_stats_now() - start;
+}
+
+/*
+ * Load a DNS zone from its index if it has an up-to-date one, otherwise
+ * from the zone file itself, and (re)write the index if requested
+ */
+static int zd_load_zone_indexed(const char* zone_file, const zd_opts* opts, char** zone_name, dnsz_zone* zone, ldns_rr** soa, zd_zonemd* zonemd, zd_zone_stats* stats)
+{
+	zd_index_src	src		= { 0 };
+	int		rv		= 0;
+
+	/* Indexes do not hold the records that are left out of the comparison,
+	 * so zone digests are always computed from the zone file; AXFR data
+	 * from stdin has nowhere to keep an index */
+	if (!opts->use_index || (zonemd != NULL) || (opts->axfr_input && (strcmp(zone_file, "-") == 0)) || (zd_index_source(zone_file, &src) != 0))
+	{
+		return zd_load_zone(zone_file, NULL, opts, zone_name, zone, soa, zonemd, stats);
+	}
+
+	if ((rv = zd_index_load(zone_file, &src, opts, zone, soa, zone_name, &stats->records, &stats->lines)) != ENOENT)
+	{
+		stats->from_index = (rv == 0);
+
+		return rv;
+	}
+
+	if ((rv = zd_load_zone(zone_file, NULL, opts, zone_name, zone, soa, NULL, stats)) != 0)
+	{
+		return rv;
+	}
+
+	/* The index holds the records in hash order */
+	zd_sort_zone(zone, opts, stats);
+
+	/* Failing to write the index only costs time on the next run */
+	zd_index_write(zone_file, &src, opts, zone, *soa, (zone_name != NULL) ? *zone_name : NULL, stats->records, stats->lines);
+
+	return 0;
+}
+
+/* A loaded zone */
+struct _zd_zone
+{
+	dnsz_zone	data;
+	ldns_rr*	soa;
+	char*		name;
+	int		verify;
+	int		rrsets;
+	zd_zonemd	zonemd;
+	zd_zone_stats	stats;
+};
+
+/*
+ * Load a zone from its index or file into a new zone handle; zones that
+ * are not sorted cannot be compared yet, but do have their sum
+ */
+static int zd_zone_new(const char* zone_file, const zd_map* buf, const zd_opts* opts, const int sort, zd_zone** zone)
+{
+	zd_zone*	z	= (zd_zone*) calloc(1, sizeof(zd_zone));
+	int		rv	= 0;
+
+	*zone = NULL;
+
+	if (z == NULL)
+	{
+		return ENOMEM;
+	}
+
+	z->verify = zd_hash_needs_verify(opts->hash_alg);
+	z->rrsets = opts->rrsets;
+
+	if (buf != NULL)
+	{
+		rv = zd_load_zone(zone_file, buf, opts, &z->name, &z->data, &z->soa, opts->zonemd ? &z->zonemd : NULL, &z->stats);
+	}
+	else
+	{
+		rv = zd_load_zone_indexed(zone_file, opts, &z->name, &z->data, &z->soa, opts->zonemd ? &z->zonemd : NULL, &z->stats);
+	}
+
+	if (rv != 0)
+	{
+		zd_zone_free(z);
+
+		return rv;
+	}
+
+	if (sort)
+	{
+		zd_sort_zone(&z->data, opts, &z->stats);
+	}
+
+	*zone = z;
+
+	return 0;
+}
+
+/* Load a zone from a file */
+int zd_zone_load(const char* zone_file, const zd_opts* opts, zd_zone** zone)
+{
+	assert(zone_file != NULL);
+	assert(opts != NULL);
+	assert(zone != NULL);
+
+	return zd_zone_new(zone_file, NULL, opts, 1, zone);
+}
+
+/* Load a zone from zone file data in memory */
+int zd_zone_load_buf(const char* data, const size_t len, const zd_opts* opts, zd_zone** zone)
+{
+	assert(data != NULL);
+	assert(opts != NULL);
+	assert(zone != NULL);
+
+	zd_map	buf	= { data, len };
+
+	return zd_zone_new("(memory)", &buf, opts, 1, zone);
+}
+
+/* Free a zone */
+void zd_zone_free(zd_zone* zone)
+{
+	if (zone == NULL) return;
+
+	zd_free_zone(&zone->data);
+
+	if (zone->soa != NULL) ldns_rr_free(zone->soa);
+
+	free(zone->name);
+	free(zone);
+}
+
+/* Return the name of a zone, or NULL if it is not known */
+const char* zd_zone_name(const zd_zone* zone)
+{
+	return zone->name;
+}
+
+/* Return the SOA record of a zone, or NULL if it does not have one */
+const ldns_rr* zd_zone_soa(const zd_zone* zone)
+{
+	return zone->soa;
+}
+
+/* Return the number of records in a zone, other than the SOA */
+int zd_zone_count(const zd_zone* zone)
+{
+	return zone->stats.records;
+}
+
+/* Return the outcome of checking the ZONEMD record of a zone */
+int zd_zone_zonemd(const zd_zone* zone, unsigned char* digest)
+{
+	if ((digest != NULL) && (zone->zonemd.status != ZD_ZONEMD_NONE))
+	{
+		memcpy(digest, zone->zonemd.digest, ZD_ZONEMD_SIZE);
+	}
+
+	return zone->zonemd.status;
+}
+
+/* Arguments and results of loading one zone on a worker thread */
+typedef struct _zd_load_job
+{
+	const char*	zone_file;
+	const zd_opts*	opts;
+	int		sort;
+	zd_zone*	zone;
+	int		rv;
+}
+zd_load_job;
+
+/* Thread entry point for loading a zone; all results go into the job */
+static void* zd_load_job_run(void* arg)
+{
+	zd_load_job*	job	= (zd_load_job*) arg;
+
+	job->rv = zd_zone_new(job->zone_file, NULL, job->opts, job->sort, &job->zone);
+
+	return NULL;
+}
+
+/* Where the differences between two zones are reported */
+typedef struct _zd_diff_ctx
+{
+	zd_change_cb	cb;
+	void*		arg;
+}
+zd_diff_ctx;
+
+/* 
+ * Perform the SOA comparison; we report a changed SOA if one of the
+ * fields other than the serial has changed, or if the serial in the
+ * right file is higher than the SOA in the left file
+ */
+static int zd_diff_soa(const zd_diff_ctx* ctx, const ldns_rr* left_soa, const ldns_rr* right_soa, const zd_opts* opts)
+{
+	ldns_rr*	new_soa	= NULL;
+	int		rv	= 0;
+
+	if ((ldns_rdf_compare(ldns_rr_rdf(left_soa, 0), ldns_rr_rdf(right_soa, 0)) != 0) ||  /* SOA MNAME changed? */
+	    (ldns_rdf_compare(ldns_rr_rdf(left_soa, 1), ldns_rr_rdf(right_soa, 1)) != 0) ||  /* SOA RNAME changed? */
+	    (opts->include_serial && (ldns_rdf_compare(ldns_rr_rdf(left_soa, 2), ldns_rr_rdf(right_soa, 2)) < 0)) ||   /* SOA serial right higher than left? */
+	    (ldns_rdf_compare(ldns_rr_rdf(left_soa, 3), ldns_rr_rdf(right_soa, 3)) != 0) ||  /* SOA refresh changed? */
+	    (ldns_rdf_compare(ldns_rr_rdf(left_soa, 4), ldns_rr_rdf(right_soa, 4)) != 0) ||  /* SOA retry changed? */
+	    (ldns_rdf_compare(ldns_rr_rdf(left_soa, 5), ldns_rr_rdf(right_soa, 5)) != 0) ||  /* SOA expire changed? */
+	    (ldns_rdf_compare(ldns_rr_rdf(left_soa, 6), ldns_rr_rdf(right_soa, 6)) != 0))    /* SOA minimum changed? */
+	{
+		/* Check if the left SOA serial is higher than, or equal to the right SOA serial */
+		if (ldns_rdf_compare(ldns_rr_rdf(left_soa, 2), ldns_rr_rdf(right_soa, 2)) >= 0)
+		{
+			uint32_t	soa_serial	= 0;
+			ldns_rdf*	old_serial	= NULL;
+
+			/* The zones themselves are left untouched */
+			if ((new_soa = ldns_rr_clone(right_soa)) == NULL)
+			{
+				return ENOMEM;
+			}
+
+			/* Ensure that the SOA serial that is reported is higher than
+			   the left SOA serial */
+			soa_serial = ldns_rdf2native_int32(ldns_rr_rdf(left_soa, 2));
+			soa_serial++;
+
+			old_serial = ldns_rr_set_rdf(new_soa, ldns_native2rdf_int32(LDNS_RDF_TYPE_INT32, soa_serial), 2);
+
+			ldns_rdf_deep_free(old_serial);
+		}
+
+		rv = ctx->cb(ZD_CHANGE_SOA, left_soa, (new_soa != NULL) ? new_soa : right_soa, ctx->arg);
+
+		if (new_soa != NULL) ldns_rr_free(new_soa);
+	}
+
+	return rv;
+}
+
+/* Report a difference between two stored records */
+static int zd_report_diff(const zd_rec* rr2del, const zd_rec* rr2add, void* arg)
+{
+	const zd_diff_ctx*	ctx	= (const zd_diff_ctx*) arg;
+	ldns_rr*		old_rr	= NULL;
+	ldns_rr*		new_rr	= NULL;
+	int			change	= ZD_CHANGE_ADD;
+	int			rv	= 0;
+
+	if (((rr2del != NULL) && ((old_rr = zd_rec2rr(rr2del)) == NULL)) ||
+	    ((rr2add != NULL) && ((new_rr = zd_rec2rr(rr2add)) == NULL)))
+	{
+		fprintf(stderr, "Failed to convert record from wire format for output\n");
+
+		rv = EINVAL;
+		goto cleanup;
+	}
+
+	if ((old_rr != NULL) && (new_rr != NULL))
+	{
+		change = ZD_CHANGE_TTL;
+	}
+	else if (old_rr != NULL)
+	{
+		change = ZD_CHANGE_DEL;
+	}
+
+	rv = ctx->cb(change, old_rr, new_rr, ctx->arg);
+
+cleanup:
+	if (old_rr != NULL) ldns_rr_free(old_rr);
+	if (new_rr != NULL) ldns_rr_free(new_rr);
+
+	return rv;
+}
+
+/* Compare two loaded zones, reporting each difference through cb */
+int zd_diff_zones(const zd_zone* left, const zd_zone* right, const zd_opts* opts, zd_change_cb cb, void* arg)
+{
+	assert(left != NULL);
+	assert(right != NULL);
+	assert(opts != NULL);
+	assert(cb != NULL);
+
+	zd_diff_ctx	ctx	= { cb, arg };
+	int		rv	= 0;
+
+	/* Zones without a SOA or fingerprinted differently cannot be compared */
+	if ((left->soa == NULL) || (right->soa == NULL) || (left->data.hash_size != right->data.hash_size) || (left->rrsets != right->rrsets))
+	{
+		return EINVAL;
+	}
+
+	if ((rv = zd_diff_soa(&ctx, left->soa, right->soa, opts)) != 0)
+	{
+		return rv;
+	}
+
+	/* Equal sums of fingerprints that need no verification mean equal zones */
+	if (!left->verify && !right->verify && !zd_zone_sum_differs(&left->data, &right->data))
+	{
+		return 0;
+	}
+
+	if (left->rrsets)
+	{
+		return zd_zone_merge_rrsets(&left->data, &right->data, left->verify || right->verify, zd_report_diff, &ctx);
+	}
+
+	return zd_zone_merge(&left->data, &right->data, left->verify || right->verify, zd_report_diff, &ctx);
+}
+
+/* Returned by zd_quiet_change() to stop at the first difference */
+#define ZD_DIFF_STOP		-1
+
+/* Count the first difference and stop */
+static int zd_quiet_change(const int change, const ldns_rr* old_rr, const ldns_rr* new_rr, void* arg)
+{
+	(void) change;
+	(void) old_rr;
+	(void) new_rr;
+
+	*((int*) arg) = 1;
+
+	return ZD_DIFF_STOP;
+}
+
+/*
+ * Only check whether two zones differ. Zones with different sums differ
+ * for certain, so they are not even sorted; equal sums of fingerprints
+ * that need no verification mean the zones are the same.
+ */
+static int zd_diff_quiet(zd_zone* left, zd_zone* right, const zd_opts* opts, int* diffcount)
+{
+	zd_diff_ctx	ctx	= { zd_quiet_change, diffcount };
+	int		rv	= 0;
+
+	*diffcount = 0;
+
+	if ((rv = zd_diff_soa(&ctx, left->soa, right->soa, opts)) == 0)
+	{
+		if (zd_zone_sum_differs(&left->data, &right->data))
+		{
+			*diffcount = 1;
+		}
+		else if (left->verify || right->verify)
+		{
+			zd_sort_zone(&left->data, opts, &left->stats);
+			zd_sort_zone(&right->data, opts, &right->stats);
+
+			rv = zd_diff_zones(left, right, opts, zd_quiet_change, diffcount);
+		}
+	}
+
+	return (rv == ZD_DIFF_STOP) ? 0 : rv;
+}
+
+/* Return how many differences ldns-zonediff counts for a change */
+int zd_change_diffcount(const int change, const ldns_rr* old_rr, const ldns_rr* new_rr)
+{
+	/* A changed SOA counts as a single difference */
+	return (old_rr != NULL) + (new_rr != NULL) - (change == ZD_CHANGE_SOA);
+}
+
+/* Where zd_print_change() writes the differences */
+typedef struct _zd_print_ctx
+{
+	zd_out*		out;
+	const char*	zone_name;
+	int		output_knotc_commands;
+	int		output_format;
+	zd_update*	update;
+	zd_stats*	stats;
+	int*		diffcount;
+}
+zd_print_ctx;
+
+/* Write a difference in the output format and count it */
+static int zd_print_change(const int change, const ldns_rr* old_rr, const ldns_rr* new_rr, void* arg)
+{
+	zd_print_ctx*	ctx	= (zd_print_ctx*) arg;
+
+	switch(change)
+	{
+	case ZD_CHANGE_ADD:
+		ctx->stats->added++;
+		break;
+	case ZD_CHANGE_DEL:
+		ctx->stats->removed++;
+		break;
+	case ZD_CHANGE_TTL:
+		ctx->stats->ttl_changed++;
+		break;
+	case ZD_CHANGE_SOA:
+		ctx->stats->soa_changed++;
+		break;
+	}
+
+	*ctx->diffcount += zd_change_diffcount(change, old_rr, new_rr);
+
+	/* IXFR responses and nsupdate scripts have their own writer */
+	if (ctx->update != NULL)
+	{
+		return zd_update_change(ctx->update, change, old_rr, new_rr);
+	}
+
+	/* Delete before add -- either for most changes, both for TTL and SOA changes */
+	if ((ctx->output_format == ZD_OUT_JSON) || (ctx->output_format == ZD_OUT_BINARY))
+	{
+		if (old_rr != NULL) zd_out_change(ctx->out, ctx->output_format, old_rr, 1);
+		if (new_rr != NULL) zd_out_change(ctx->out, ctx->output_format, new_rr, 0);
+
+		return 0;
+	}
+
+	if (old_rr != NULL) zd_out_rr(ctx->out, ctx->zone_name, old_rr, 1, ctx->output_knotc_commands);
+	if (new_rr != NULL) zd_out_rr(ctx->out, ctx->zone_name, new_rr, 0, ctx->output_knotc_commands);
+
+	return 0;
+}
+
+/* Largest record a stream can hold, in wire format */
+#define ZD_STREAM_MAX_WIRE	(LDNS_MAX_DOMAINLEN + 1 + 10 + 65535)
+
+/* Initial size of the buffer for the records of one owner name */
+#define ZD_GROUP_INITIAL_SIZE	4096
+
+/*
+ * Sequential reader for zone files in DNSSEC canonical order; it only
+ * keeps the records of one owner name in memory at a time
+ */
+typedef struct _zd_stream
+{
+	const char*	zone_file;
+	const zd_opts*	opts;
+	zd_chunk	whole;
+	zd_map		map;
+	int		mapped;
+	zd_tok*		tok;
+	FILE*		zone_fd;
+	ldns_rdf*	origin;
+	ldns_rdf*	prev;
+	uint32_t	ttl;
+	int		line_no;
+	ldns_rr*	soa;
+	int		count;
+	zd_rec*		next;
+	int		have_next;
+	int		next_line;
+	uint8_t*	buf;
+	size_t		buf_len;
+	size_t		buf_size;
+	size_t*		ofs;
+	zd_rec**	recs;
+	size_t		rec_count;
+	size_t		rec_cap;
+	uint8_t		owner[LDNS_MAX_DOMAINLEN + 1];
+	int		have_owner;
+	size_t*		filtered;
+}
+zd_stream;
+
+/* Return the length of an uncompressed name in wire format */
+static size_t zd_wire_name_len(const uint8_t* name)
+{
+	size_t	i	= 0;
+
+	while (name[i] != 0)
+	{
+		i += name[i] + 1;
+	}
+
+	return i + 1;
+}
+
+/*
+ * Read the next record to compare from a stream; the SOA is set aside and
+ * excluded types are skipped. Returns 0, ZD_TOK_END or an error.
+ */
+static int zd_stream_read(zd_stream* stream, zd_rec* out)
+{
+	const zd_opts*	opts	= stream->opts;
+	int		rv	= 0;
+
+	for (;;)
+	{
+		ldns_rr*	rr		= NULL;
+		uint8_t*	rr_wire		= NULL;
+		size_t		rr_wire_size	= 0;
+		zd_tok_rr	rec		= { 0 };
+
+		if (stream->tok != NULL)
+		{
+			rv = zd_tok_next(stream->tok, &rec);
+
+			stream->line_no = zd_tok_line_no(stream->tok);
+
+			if (rv == ZD_TOK_END)
+			{
+				return ZD_TOK_END;
+			}
+
+			rr = rec.rr;
+		}
+		else
+		{
+			if (feof(stream->zone_fd))
+			{
+				return ZD_TOK_END;
+			}
+
+			if ((rv = ldns_rr_new_frm_fp_l(&rr, stream->zone_fd, &stream->ttl, &stream->origin, &stream->prev, &stream->line_no)) == LDNS_STATUS_OK)
+			{
+				if (rr == NULL) continue;
+
+				ldns_rr2canonical(rr);
+
+				rec.type = ldns_rr_get_type(rr);
+				rec.ttl = ldns_rr_ttl(rr);
+			}
+			else if ((rv == LDNS_STATUS_SYNTAX_EMPTY) || (rv == LDNS_STATUS_SYNTAX_TTL) || (rv == LDNS_STATUS_SYNTAX_ORIGIN))
+			{
+				continue;
+			}
+		}
+
+		if (rv != LDNS_STATUS_OK)
+		{
+			fprintf(stderr, "Error parsing zone file %s on line %d, aborting (%s)\n", stream->zone_file, stream->line_no, ldns_get_errorstr_by_id(rv));
+
+			return rv;
+		}
+
+		if (rec.type == LDNS_RR_TYPE_SOA)
+		{
+			size_t	pos	= 0;
+
+			if (stream->soa != NULL)
+			{
+				fprintf(stderr, "Error parsing zone file %s, encountered duplicate SOA record on line %d, aborting\n", stream->zone_file, stream->line_no);
+
+				if (rr != NULL) ldns_rr_free(rr);
+
+				return EINVAL;
+			}
+
+			if ((rr == NULL) && (ldns_wire2rr(&rr, rec.wire, rec.wire_len, &pos, LDNS_SECTION_ANSWER) != LDNS_STATUS_OK))
+			{
+				fprintf(stderr, "Error converting RR from wire format on line %d of %s, aborting\n", stream->line_no, stream->zone_file);
+
+				return EINVAL;
+			}
+
+			ldns_rr_set_ttl(rr, rec.ttl);
+			stream->soa = rr;
+			continue;
+		}
+
+		if (zd_skip_type(rec.type, opts))
+		{
+			stream->filtered[rec.type]++;
+
+			if (rr != NULL) ldns_rr_free(rr);
+
+			continue;
+		}
+
+		if (stream->tok != NULL)
+		{
+			/* Use the wire format the tokenizer made, with a fixed TTL */
+			if (rr != NULL) ldns_rr_free(rr);
+
+			zd_wire_mask_ttl(rec.wire, rec.ttl_ofs);
+		}
+		else
+		{
+			ldns_rr_set_ttl(rr, LDNS_DEFAULT_TTL);
+
+			rv = ldns_rr2wire(&rr_wire, rr, LDNS_SECTION_ANSWER, &rr_wire_size);
+
+			ldns_rr_free(rr);
+
+			if ((rv != LDNS_STATUS_OK) || (rr_wire_size > ZD_STREAM_MAX_WIRE))
+			{
+				fprintf(stderr, "Error converting RR to wire format on line %d of %s, aborting\n", stream->line_no, stream->zone_file);
+
+				free(rr_wire);
+
+				return EINVAL;
+			}
+
+			rec.wire = rr_wire;
+			rec.wire_len = rr_wire_size;
+		}
+
+		out->ttl = rec.ttl;
+		out->len = (uint32_t) rec.wire_len;
+		memcpy(out->wire, rec.wire, rec.wire_len);
+
+		free(rr_wire);
+
+		stream->count++;
+
+		return 0;
+	}
+}
+
+/* Add a copy of a record to the records of the current owner name */
+static int zd_stream_keep(zd_stream* stream, const zd_rec* rec)
+{
+	/* Keep the headers of the records aligned */
+	const size_t	size	= (sizeof(zd_rec) + rec->len + 3) & ~((size_t) 3);
+
+	while (stream->buf_len + size > stream->buf_size)
+	{
+		size_t		new_size	= (stream->buf_size > 0) ? 2 * stream->buf_size : ZD_GROUP_INITIAL_SIZE;
+		uint8_t*	new_buf		= (uint8_t*) realloc(stream->buf, new_size);
+
+		if (new_buf == NULL) return ENOMEM;
+
+		stream->buf = new_buf;
+		stream->buf_size = new_size;
+	}
+
+	if (stream->rec_count == stream->rec_cap)
+	{
+		size_t		new_cap		= (stream->rec_cap > 0) ? 2 * stream->rec_cap : 64;
+		size_t*		new_ofs		= (size_t*) realloc(stream->ofs, new_cap * sizeof(size_t));
+		zd_rec**	new_recs	= NULL;
+
+		if (new_ofs == NULL) return ENOMEM;
+
+		stream->ofs = new_ofs;
+
+		if ((new_recs = (zd_rec**) realloc(stream->recs, new_cap * sizeof(zd_rec*))) == NULL) return ENOMEM;
+
+		stream->recs = new_recs;
+		stream->rec_cap = new_cap;
+	}
+
+	memcpy(&stream->buf[stream->buf_len], rec, sizeof(zd_rec) + rec->len);
+	stream->ofs[stream->rec_count++] = stream->buf_len;
+	stream->buf_len += size;
+
+	return 0;
+}
+
+/*
+ * Read all records of the next owner name, sorted for merging; owner
+ * names must appear in strictly increasing canonical order. Returns 0,
+ * ZD_TOK_END when there are no more records, or an error.
+ */
+static int zd_stream_group(zd_stream* stream)
+{
+	size_t	owner_len	= 0;
+	size_t	i		= 0;
+	int	rv		= 0;
+
+	stream->buf_len = 0;
+	stream->rec_count = 0;
+
+	if (!stream->have_next)
+	{
+		return ZD_TOK_END;
+	}
+
+	if (stream->have_owner && (zd_dname_canon_cmp(stream->next->wire, stream->owner) <= 0))
+	{
+		fprintf(stderr, "Zone file %s is not in canonical order on line %d, aborting\n", stream->zone_file, stream->next_line);
+
+		return EINVAL;
+	}
+
+	owner_len = zd_wire_name_len(stream->next->wire);
+	memcpy(stream->owner, stream->next->wire, owner_len);
+	stream->have_owner = 1;
+
+	do
+	{
+		if ((rv = zd_stream_keep(stream, stream->next)) != 0) return rv;
+
+		if ((rv = zd_stream_read(stream, stream->next)) == ZD_TOK_END)
+		{
+			stream->have_next = 0;
+			break;
+		}
+
+		if (rv != 0) return rv;
+
+		stream->next_line = stream->line_no;
+	}
+	while ((zd_wire_name_len(stream->next->wire) == owner_len) && (memcmp(stream->next->wire, stream->owner, owner_len) == 0));
+
+	/* The buffer no longer moves, so the records can be addressed directly */
+	for (i = 0; i < stream->rec_count; i++)
+	{
+		stream->recs[i] = (zd_rec*) &stream->buf[stream->ofs[i]];
+	}
+
+	qsort(stream->recs, stream->rec_count, sizeof(zd_rec*), zd_rec_ptr_cmp);
+
+	return 0;
+}
+
+/* Close a stream and free everything it holds */
+static void zd_stream_close(zd_stream* stream)
+{
+	if (stream->tok != NULL) zd_tok_free(stream->tok);
+	if (stream->mapped) zd_unmap_file(&stream->map);
+	if (stream->zone_fd != NULL) fclose(stream->zone_fd);
+	if (stream->origin != NULL) ldns_rdf_deep_free(stream->origin);
+	if (stream->prev != NULL) ldns_rdf_deep_free(stream->prev);
+	if (stream->soa != NULL) ldns_rr_free(stream->soa);
+
+	free(stream->next);
+	free(stream->buf);
+	free(stream->ofs);
+	free(stream->recs);
+
+	memset(stream, 0, sizeof(zd_stream));
+}
+
+/* Finish reading a stream; returns EIO if its zone data ended early */
+static int zd_stream_finish(zd_stream* stream)
+{
+	int	rv	= 0;
+
+	if ((stream->zone_fd != NULL) && (fclose(stream->zone_fd) != 0))
+	{
+		rv = EIO;
+	}
+
+	stream->zone_fd = NULL;
+
+	return rv;
+}
+
+/* Open a zone file for streaming and read ahead to its first record */
+static int zd_stream_open(zd_stream* stream, const char* zone_file, const zd_opts* opts, zd_zone_stats* stats)
+{
+	int	compressed	= zd_comp_detect(zone_file);
+	int	rv		= 0;
+
+	memset(stream, 0, sizeof(zd_stream));
+
+	stream->zone_file = zone_file;
+	stream->opts = opts;
+	stream->filtered = stats->filtered;
+	stream->whole.end = -1;
+
+	if ((stream->next = (zd_rec*) malloc(sizeof(zd_rec) + ZD_STREAM_MAX_WIRE)) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	zd_range_state(&stream->whole, opts, &stream->origin, &stream->ttl, &stream->prev);
+
+	if ((compressed == ZD_COMP_NONE) && !opts->ldns_parser && (zd_map_file(zone_file, &stream->map) == 0))
+	{
+		stream->mapped = 1;
+
+		/* The tokenizer takes over the origin */
+		stream->tok = zd_tok_new(&stream->map, &stream->whole, stream->origin, stream->ttl, stream->prev);
+		stream->origin = NULL;
+
+		if (stream->tok == NULL)
+		{
+			zd_stream_close(stream);
+
+			return ENOMEM;
+		}
+
+		zd_tok_filter(stream->tok, opts, stream->filtered);
+	}
+	else if ((stream->zone_fd = (compressed != ZD_COMP_NONE) ? zd_comp_fopen(zone_file, compressed) : fopen(zone_file, "r")) == NULL)
+	{
+		rv = errno;
+
+		fprintf(stderr, "Failed to open zone file %s\n", zone_file);
+
+		zd_stream_close(stream);
+
+		return rv;
+	}
+
+	if ((rv = zd_stream_read(stream, stream->next)) == 0)
+	{
+		stream->have_next = 1;
+		stream->next_line = stream->line_no;
+	}
+	else if (rv != ZD_TOK_END)
+	{
+		zd_stream_close(stream);
 
-#define	RR_HASH		(EVP_sha256())
-#define RR_HASH_SIZE	32
+		return rv;
+	}
 
-typedef struct _dnsz_ll_ent
-{
-	unsigned char		rr_hash[RR_HASH_SIZE];
-	ldns_rr*		rr;
-	struct _dnsz_ll_ent*	next;
+	return 0;
 }
-dnsz_ll_ent;
 
-/* Element comparison for sorting */
-static int zd_dnsz_ll_ent_cmp(const dnsz_ll_ent* a, const dnsz_ll_ent* b)
+/* Return the current origin of a stream in presentation format, or NULL if none */
+static char* zd_stream_origin_str(const zd_stream* stream)
 {
-	return memcmp(a->rr_hash, b->rr_hash, RR_HASH_SIZE);
+	if (stream->tok != NULL)
+	{
+		return zd_tok_origin_str(stream->tok);
+	}
+
+	return (stream->origin != NULL) ? ldns_rdf2str(stream->origin) : NULL;
 }
 
-/* A missing routine in ldns, written out for symmetry */
-static uint32_t ldnsplus_rr_get_ttl(ldns_rr *rr)
+/* Report the differences between the sorted records of one owner name */
+static int zd_diff_group(const zd_diff_ctx* ctx, zd_rec** left, const size_t left_count, zd_rec** right, const size_t right_count)
 {
-	return rr->_ttl;
+	size_t	left_it		= 0;
+	size_t	right_it	= 0;
+	int	rv		= 0;
+
+	while ((left_it < left_count) || (right_it < right_count))
+	{
+		zd_rec*	rr2del = NULL;
+		zd_rec*	rr2add = NULL;
+		int	lr_comp	= 0;
+
+		if (left_it >= left_count)
+		{
+			lr_comp = 1;
+		}
+		else if (right_it >= right_count)
+		{
+			lr_comp = -1;
+		}
+		else
+		{
+			lr_comp = zd_rec_cmp(left[left_it], right[right_it]);
+		}
+
+		if (lr_comp == 0)
+		{
+			/* The TTL may still differ, because it was not compared */
+			if (left[left_it]->ttl != right[right_it]->ttl)
+			{
+				rr2del = left[left_it];
+				rr2add = right[right_it];
+			}
+
+			left_it++;
+			right_it++;
+		}
+		else if (lr_comp < 0)
+		{
+			rr2del = left[left_it++];
+		}
+		else
+		{
+			rr2add = right[right_it++];
+		}
+
+		if (((rr2del != NULL) || (rr2add != NULL)) && ((rv = zd_report_diff(rr2del, rr2add, (void*) ctx)) != 0))
+		{
+			return rv;
+		}
+	}
+
+	return 0;
 }
 
-/* Load a DNS zone from the specified file */
-static int zd_load_zone(const char* zone_file, const char* explicit_origin, char** zone_name, const int include_sigs, const int include_keys, const int include_nsecs, const int include_delegs, const int include_serial, const int output_knotc_commands, dnsz_ll_ent** zone_ll, ldns_rr** soa)
+/*
+ * Compute the difference between two zone files that are both in DNSSEC
+ * canonical order, reading them in lockstep one owner name at a time
+ */
+static int zd_diff_sorted(zd_print_ctx* print, const char* left_zone, const char* right_zone, const zd_opts* opts)
 {
-	assert(zone_file != NULL);
-	assert(zone_ll != NULL);
-	assert(soa != NULL);
+	zd_out*		out		= print->out;
+	zd_stats*	stats		= print->stats;
+	zd_stream	left		= { 0 };
+	zd_stream	right		= { 0 };
+	zd_diff_ctx	diff_ctx	= { zd_print_change, print };
+	zd_update	update		= { 0 };
+	char*		zone_name	= NULL;
+	int		left_rv		= 0;
+	int		right_rv	= 0;
+	int		rv		= 0;
 
-	FILE*		zone_fd			= fopen(zone_file, "r");
-	ldns_rr*	cur_rr			= NULL;
-	ldns_rr*	pre_rr			= NULL;
-	ldns_rdf*	origin			= NULL;
-	ldns_rdf*	prev			= NULL;
-	uint8_t*	rr_wire			= NULL;
-	size_t		rr_wire_size		= 0;
-	int		line_no			= 0;
-	unsigned int	digest_size		= RR_HASH_SIZE;
-	int		rv			= 0;
-	uint32_t	ttl			= 0;
-	unsigned char	digest[RR_HASH_SIZE]	= { 0 };
-	EVP_MD_CTX	ctx			= { 0 };
-	int		count			= 0;
+	const int	output_knotc_commands	= opts->quiet ? 0 : opts->output_knotc_commands;
+	const int	output_summary		= !opts->quiet && !opts->output_knotc_commands && (opts->output_format == ZD_OUT_TEXT);
 
-	*soa = NULL;
-	*zone_ll = NULL;
+	/* In quiet mode, the first difference ends the comparison */
+	if (opts->quiet)
+	{
+		diff_ctx.cb = zd_quiet_change;
+		diff_ctx.arg = print->diffcount;
+	}
 
-	if (zone_fd == NULL)
+	if ((rv = zd_stream_open(&left, left_zone, opts, &stats->left)) != 0)
 	{
-		fprintf(stderr, "Failed to open zone file %s\n", zone_file);
+		return rv;
+	}
+
+	if ((rv = zd_stream_open(&right, right_zone, opts, &stats->right)) != 0)
+	{
+		zd_stream_close(&left);
 
-		return errno;
+		return rv;
 	}
 
-	if (explicit_origin != NULL)
+	/* The SOA is at the apex, which sorts first */
+	left_rv = zd_stream_group(&left);
+	right_rv = zd_stream_group(&right);
+
+	if (((left_rv != 0) && (left_rv != ZD_TOK_END)) || ((right_rv != 0) && (right_rv != ZD_TOK_END)))
 	{
-		origin = ldns_dname_new_frm_str(explicit_origin);
+		rv = ((left_rv != 0) && (left_rv != ZD_TOK_END)) ? left_rv : right_rv;
+
+		goto cleanup;
 	}
 
-	while (!feof(zone_fd))
+	if (left.soa == NULL)
 	{
-		dnsz_ll_ent*	new_ent	= NULL;
+		fprintf(stderr, "Left zone does not have a valid SOA record at its apex, please check if the zone file %s is valid.\n", left_zone);
 
-		if ((rv = ldns_rr_new_frm_fp_l(&cur_rr, zone_fd, &ttl, &origin, &prev, &line_no)) != LDNS_STATUS_OK)
-		{
-			switch(rv)
-			{
-			case LDNS_STATUS_SYNTAX_EMPTY:
-			case LDNS_STATUS_SYNTAX_TTL:
-			case LDNS_STATUS_SYNTAX_ORIGIN:
-				break;
-			default:
-				fprintf(stderr, "Error parsing zone file %s on line %d, aborting (%s)\n", zone_file, line_no, ldns_get_errorstr_by_id(rv));
-				return rv;
-			}
-			
-			continue;
-		}
+		rv = 1;
+		goto cleanup;
+	}
 
-		if (cur_rr == NULL) continue;
+	if (right.soa == NULL)
+	{
+		fprintf(stderr, "Right zone does not have a valid SOA record at its apex, please check if the zone file %s is valid.\n", right_zone);
 
-		ldns_rr2canonical(cur_rr);
+		rv = 1;
+		goto cleanup;
+	}
 
-		if (ldns_rr_get_type(cur_rr) == LDNS_RR_TYPE_SOA)
-		{
-			if (*soa != NULL)
-			{
-				fprintf(stderr, "Error parsing zone file %s, encountered duplicate SOA record on line %d, aborting\n", zone_file, line_no);
+	/* Sorted dumps rarely set an origin, so fall back to the SOA owner */
+	if ((zone_name = zd_stream_origin_str(&left)) == NULL)
+	{
+		zone_name = ldns_rdf2str(ldns_rr_owner(left.soa));
+	}
 
-				return EINVAL;
-			}
+	if (zone_name == NULL)
+	{
+		fprintf(stderr, "Failed to determine domain name from zone or explicit origin.\n");
 
-			*soa = cur_rr;
-			continue;
-		}
+		rv = 1;
+		goto cleanup;
+	}
 
-		if (((ldns_rr_get_type(cur_rr) == LDNS_RR_TYPE_RRSIG) && !include_sigs) ||
-		    ((ldns_rr_get_type(cur_rr) == LDNS_RR_TYPE_DNSKEY) && !include_keys) ||
-		    ((ldns_rr_get_type(cur_rr) == LDNS_RR_TYPE_DS) && !include_delegs) ||
-		    ((ldns_rr_get_type(cur_rr) == LDNS_RR_TYPE_NSEC) && !include_nsecs) ||
-		    ((ldns_rr_get_type(cur_rr) == LDNS_RR_TYPE_NSEC3) && !include_nsecs) ||
-		    ((ldns_rr_get_type(cur_rr) == LDNS_RR_TYPE_NSEC3PARAM) && !include_nsecs))
+	print->zone_name = zone_name;
+
+	/* IXFR responses and nsupdate scripts are framed by the SOA records */
+	if (!opts->quiet && ((opts->output_format == ZD_OUT_IXFR) || (opts->output_format == ZD_OUT_NSUPDATE)))
+	{
+		if ((rv = zd_update_init(&update, out, opts->output_format, zone_name, left.soa, right.soa, 1)) != 0)
 		{
-			ldns_rr_free(cur_rr);
-			continue;
+			goto cleanup;
 		}
 
-		/* Clone the RR with a fixed TTL so it will not impact hash sorting */
-		pre_rr = ldns_rr_clone(cur_rr);
+		print->update = &update;
+	}
+
+	/* If outputting knotc commands and no contextual transation,
+	 * start a transaction for the diff */
+	if (output_knotc_commands == 1)
+	{
+		zd_out_printf(out, "zone-begin %s\n", zone_name);
+	}
 
-		if (pre_rr == NULL) {
-			ldns_rr_free(cur_rr);
-			return ENOMEM;
-		}
+	if ((rv = zd_diff_soa(&diff_ctx, left.soa, right.soa, opts)) != 0)
+	{
+		goto cleanup;
+	}
 
-		ldns_rr_set_ttl(pre_rr, LDNS_DEFAULT_TTL);
+	/* Walk both zones one owner name at a time */
+	while ((left_rv == 0) || (right_rv == 0))
+	{
+		int	owner_comp	= 0;
 
-		/* Convert the RR to wire format for hashing */
-		if (ldns_rr2wire(&rr_wire, pre_rr, LDNS_SECTION_ANSWER, &rr_wire_size) != LDNS_STATUS_OK)
+		if (left_rv != 0)
 		{
-			fprintf(stderr, "Error converting RR to wire format on line %d of %s, aborting\n", line_no, zone_file);
-
-			return EINVAL;
+			owner_comp = 1;
 		}
-
-		if (EVP_DigestInit(&ctx, RR_HASH) != 1)
+		else if (right_rv != 0)
 		{
-			fprintf(stderr, "Failed to initialise hashing\n");
-
-			return EINVAL;
+			owner_comp = -1;
 		}
-
-		if (EVP_DigestUpdate(&ctx, rr_wire, rr_wire_size) != 1)
+		else
 		{
-			fprintf(stderr, "Failed to update hash of RR\n");
-			
-			return EINVAL;
+			owner_comp = zd_dname_canon_cmp(left.owner, right.owner);
 		}
 
-		if (EVP_DigestFinal(&ctx, digest, &digest_size) != 1)
+		if ((rv = zd_diff_group(&diff_ctx,
+		                        left.recs, (owner_comp <= 0) ? left.rec_count : 0,
+		                        right.recs, (owner_comp >= 0) ? right.rec_count : 0)) != 0)
 		{
-			fprintf(stderr, "Failed to output hash of RR\n");
-
-			return EINVAL;
+			goto cleanup;
 		}
 
-		ldns_rr_free(pre_rr);
-		pre_rr = NULL;
-
-		free(rr_wire);
-		rr_wire = NULL;
-		rr_wire_size = 0;
-
-		new_ent = (dnsz_ll_ent*) malloc(sizeof(dnsz_ll_ent));
-		memset(new_ent, 0, sizeof(dnsz_ll_ent));
-
-		/* Add the RR */
-		memcpy(new_ent->rr_hash, digest, RR_HASH_SIZE);
-		new_ent->rr = cur_rr;
+		if (owner_comp <= 0) left_rv = zd_stream_group(&left);
+		if (owner_comp >= 0) right_rv = zd_stream_group(&right);
 
-		LL_APPEND(*zone_ll, new_ent);
+		if (((left_rv != 0) && (left_rv != ZD_TOK_END)) || ((right_rv != 0) && (right_rv != ZD_TOK_END)))
+		{
+			rv = ((left_rv != 0) && (left_rv != ZD_TOK_END)) ? left_rv : right_rv;
 
-		count++;
+			goto cleanup;
+		}
 	}
 
-	if (!output_knotc_commands)
+	/* Corrupt compressed data ends a zone early */
+	if (((rv = zd_stream_finish(&left)) != 0) || ((rv = zd_stream_finish(&right)) != 0))
 	{
-		printf("; Collected %d records from %d lines of zone data in %s\n", count, line_no, zone_file);
+		goto cleanup;
 	}
 
-	if (origin != NULL)
+	if ((print->update != NULL) && ((rv = zd_update_finish(print->update)) != 0))
 	{
-		if (zone_name != NULL)
-		{
-			*zone_name = ldns_rdf2str(origin);
-		}
+		goto cleanup;
+	}
 
-		ldns_rdf_deep_free(origin);
+	/* If outputting knotc commands and no contextual transaction,
+	 * commit the transaction now */
+	if (output_knotc_commands == 1)
+	{
+		zd_out_printf(out, "zone-commit %s\n", zone_name);
 	}
 
-	if (prev != NULL)
+	/* Counts are only known once the zones have been read completely */
+	stats->left.records = left.count;
+	stats->left.lines = left.line_no;
+	stats->right.records = right.count;
+	stats->right.lines = right.line_no;
+
+	if (output_summary)
 	{
-		ldns_rdf_deep_free(prev);
+		zd_out_printf(out, "; Collected %d records from %d lines of zone data in %s\n", left.count, left.line_no, left_zone);
+		zd_out_printf(out, "; Collected %d records from %d lines of zone data in %s\n", right.count, right.line_no, right_zone);
 	}
 
-	fclose(zone_fd);
+cleanup:
+	zd_stream_close(&left);
+	zd_stream_close(&right);
+	zd_update_free(&update);
 
-	/* Finally, sort the zone data in hash order */
-	LL_SORT(*zone_ll, zd_dnsz_ll_ent_cmp);
+	print->update = NULL;
 
-	return 0;
+	free(zone_name);
+
+	return (rv == ZD_DIFF_STOP) ? 0 : rv;
 }
 
-/* Free zone data */
-static void zd_free_zone(dnsz_ll_ent** zone_ll)
+/*
+ * Report the outcome of checking the ZONEMD record of a zone along with
+ * the differences; a mismatch goes to stderr if there is no such report
+ */
+static void zd_out_zonemd(zd_out* out, const zd_zone* zone, const char* zone_file, const int output_summary)
 {
-	assert(zone_ll != NULL);
+	char	hex[2 * ZD_ZONEMD_SIZE + 1]	= { 0 };
+	int	i				= 0;
 
-	dnsz_ll_ent*	ll_it	= NULL;
-	dnsz_ll_ent*	ll_tmp	= NULL;
-
-	LL_FOREACH_SAFE(*zone_ll, ll_it, ll_tmp)
+	for (i = 0; i < ZD_ZONEMD_SIZE; i++)
 	{
-		ldns_rr_free(ll_it->rr);
-		free(ll_it);
+		snprintf(&hex[2 * i], 3, "%02x", zone->zonemd.digest[i]);
 	}
 
-	*zone_ll = NULL;
-}
-
-/* Escape single quotes in a string (needed for knotc output) */
-static char* zd_escape(char* str)
-{
-	char	out_buf[4096]	= { 0 };
-	size_t	ofs		= 0;
-	size_t	i		= 0;
-
-	for (i = 0; i < strlen(str) && (4096-ofs > 0); i++)
+	switch(zone->zonemd.status)
 	{
-		if (str[i] == '\"')
+	case ZD_ZONEMD_VALID:
+		if (output_summary) zd_out_printf(out, "; ZONEMD of %s verified\n", zone_file);
+		break;
+	case ZD_ZONEMD_INVALID:
+		if (output_summary)
 		{
-			snprintf(&out_buf[ofs], 4096-ofs, "\\\"");
-			ofs += 2;
-		}
-		else if (str[i] == '\\')
-		{
-			snprintf(&out_buf[ofs], 4096-ofs, "\\\\");
-			ofs += 2;
+			zd_out_printf(out, "; ZONEMD of %s does not match the zone data, computed digest %s\n", zone_file, hex);
 		}
 		else
 		{
-			snprintf(&out_buf[ofs], 4096-ofs, "%c", str[i]);
-			ofs++;
+			fprintf(stderr, "ZONEMD of %s does not match the zone data, computed digest %s\n", zone_file, hex);
 		}
+		break;
+	case ZD_ZONEMD_MISSING:
+		if (output_summary) zd_out_printf(out, "; No SIMPLE/SHA384 ZONEMD record in %s, computed digest %s\n", zone_file, hex);
+		break;
 	}
-
-	free(str);
-
-	return strdup(out_buf);
 }
 
-/* Output an RR that changed */
-static void zd_output_rr(const char* zone_name, const ldns_rr* rr, int remove, const int output_knotc_commands)
+/* Compute the difference between left_zone and right_zone and write it to fd */
+int zd_diff_files(const char* left_zone, const char* right_zone, const zd_opts* opts, const int fd, int* diffcount)
 {
-	assert(rr != NULL);
+	assert(left_zone != NULL);
+	assert(right_zone != NULL);
+	assert(opts != NULL);
+	assert(diffcount != NULL);
 
-	/* Collect string versions of RR data */
-	char*	owner		= ldns_rdf2str(ldns_rr_owner(rr));
-	char*	type		= ldns_rr_type2str(ldns_rr_get_type(rr));
-	char	ttl[32]		= { 0 };
-	char**	rdata		= (char**) malloc(ldns_rr_rd_count(rr) * sizeof(char*));
-	size_t	i		= 0;
-	size_t	ofs		= 0;
-	char	out_buf[4096]	= { 0 };
+	zd_zone*	left		= NULL;
+	zd_zone*	right		= NULL;
+	zd_out		out		= { 0 };
+	zd_print_ctx	print		= { 0 };
+	zd_update	update		= { 0 };
+	zd_stats	stats		= { { 0 } };
+	zd_load_job	left_job	= { 0 };
+	zd_load_job	right_job	= { 0 };
+	pthread_t	left_thread;
+	int		left_threaded	= 0;
+	int		rv		= 0;
 
-	snprintf(ttl, 32, "%u", ldns_rr_ttl(rr));
+	const int	output_knotc_commands	= opts->quiet ? 0 : opts->output_knotc_commands;
+	const int	output_summary		= !opts->quiet && !opts->output_knotc_commands && (opts->output_format == ZD_OUT_TEXT);
 
-	for (i = 0; i < ldns_rr_rd_count(rr); i++)
+	/* All output goes through one buffer that is written in large blocks */
+	if ((rv = zd_out_init(&out, fd)) != 0)
 	{
-		if (output_knotc_commands)
-		{
-			rdata[i] = zd_escape(ldns_rdf2str(ldns_rr_rdf(rr, i)));
-		}
-		else
-		{
-			rdata[i] = ldns_rdf2str(ldns_rr_rdf(rr, i));
-		}
+		return rv;
 	}
 
-	/* Add owner name to RR string representation */
-	snprintf(&out_buf[0], 4096, "%s ", owner);
-	ofs += strlen(owner) + 1;
-	free(owner);
-
-	/* Add TTL */
-	snprintf(&out_buf[ofs], 4096-ofs, "%s ", ttl);
-	ofs += strlen(ttl) + 1;
+	print.out = &out;
+	print.output_knotc_commands = output_knotc_commands;
+	print.output_format = opts->output_format;
+	print.stats = &stats;
+	print.diffcount = diffcount;
 
-	/* Add type */
-	snprintf(&out_buf[ofs], 4096-ofs, "%s ", type);
-	ofs += strlen(type) + 1;
-	free(type);
+	zd_stats_begin(&stats.phases[ZD_PHASE_TOTAL]);
 
-	if (output_knotc_commands)
+	/* Zones that are already in canonical order can be streamed; loading
+	 * and comparing them is one phase */
+	if (opts->sorted_input)
 	{
-		snprintf(&out_buf[ofs], 4096-ofs, "\"");
-		ofs += 1;
+		zd_stats_begin(&stats.phases[ZD_PHASE_DIFF]);
+
+		rv = zd_diff_sorted(&print, left_zone, right_zone, opts);
+
+		zd_stats_end(&stats.phases[ZD_PHASE_DIFF]);
+
+		goto cleanup;
 	}
 
-	/* Add RDATA */
-	for (i = 0; i < ldns_rr_rd_count(rr); i++)
+	/* In quiet mode, zones are only sorted if their sums are not enough */
+	left_job.zone_file = left_zone;
+	left_job.opts = opts;
+	left_job.sort = !opts->quiet;
+	right_job.zone_file = right_zone;
+	right_job.opts = opts;
+	right_job.sort = !opts->quiet;
+
+	zd_stats_begin(&stats.phases[ZD_PHASE_LOAD]);
+
+	/* The zones share no state, so load the left zone on a separate
+	 * thread while this thread loads the right zone; if no thread can
+	 * be started, fall back to loading them one after the other */
+	left_threaded = (pthread_create(&left_thread, NULL, zd_load_job_run, &left_job) == 0);
+
+	if (!left_threaded)
 	{
-		snprintf(&out_buf[ofs], 4096-ofs, "%s ", rdata[i]);
-		ofs += strlen(rdata[i]) + 1;
-		free(rdata[i]);
+		zd_load_job_run(&left_job);
 	}
 
-	free(rdata);
-	out_buf[ofs-1] = '\0';
-	ofs--;
+	zd_load_job_run(&right_job);
 
-	if (output_knotc_commands)
+	if (left_threaded)
 	{
-		snprintf(&out_buf[ofs], 4096-ofs, "\"");
-		ofs += 1;
+		pthread_join(left_thread, NULL);
 	}
 
-	if (output_knotc_commands)
+	zd_stats_end(&stats.phases[ZD_PHASE_LOAD]);
+
+	left = left_job.zone;
+	right = right_job.zone;
+
+	if (left != NULL) stats.left = left->stats;
+	if (right != NULL) stats.right = right->stats;
+
+	/* Report in a fixed order, regardless of which load finished first */
+	if (output_summary)
 	{
-		if (remove)
+		if (left != NULL)
 		{
-			printf("zone-unset %s %s\n", zone_name, out_buf);
+			zd_out_printf(&out, "; Collected %d records from %d lines of zone data in %s\n", stats.left.records, stats.left.lines, left_zone);
 		}
-		else
+
+		if (right != NULL)
 		{
-			printf("zone-set %s %s\n", zone_name, out_buf);
+			zd_out_printf(&out, "; Collected %d records from %d lines of zone data in %s\n", stats.right.records, stats.right.lines, right_zone);
 		}
 	}
-	else
+
+	if ((left_job.rv != 0) || (right_job.rv != 0))
 	{
-		printf("%s %s\n", remove ? "--" : "++", out_buf);
-	}
-}
+		rv = (left_job.rv != 0) ? left_job.rv : right_job.rv;
 
-/* Compute the difference between left_zone and right_zone and output to stdout */
-int do_zonediff(const char* left_zone, const char* right_zone, const char* origin, const int include_sigs, const int include_keys, const int include_nsecs, const int include_delegs, const int include_serial, const int output_knotc_commands, int* diffcount)
-{
-	assert(left_zone != NULL);
-	assert(right_zone != NULL);
-	assert(diffcount != NULL);
+		goto cleanup;
+	}
 
-	dnsz_ll_ent*	left_zone_ll	= NULL;
-	dnsz_ll_ent*	right_zone_ll	= NULL;
-	ldns_rr*	left_soa	= NULL;
-	ldns_rr*	right_soa	= NULL;
-	dnsz_ll_ent*	left_it		= NULL;
-	dnsz_ll_ent*	right_it	= NULL;
-	char*		zone_name	= NULL;
-	int		rv		= 0;
-	
-	if (((rv = zd_load_zone(left_zone, origin, &zone_name, include_sigs, include_keys, include_nsecs, include_delegs, include_serial, output_knotc_commands, &left_zone_ll, &left_soa)) != 0) ||
-	    ((rv = zd_load_zone(right_zone, origin, NULL, include_sigs, include_keys, include_nsecs, include_delegs, include_serial, output_knotc_commands, &right_zone_ll, &right_soa)) != 0))
+	if (!opts->quiet)
 	{
-		return rv;
+		zd_out_zonemd(&out, left, left_zone, output_summary);
+		zd_out_zonemd(&out, right, right_zone, output_summary);
 	}
 
 	/* Check if both zones have a SOA record, if not, then the zone is invalid */
-	if (left_soa == NULL)
+	if (left->soa == NULL)
 	{
 		fprintf(stderr, "Left zone does not have a valid SOA record, please check if the zone file %s is valid.\n", left_zone);
 
-		return 1;
+		rv = 1;
+		goto cleanup;
 	}
 
-	if (right_soa == NULL)
+	if (right->soa == NULL)
 	{
 		fprintf(stderr, "Right zone does not have a valid SOA record, please check if the zone file %s is valid.\n", right_zone);
 
-		return 1;
+		rv = 1;
+		goto cleanup;
 	}
 
-	if (zone_name == NULL)
+	/* The zone name is always taken from the left zone */
+	if (left->name == NULL)
 	{
 		fprintf(stderr, "Failed to determine domain name from zone or explicit origin.\n");
 
-		return 1;
+		rv = 1;
+		goto cleanup;
 	}
 
-	/* If outputting knotc commands and no contextual transation,
-	 * start a transaction for the diff */
-	if (output_knotc_commands == 1)
-	{
-		printf("zone-begin %s\n", zone_name);
-	}
+	print.zone_name = left->name;
 
-	/* 
-	 * Perform the SOA comparison; we output a changed SOA if one of the
-	 * fields other than the serial has changed, or if the serial in the
-	 * right file is higher than the SOA in the left file
-	 */
-	if ((ldns_rdf_compare(ldns_rr_rdf(left_soa, 0), ldns_rr_rdf(right_soa, 0)) != 0) ||  /* SOA MNAME changed? */
-	    (ldns_rdf_compare(ldns_rr_rdf(left_soa, 1), ldns_rr_rdf(right_soa, 1)) != 0) ||  /* SOA RNAME changed? */
-	    (include_serial && (ldns_rdf_compare(ldns_rr_rdf(left_soa, 2), ldns_rr_rdf(right_soa, 2)) < 0)) ||   /* SOA serial right higher than left? */
-	    (ldns_rdf_compare(ldns_rr_rdf(left_soa, 3), ldns_rr_rdf(right_soa, 3)) != 0) ||  /* SOA refresh changed? */
-	    (ldns_rdf_compare(ldns_rr_rdf(left_soa, 4), ldns_rr_rdf(right_soa, 4)) != 0) ||  /* SOA retry changed? */
-	    (ldns_rdf_compare(ldns_rr_rdf(left_soa, 5), ldns_rr_rdf(right_soa, 5)) != 0) ||  /* SOA expire changed? */
-	    (ldns_rdf_compare(ldns_rr_rdf(left_soa, 6), ldns_rr_rdf(right_soa, 6)) != 0))    /* SOA minimum changed? */
+	/* IXFR responses and nsupdate scripts are framed by the SOA records */
+	if (!opts->quiet && ((opts->output_format == ZD_OUT_IXFR) || (opts->output_format == ZD_OUT_NSUPDATE)))
 	{
-		/* Check if the left SOA serial is higher than, or equal to the right SOA serial */
-		if (ldns_rdf_compare(ldns_rr_rdf(left_soa, 2), ldns_rr_rdf(right_soa, 2)) >= 0)
+		if ((rv = zd_update_init(&update, &out, opts->output_format, left->name, left->soa, right->soa, opts->max_memory > 0)) != 0)
 		{
-			uint32_t	soa_serial	= 0;
-			ldns_rdf*	old_soa		= NULL;
-
-			/* Check if the left SOA serial is higher than the right SOA, if so,
-			   replace the right SOA serial with the one from the left */
-			if (ldns_rdf_compare(ldns_rr_rdf(left_soa, 2), ldns_rr_rdf(right_soa, 2)) >= 0)
-			{
-				ldns_rdf*	new_soa	= ldns_rdf_clone(ldns_rr_rdf(left_soa, 2));
-				ldns_rdf*	old_soa	= NULL;
-
-				old_soa = ldns_rr_set_rdf(right_soa, new_soa, 2);
+			goto cleanup;
+		}
 
-				ldns_rdf_deep_free(old_soa);
-			}
+		print.update = &update;
+	}
 
-			/* Ensure that the SOA serial that is output is higher than the
-			   old left SOA serial */
-			soa_serial = ldns_rdf2native_int32(ldns_rr_rdf(right_soa, 2));
-			soa_serial++;
+	zd_stats_begin(&stats.phases[ZD_PHASE_DIFF]);
 
-			old_soa = ldns_rr_set_rdf(right_soa, ldns_native2rdf_int32(LDNS_RDF_TYPE_INT32, soa_serial), 2);
+	if (opts->quiet)
+	{
+		rv = zd_diff_quiet(left, right, opts, diffcount);
 
-			ldns_rdf_deep_free(old_soa);
-		}
+		zd_stats_end(&stats.phases[ZD_PHASE_DIFF]);
 
-		zd_output_rr(zone_name, left_soa, 1, output_knotc_commands);
-		zd_output_rr(zone_name, right_soa, 0, output_knotc_commands);
+		/* Any sorting happened while comparing */
+		stats.left.sort_time = left->stats.sort_time;
+		stats.right.sort_time = right->stats.sort_time;
 
-		(*diffcount)++;
+		goto cleanup;
 	}
 
-	ldns_rr_free(left_soa);
-	ldns_rr_free(right_soa);
+	/* If outputting knotc commands and no contextual transation,
+	 * start a transaction for the diff */
+	if (output_knotc_commands == 1)
+	{
+		zd_out_printf(&out, "zone-begin %s\n", left->name);
+	}
 
-	/* Iterate over both zones and output the differences */
-	left_it = left_zone_ll;
-	right_it = right_zone_ll;
+	/* Compare both zones and output the differences */
+	rv = zd_diff_zones(left, right, opts, zd_print_change, &print);
 
-	while (left_it || right_it)
+	if ((rv == 0) && (print.update != NULL))
 	{
-		dnsz_ll_ent*	entry2del = NULL;
-		dnsz_ll_ent*	entry2add = NULL;
-		if (left_it && right_it)
-		{
-			int lr_comp = memcmp(left_it->rr_hash, right_it->rr_hash, RR_HASH_SIZE);
+		rv = zd_update_finish(print.update);
+	}
 
-			if (lr_comp == 0)
-			{
-				/* The TTL may still differ, because these were not hashed */
-				if (ldnsplus_rr_get_ttl(left_it->rr) != ldnsplus_rr_get_ttl(right_it->rr))
-				{
-					entry2del = left_it;
-					entry2add = right_it;
-				}
-				/* Left and right hashes are in sync, advance both */
-				left_it = left_it->next;
-				right_it = right_it->next;
-			}
-			else if (lr_comp < 0)
-			{
-				/* Record from left zone is not in right zone */
-				entry2del = left_it;
-				left_it = left_it->next;
-			}
-			else
-			{
-				/* Record from right zone is not in left zone */
-				entry2add = right_it;
-				right_it = right_it->next;
-			}
-		}
-		else if (!left_it && right_it)
-		{
-			/* Additional records in right zone that are not present in the left zone */
-			entry2add = right_it;
+	zd_stats_end(&stats.phases[ZD_PHASE_DIFF]);
 
-			/* Advance right iterator */
-			right_it = right_it->next;
+	if (rv != 0)
+	{
+		goto cleanup;
+	}
 
-		}
-		else if (left_it && !right_it)
-		{
-			/* Additional records in the left zone that are not present in the right zone */
-			entry2del = left_it;
+	/* If outputting knotc commands and no contextual transaction,
+	 * commit the transaction now */
+	if (output_knotc_commands == 1)
+	{
+		zd_out_printf(&out, "zone-commit %s\n", left->name);
+	}
 
-			/* Advance left iterator */
-			left_it = left_it->next;
-		}
+cleanup:
+	zd_zone_free(left);
+	zd_zone_free(right);
+	zd_update_free(&update);
 
-		/* Delete before add -- either for most changes, both for TTL changes */
-		if (entry2del != NULL) {
-			zd_output_rr(zone_name, entry2del->rr, 1, output_knotc_commands);
-			(*diffcount)++;
-		}
-		if (entry2add != NULL) {
-			zd_output_rr(zone_name, entry2add->rr, 0, output_knotc_commands);
-			(*diffcount)++;
-		}
+	if ((zd_out_free(&out) != 0) && (rv == 0))
+	{
+		fprintf(stderr, "Failed to write the differences between %s and %s\n", left_zone, right_zone);
+
+		rv = EIO;
 	}
 
-	zd_free_zone(&left_zone_ll);
-	zd_free_zone(&right_zone_ll);
+	zd_stats_end(&stats.phases[ZD_PHASE_TOTAL]);
 
-	/* If outputting knotc commands and no contextual transaction,
-	 * commit the transaction now */
-	if (output_knotc_commands == 1)
+	if ((rv == 0) && (opts->stats != ZD_STATS_NONE))
 	{
-		printf("zone-commit %s\n", zone_name);
+		zd_stats_print(stderr, &stats, left_zone, right_zone, opts->stats);
 	}
 
-	free(zone_name);
+	return rv;
+}
 
-	return 0;
+/* Compute the difference between left_zone and right_zone and output to stdout */
+int do_zonediff(const char* left_zone, const char* right_zone, const zd_opts* opts, int* diffcount)
+{
+	fflush(stdout);
+
+	return zd_diff_files(left_zone, right_zone, opts, STDOUT_FILENO, diffcount);
 }
- 
@@ -31,7 +31,100 @@
 #ifndef _LDNS_ZONEDIFF_DNS_ZONEDIFF_H
 #define _LDNS_ZONEDIFF_DNS_ZONEDIFF_H
 
-int do_zonediff(const char* left_zone, const char* right_zone, const char* origin, const int include_sigs, const int include_keys, const int include_nsecs, const int include_delegs, const int include_serial, const int output_knotc_commands, int* diffcount);
+#include <stddef.h>
+#include <ldns/ldns.h>
+
+/* Options that control loading and comparing zones */
+typedef struct _zd_opts
+{
+	const char*	origin;
+	int		include_sigs;
+	int		include_keys;
+	int		include_nsecs;
+	int		include_delegs;
+	int		include_serial;
+	int		output_knotc_commands;
+	int		output_format;
+	int		threads;
+	int		hash_alg;
+	int		rrsets;
+	int		ldns_parser;
+	int		sorted_input;
+	size_t		max_memory;
+	int		use_index;
+	int		stats;
+	int		quiet;
+	int		zonemd;
+	int		axfr_input;
+}
+zd_opts;
+
+/* Kinds of differences reported by zd_diff_zones() */
+#define ZD_CHANGE_ADD		0	/* Record only in the right zone (new_rr) */
+#define ZD_CHANGE_DEL		1	/* Record only in the left zone (old_rr) */
+#define ZD_CHANGE_TTL		2	/* Record in both zones with a different TTL */
+#define ZD_CHANGE_SOA		3	/* Changed SOA; new_rr has the serial to publish */
+
+/* Outcome of checking the ZONEMD record of a zone (RFC 8976) */
+#define ZD_ZONEMD_NONE		0	/* Not computed */
+#define ZD_ZONEMD_MISSING	1	/* No SIMPLE/SHA384 ZONEMD record at the apex */
+#define ZD_ZONEMD_VALID		2	/* The ZONEMD record matches the zone data */
+#define ZD_ZONEMD_INVALID	3	/* The ZONEMD record does not match */
+
+/* Size of a SIMPLE/SHA384 zone digest */
+#define ZD_ZONEMD_SIZE		48
+
+/* A loaded zone; zones are independent, so they can be used from any thread */
+typedef struct _zd_zone zd_zone;
+
+/*
+ * Called for each difference between two zones; the records are only
+ * valid during the call. A non-zero return value stops the comparison
+ * and is returned by zd_diff_zones()
+ */
+typedef int (*zd_change_cb)(const int change, const ldns_rr* old_rr, const ldns_rr* new_rr, void* arg);
+
+/*
+ * Return how many differences ldns-zonediff counts for a change: one per
+ * record, so two for a TTL change, but one for a changed SOA
+ */
+int zd_change_diffcount(const int change, const ldns_rr* old_rr, const ldns_rr* new_rr);
+
+/* Load a zone from a file; returns 0 on success */
+int zd_zone_load(const char* zone_file, const zd_opts* opts, zd_zone** zone);
+
+/* Load a zone from zone file data in memory; returns 0 on success */
+int zd_zone_load_buf(const char* data, const size_t len, const zd_opts* opts, zd_zone** zone);
+
+/* Free a zone */
+void zd_zone_free(zd_zone* zone);
+
+/* Return the name of a zone, or NULL if it is not known */
+const char* zd_zone_name(const zd_zone* zone);
+
+/* Return the SOA record of a zone, or NULL if it does not have one */
+const ldns_rr* zd_zone_soa(const zd_zone* zone);
+
+/* Return the number of records in a zone, other than the SOA */
+int zd_zone_count(const zd_zone* zone);
+
+/*
+ * Return the outcome of checking the ZONEMD record of a zone loaded with
+ * the zonemd option, and copy the computed digest if it is not NULL
+ */
+int zd_zone_zonemd(const zd_zone* zone, unsigned char* digest);
+
+/*
+ * Compare two zones loaded with the same fingerprint algorithm, reporting
+ * each difference through cb; the zones are not changed
+ */
+int zd_diff_zones(const zd_zone* left, const zd_zone* right, const zd_opts* opts, zd_change_cb cb, void* arg);
+
+/* Compare two zone files and write the differences to a file descriptor */
+int zd_diff_files(const char* left_zone, const char* right_zone, const zd_opts* opts, const int fd, int* diffcount);
+
+/* Compare two zone files and write the differences to stdout */
+int do_zonediff(const char* left_zone, const char* right_zone, const zd_opts* opts, int* diffcount);
 
 #endif /* !_LDNS_ZONEDIFF_DNS_ZONEDIFF_H */
  
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include "dns_zonegen.h"
+
+/* Number of records in each RRset of the large RRsets shape */
+#define ZD_GEN_RRSET_SIZE	64
+
+/* Serial of the SOA record in the left zone */
+#define ZD_GEN_SERIAL		2018010100
+
+/* Default TTL of generated records */
+#define ZD_GEN_TTL		3600
+
+/* Key tag used in DS and RRSIG records */
+#define ZD_GEN_KEY_TAG		12345
+
+/* State while generating a pair of zones */
+typedef struct _zd_gen
+{
+	const zd_gen_opts*	opts;
+	FILE*			left;
+	FILE*			right;
+	uint64_t		state;
+	size_t			count;
+	size_t			added;
+	int			origin_labels;
+}
+zd_gen;
+
+static const char* zd_gen_shape_names[] =
+{
+	"hosts",
+	"tld",
+	"rrsets",
+	"txt",
+	"signed",
+	NULL
+};
+
+/* Look up a zone shape by name; returns -1 if unknown */
+int zd_gen_shape_by_name(const char* name)
+{
+	int	i	= 0;
+
+	for (i = 0; zd_gen_shape_names[i] != NULL; i++)
+	{
+		if (strcmp(name, zd_gen_shape_names[i]) == 0) return i;
+	}
+
+	return -1;
+}
+
+/* Deterministic pseudo-random numbers (xorshift64*) */
+static uint64_t zd_gen_rand(zd_gen* g)
+{
+	g->state ^= g->state >> 12;
+	g->state ^= g->state << 25;
+	g->state ^= g->state >> 27;
+
+	return g->state * 0x2545f4914f6cdd1dULL;
+}
+
+/* Fill a string with random base32hex characters, as in NSEC3 owner names */
+static void zd_gen_base32(zd_gen* g, char* out, const size_t len)
+{
+	static const char	digits[]	= "0123456789abcdefghijklmnopqrstuv";
+	size_t			i		= 0;
+
+	for (i = 0; i < len; i++)
+	{
+		out[i] = digits[zd_gen_rand(g) % 32];
+	}
+
+	out[len] = '\0';
+}
+
+/* Fill a string with random base64 characters, as in keys and signatures */
+static void zd_gen_base64(zd_gen* g, char* out, const size_t len)
+{
+	static const char	digits[]	= "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t			i		= 0;
+
+	for (i = 0; i < len; i++)
+	{
+		out[i] = digits[zd_gen_rand(g) % 64];
+	}
+
+	out[len] = '\0';
+}
+
+/* Count the labels of a name relative to the origin, plus those of the origin */
+static int zd_gen_labels(const zd_gen* g, const char* owner)
+{
+	int	labels	= g->origin_labels;
+
+	if (strcmp(owner, "@") == 0) return labels;
+
+	for (labels++; *owner != '\0'; owner++)
+	{
+		if (*owner == '.') labels++;
+	}
+
+	return labels;
+}
+
+/*
+ * Write a record to the left zone and, unless it is removed, to the right
+ * zone, possibly with a different TTL; sometimes a record of the same type
+ * is added to the right zone under a new owner name
+ */
+static void zd_gen_rr(zd_gen* g, const char* owner, const uint32_t ttl, const char* type, const char* rdata)
+{
+	const zd_gen_opts*	opts	= g->opts;
+	int			r	= (int) (zd_gen_rand(g) % 10000);
+
+	fprintf(g->left, "%s\t%u\tIN\t%s\t%s\n", owner, ttl, type, rdata);
+
+	if (r >= opts->del_ratio + opts->ttl_ratio)
+	{
+		fprintf(g->right, "%s\t%u\tIN\t%s\t%s\n", owner, ttl, type, rdata);
+	}
+	else if (r >= opts->del_ratio)
+	{
+		fprintf(g->right, "%s\t%u\tIN\t%s\t%s\n", owner, ttl * 2, type, rdata);
+	}
+
+	g->count++;
+
+	if ((int) (zd_gen_rand(g) % 10000) < opts->add_ratio)
+	{
+		if (strcmp(owner, "@") == 0)
+		{
+			fprintf(g->right, "new%zu\t%u\tIN\t%s\t%s\n", g->added++, ttl, type, rdata);
+		}
+		else
+		{
+			fprintf(g->right, "new%zu.%s\t%u\tIN\t%s\t%s\n", g->added++, owner, ttl, type, rdata);
+		}
+	}
+}
+
+/* Write a signature over the RRset of the specified type */
+static void zd_gen_rrsig(zd_gen* g, const char* owner, const char* type)
+{
+	char	sig[89];
+	char	rdata[512];
+
+	zd_gen_base64(g, sig, 88);
+
+	snprintf(rdata, sizeof(rdata), "%s 13 %d %u 20190101000000 20180101000000 %u %s %s",
+		type,
+		zd_gen_labels(g, owner),
+		ZD_GEN_TTL,
+		ZD_GEN_KEY_TAG,
+		g->opts->origin,
+		sig);
+
+	zd_gen_rr(g, owner, ZD_GEN_TTL, "RRSIG", rdata);
+}
+
+/* Write the records at the apex, other than the SOA */
+static void zd_gen_apex(zd_gen* g)
+{
+	char	key[89];
+	char	rdata[128];
+
+	zd_gen_rr(g, "@", ZD_GEN_TTL, "NS", "ns1");
+	zd_gen_rr(g, "@", ZD_GEN_TTL, "NS", "ns2");
+	zd_gen_rr(g, "ns1", ZD_GEN_TTL, "A", "192.0.2.1");
+	zd_gen_rr(g, "ns2", ZD_GEN_TTL, "A", "192.0.2.2");
+
+	if (g->opts->shape != ZD_GEN_SIGNED) return;
+
+	zd_gen_base64(g, key, 88);
+	snprintf(rdata, sizeof(rdata), "257 3 13 %s", key);
+	zd_gen_rr(g, "@", ZD_GEN_TTL, "DNSKEY", rdata);
+
+	zd_gen_base64(g, key, 88);
+	snprintf(rdata, sizeof(rdata), "256 3 13 %s", key);
+	zd_gen_rr(g, "@", ZD_GEN_TTL, "DNSKEY", rdata);
+
+	zd_gen_rr(g, "@", 0, "NSEC3PARAM", "1 0 10 aabbccdd");
+
+	zd_gen_rrsig(g, "@", "SOA");
+	zd_gen_rrsig(g, "@", "NS");
+	zd_gen_rrsig(g, "@", "DNSKEY");
+	zd_gen_rrsig(g, "@", "NSEC3PARAM");
+}
+
+/* Write the records for the i-th owner name in the zone */
+static void zd_gen_unit(zd_gen* g, const size_t i)
+{
+	char	owner[64];
+	char	rdata[512];
+	char	data[256];
+	int	j	= 0;
+	int	n	= 0;
+
+	switch(g->opts->shape)
+	{
+	case ZD_GEN_TLD:
+		snprintf(owner, sizeof(owner), "dom%zu", i);
+
+		snprintf(rdata, sizeof(rdata), "ns1.dom%zu", i);
+		zd_gen_rr(g, owner, 172800, "NS", rdata);
+		snprintf(rdata, sizeof(rdata), "ns%zu.example.net.", i % 100);
+		zd_gen_rr(g, owner, 172800, "NS", rdata);
+
+		if ((i % 4) == 0)
+		{
+			snprintf(rdata, sizeof(rdata), "ns1.dom%zu", i);
+			snprintf(data, sizeof(data), "10.%zu.%zu.%zu", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+			zd_gen_rr(g, rdata, 172800, "A", data);
+		}
+
+		if ((i % 3) == 0)
+		{
+			for (j = 0; j < 64; j++)
+			{
+				data[j] = "0123456789ABCDEF"[zd_gen_rand(g) % 16];
+			}
+
+			data[64] = '\0';
+
+			snprintf(rdata, sizeof(rdata), "%zu 13 2 %s", i & 0xffff, data);
+			zd_gen_rr(g, owner, 86400, "DS", rdata);
+		}
+		break;
+	case ZD_GEN_RRSETS:
+		snprintf(owner, sizeof(owner), "pool%zu", i);
+
+		for (j = 0; j < ZD_GEN_RRSET_SIZE; j++)
+		{
+			snprintf(rdata, sizeof(rdata), "10.%zu.%zu.%d", (i >> 8) & 0xff, i & 0xff, j + 1);
+			zd_gen_rr(g, owner, 300, "A", rdata);
+		}
+		break;
+	case ZD_GEN_TXT:
+		snprintf(owner, sizeof(owner), "txt%zu", i);
+
+		n = 1 + (int) (zd_gen_rand(g) % 4);
+
+		for (j = 0; j < n; j++)
+		{
+			zd_gen_base64(g, data, 40 + zd_gen_rand(g) % 216);
+			snprintf(rdata, sizeof(rdata), "\"%s\"", data);
+			zd_gen_rr(g, owner, ZD_GEN_TTL, "TXT", rdata);
+		}
+		break;
+	case ZD_GEN_SIGNED:
+		snprintf(owner, sizeof(owner), "host%zu", i);
+
+		snprintf(rdata, sizeof(rdata), "10.%zu.%zu.%zu", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+		zd_gen_rr(g, owner, ZD_GEN_TTL, "A", rdata);
+		zd_gen_rrsig(g, owner, "A");
+
+		snprintf(rdata, sizeof(rdata), "2001:db8::%zx", i);
+		zd_gen_rr(g, owner, ZD_GEN_TTL, "AAAA", rdata);
+		zd_gen_rrsig(g, owner, "AAAA");
+
+		/* The hashed owner names do not form a real chain, which does not matter here */
+		zd_gen_base32(g, owner, 32);
+		zd_gen_base32(g, data, 32);
+		snprintf(rdata, sizeof(rdata), "1 0 10 aabbccdd %s A AAAA RRSIG", data);
+		zd_gen_rr(g, owner, 300, "NSEC3", rdata);
+		zd_gen_rrsig(g, owner, "NSEC3");
+		break;
+	default:
+		snprintf(owner, sizeof(owner), "host%zu", i);
+
+		snprintf(rdata, sizeof(rdata), "10.%zu.%zu.%zu", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+		zd_gen_rr(g, owner, ZD_GEN_TTL, "A", rdata);
+		snprintf(rdata, sizeof(rdata), "2001:db8::%zx", i);
+		zd_gen_rr(g, owner, ZD_GEN_TTL, "AAAA", rdata);
+		snprintf(rdata, sizeof(rdata), "10 mail%zu", i % 64);
+		zd_gen_rr(g, owner, ZD_GEN_TTL, "MX", rdata);
+		snprintf(rdata, sizeof(rdata), "\"v=host%zu\"", i);
+		zd_gen_rr(g, owner, ZD_GEN_TTL, "TXT", rdata);
+		break;
+	}
+}
+
+/* Write a left zone and a right zone that differs from it as specified */
+int zd_gen_zones(const zd_gen_opts* opts, FILE* left, FILE* right)
+{
+	assert(opts != NULL);
+	assert(opts->origin != NULL);
+	assert(left != NULL);
+	assert(right != NULL);
+
+	zd_gen		g	= { 0 };
+	const char*	p	= NULL;
+	size_t		i	= 0;
+
+	g.opts = opts;
+	g.left = left;
+	g.right = right;
+	g.state = opts->seed ^ 0x9e3779b97f4a7c15ULL;
+
+	/* The generator must not start out with an all-zero state */
+	if (g.state == 0) g.state = 1;
+
+	for (p = opts->origin; *p != '\0'; p++)
+	{
+		if ((*p == '.') && (p != opts->origin)) g.origin_labels++;
+	}
+
+	fprintf(left, "$ORIGIN %s\n$TTL %u\n", opts->origin, ZD_GEN_TTL);
+	fprintf(right, "$ORIGIN %s\n$TTL %u\n", opts->origin, ZD_GEN_TTL);
+
+	fprintf(left, "@\t%u\tIN\tSOA\tns1 hostmaster %u 3600 900 604800 300\n", ZD_GEN_TTL, (uint32_t) ZD_GEN_SERIAL);
+	fprintf(right, "@\t%u\tIN\tSOA\tns1 hostmaster %u 3600 900 604800 300\n", ZD_GEN_TTL, (uint32_t) ZD_GEN_SERIAL + (uint32_t) opts->serial_bump);
+
+	zd_gen_apex(&g);
+
+	for (i = 0; g.count < opts->records; i++)
+	{
+		zd_gen_unit(&g, i);
+	}
+
+	if (ferror(left) || ferror(right))
+	{
+		return EIO;
+	}
+
+	return 0;
+}
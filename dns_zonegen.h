@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LDNS_ZONEDIFF_DNS_ZONEGEN_H
+#define _LDNS_ZONEDIFF_DNS_ZONEGEN_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Shapes of generated zones */
+#define ZD_GEN_HOSTS		0	/* Hosts with A, AAAA, MX and TXT records */
+#define ZD_GEN_TLD		1	/* Delegations with glue and DS records */
+#define ZD_GEN_RRSETS		2	/* Few owners with large RRsets */
+#define ZD_GEN_TXT		3	/* Owners with long TXT records */
+#define ZD_GEN_SIGNED		4	/* Hosts signed with RRSIG and NSEC3 records */
+#define ZD_GEN_SHAPES		5	/* Number of shapes */
+
+/*
+ * Parameters for a pair of generated zones; the change ratios are in
+ * hundredths of a percent of the records in the left zone
+ */
+typedef struct _zd_gen_opts
+{
+	const char*	origin;
+	int		shape;
+	size_t		records;	/* Approximate number of records in the left zone */
+	uint64_t	seed;
+	int		add_ratio;	/* Records only in the right zone */
+	int		del_ratio;	/* Records only in the left zone */
+	int		ttl_ratio;	/* Records with a different TTL in the right zone */
+	int32_t		serial_bump;	/* Difference of the right SOA serial */
+}
+zd_gen_opts;
+
+/* Look up a zone shape by name; returns -1 if unknown */
+int zd_gen_shape_by_name(const char* name);
+
+/*
+ * Write a left zone and a right zone that differs from it as specified;
+ * the same options always produce the same zones. Returns 0 on success
+ */
+int zd_gen_zones(const zd_gen_opts* opts, FILE* left, FILE* right);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONEGEN_H */
+ 
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <openssl/evp.h>
+#include "dns_zonehash.h"
+
+/* Multiplication and mixing constants, borrowed from xxHash */
+#define ZD_PRIME64_1	0x9E3779B185EBCA87ULL
+#define ZD_PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define ZD_PRIME64_3	0x165667B19E3779F9ULL
+#define ZD_SECRET_0	0xBE4BA423396CFEB8ULL
+#define ZD_SECRET_1	0x1CAD21F72C81017CULL
+#define ZD_SECRET_2	0xDB979083E96DD4DEULL
+#define ZD_SECRET_3	0x1F67B3B7A4A44072ULL
+
+static inline uint64_t zd_read64(const uint8_t* p)
+{
+	return	((uint64_t) p[0])	| ((uint64_t) p[1] << 8)  |
+		((uint64_t) p[2] << 16)	| ((uint64_t) p[3] << 24) |
+		((uint64_t) p[4] << 32)	| ((uint64_t) p[5] << 40) |
+		((uint64_t) p[6] << 48)	| ((uint64_t) p[7] << 56);
+}
+
+static inline void zd_write64(uint8_t* p, const uint64_t v)
+{
+	int	i	= 0;
+
+	for (i = 0; i < 8; i++)
+	{
+		p[i] = (uint8_t) (v >> (8 * i));
+	}
+}
+
+static inline uint64_t zd_rotl64(const uint64_t v, const int r)
+{
+	return (v << r) | (v >> (64 - r));
+}
+
+/* Multiply two 64-bit values to 128 bits and fold the halves together */
+static inline uint64_t zd_mul128_fold64(const uint64_t a, const uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+	const unsigned __int128	p	= (unsigned __int128) a * b;
+
+	return (uint64_t) p ^ (uint64_t) (p >> 64);
+#else
+	const uint64_t	lo_lo	= (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+	const uint64_t	hi_lo	= (a >> 32) * (b & 0xFFFFFFFF);
+	const uint64_t	lo_hi	= (a & 0xFFFFFFFF) * (b >> 32);
+	const uint64_t	hi_hi	= (a >> 32) * (b >> 32);
+	const uint64_t	cross	= (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	const uint64_t	upper	= (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	const uint64_t	lower	= (cross << 32) | (lo_lo & 0xFFFFFFFF);
+
+	return lower ^ upper;
+#endif
+}
+
+/* Final mix so that every input bit affects every output bit */
+static inline uint64_t zd_avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= ZD_PRIME64_2;
+	h ^= h >> 29;
+	h *= ZD_PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+/*
+ * Fast 128-bit fingerprint in the style of XXH3: the input is consumed in
+ * 16-byte stripes that are mixed into two chained 64-bit lanes through a
+ * 64x64->128 bit multiplication. It is not collision resistant, so equal
+ * fingerprints must always be confirmed by comparing the data itself.
+ */
+static void zd_fp128(const uint8_t* data, const size_t len, unsigned char* digest)
+{
+	uint64_t	acc_lo	= ((uint64_t) len) * ZD_PRIME64_1;
+	uint64_t	acc_hi	= ((uint64_t) len) * ZD_PRIME64_2 ^ ZD_SECRET_3;
+	size_t		ofs	= 0;
+
+	while (ofs < len)
+	{
+		uint8_t		stripe[16]	= { 0 };
+		const uint8_t*	p		= &data[ofs];
+		uint64_t	lo		= 0;
+		uint64_t	hi		= 0;
+
+		/* Pad the final stripe; the length is already in the lanes */
+		if (len - ofs < 16)
+		{
+			memcpy(stripe, p, len - ofs);
+			p = stripe;
+		}
+
+		lo = zd_read64(p);
+		hi = zd_read64(p + 8);
+
+		acc_lo ^= zd_mul128_fold64(lo ^ (ZD_SECRET_0 + acc_hi), hi ^ ZD_SECRET_1);
+		acc_hi ^= zd_mul128_fold64(hi ^ ZD_SECRET_2, lo ^ (ZD_SECRET_3 - acc_lo));
+		acc_lo = zd_rotl64(acc_lo, 23) * ZD_PRIME64_1;
+		acc_hi = zd_rotl64(acc_hi, 41) * ZD_PRIME64_2;
+
+		ofs += 16;
+	}
+
+	zd_write64(digest, zd_avalanche(acc_lo + acc_hi));
+	zd_write64(digest + 8, zd_avalanche(acc_hi ^ zd_rotl64(acc_lo, 17)));
+}
+
+/* Look up a fingerprint algorithm by name; returns -1 if unknown */
+int zd_hash_by_name(const char* name)
+{
+	if (strcasecmp(name, "fp128") == 0)
+	{
+		return ZD_HASH_FP128;
+	}
+	else if (strcasecmp(name, "sha256") == 0)
+	{
+		return ZD_HASH_SHA256;
+	}
+
+	return -1;
+}
+
+/* Return the size of the fingerprints produced by an algorithm */
+size_t zd_hash_size(const int alg)
+{
+	return (alg == ZD_HASH_SHA256) ? 32 : 16;
+}
+
+/* Return non-zero if equal fingerprints must be confirmed by comparing data */
+int zd_hash_needs_verify(const int alg)
+{
+	return (alg != ZD_HASH_SHA256);
+}
+
+/* Compute the fingerprint of a block of data; returns 0 on success */
+int zd_hash(const int alg, const uint8_t* data, const size_t len, unsigned char* digest)
+{
+	unsigned int	digest_size	= ZD_HASH_MAX_SIZE;
+
+	if (alg == ZD_HASH_SHA256)
+	{
+		return (EVP_Digest(data, len, digest, &digest_size, EVP_sha256(), NULL) == 1) ? 0 : 1;
+	}
+
+	zd_fp128(data, len, digest);
+
+	return 0;
+}
+
+/* Prepare to fingerprint records with an algorithm */
+int zd_hasher_init(zd_hasher* hasher, const int alg)
+{
+	hasher->alg = alg;
+	hasher->ctx = NULL;
+
+	if (alg != ZD_HASH_SHA256) return 0;
+
+	if (((hasher->ctx = EVP_MD_CTX_create()) == NULL) || (EVP_DigestInit_ex(hasher->ctx, EVP_sha256(), NULL) != 1))
+	{
+		zd_hasher_free(hasher);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Compute the fingerprint of a block of data, reusing the hash context */
+int zd_hasher_hash(zd_hasher* hasher, const uint8_t* data, const size_t len, unsigned char* digest)
+{
+	unsigned int	digest_size	= ZD_HASH_MAX_SIZE;
+
+	if (hasher->ctx == NULL)
+	{
+		return zd_hash(hasher->alg, data, len, digest);
+	}
+
+	/* Without a type, the context is set up again for the same digest */
+	return ((EVP_DigestInit_ex(hasher->ctx, NULL, NULL) == 1) &&
+	        (EVP_DigestUpdate(hasher->ctx, data, len) == 1) &&
+	        (EVP_DigestFinal_ex(hasher->ctx, digest, &digest_size) == 1)) ? 0 : 1;
+}
+
+/* Release the state of a hasher */
+void zd_hasher_free(zd_hasher* hasher)
+{
+	if (hasher->ctx != NULL)
+	{
+		EVP_MD_CTX_destroy(hasher->ctx);
+		hasher->ctx = NULL;
+	}
+}
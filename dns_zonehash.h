@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LDNS_ZONEDIFF_DNS_ZONEHASH_H
+#define _LDNS_ZONEDIFF_DNS_ZONEHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+
+/* Available RR fingerprint algorithms */
+#define ZD_HASH_FP128		0	/* Fast 128-bit non-cryptographic hash */
+#define ZD_HASH_SHA256		1	/* SHA-256 through OpenSSL */
+
+/* Size of the largest fingerprint */
+#define ZD_HASH_MAX_SIZE	32
+
+/*
+ * State for fingerprinting many records in a row, so a cryptographic hash
+ * does not set up a new context for every record
+ */
+typedef struct _zd_hasher
+{
+	int		alg;
+	EVP_MD_CTX*	ctx;
+}
+zd_hasher;
+
+/* Look up a fingerprint algorithm by name; returns -1 if unknown */
+int zd_hash_by_name(const char* name);
+
+/* Return the size of the fingerprints produced by an algorithm */
+size_t zd_hash_size(const int alg);
+
+/* Return non-zero if equal fingerprints must be confirmed by comparing data */
+int zd_hash_needs_verify(const int alg);
+
+/* Compute the fingerprint of a block of data; returns 0 on success */
+int zd_hash(const int alg, const uint8_t* data, const size_t len, unsigned char* digest);
+
+/* Prepare to fingerprint records with an algorithm; returns 0 on success */
+int zd_hasher_init(zd_hasher* hasher, const int alg);
+
+/* Compute the fingerprint of a block of data; returns 0 on success */
+int zd_hasher_hash(zd_hasher* hasher, const uint8_t* data, const size_t len, unsigned char* digest);
+
+/* Release the state of a hasher */
+void zd_hasher_free(zd_hasher* hasher);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONEHASH_H */
+ 
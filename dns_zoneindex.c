@@ -0,0 +1,482 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <ldns/ldns.h>
+#include "dns_zoneindex.h"
+#include "dns_zonehash.h"
+#include "dns_zonetok.h"
+
+/* Index format; bump the version when the layout changes */
+#define ZD_INDEX_MAGIC		"ZDINDEX"
+#define ZD_INDEX_VERSION	2
+#define ZD_INDEX_BYTE_ORDER	0x01020304
+
+/* Filter options that change the contents of an index */
+#define ZD_INDEX_SIGS		0x01
+#define ZD_INDEX_KEYS		0x02
+#define ZD_INDEX_NSECS		0x04
+#define ZD_INDEX_DELEGS		0x08
+#define ZD_INDEX_RRSETS		0x10
+
+/*
+ * An index file starts with this header, in host byte order, followed by
+ * the explicit origin, the zone name, the SOA in wire format, the sorted
+ * hashes, the offsets of the records and finally the records themselves
+ */
+typedef struct _zd_index_hdr
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	byte_order;
+	uint32_t	hash_alg;
+	uint32_t	hash_size;
+	uint32_t	filter;
+	uint32_t	origin_len;
+	uint32_t	zone_name_len;
+	uint32_t	soa_len;
+	int32_t		rr_count;
+	int32_t		line_count;
+	zd_index_src	src;
+	uint64_t	count;
+	uint64_t	hashes_ofs;
+	uint64_t	offsets_ofs;
+	uint64_t	recs_ofs;
+	uint64_t	file_size;
+	zd_zone_sum	sum;
+}
+zd_index_hdr;
+
+/* Round an offset up to a multiple of 8 */
+static inline uint64_t zd_align8(const uint64_t ofs)
+{
+	return (ofs + 7) & ~((uint64_t) 7);
+}
+
+/* Return the filter options that went into an index */
+static uint32_t zd_index_filter(const zd_opts* opts)
+{
+	return	(opts->include_sigs ? ZD_INDEX_SIGS : 0) |
+		(opts->include_keys ? ZD_INDEX_KEYS : 0) |
+		(opts->include_nsecs ? ZD_INDEX_NSECS : 0) |
+		(opts->include_delegs ? ZD_INDEX_DELEGS : 0) |
+		(opts->rrsets ? ZD_INDEX_RRSETS : 0);
+}
+
+/* Return the name of the index of a zone file, which must be freed */
+static char* zd_index_path(const char* zone_file)
+{
+	char*	path	= (char*) malloc(strlen(zone_file) + strlen(ZD_INDEX_SUFFIX) + 1);
+
+	if (path != NULL)
+	{
+		strcpy(path, zone_file);
+		strcat(path, ZD_INDEX_SUFFIX);
+	}
+
+	return path;
+}
+
+/* Determine the identity of a zone file; returns 0 on success */
+int zd_index_source(const char* zone_file, zd_index_src* src)
+{
+	assert(zone_file != NULL);
+	assert(src != NULL);
+
+	struct stat	st;
+	zd_map		map	= { 0 };
+	int		rv	= 0;
+
+	memset(src, 0, sizeof(zd_index_src));
+
+	if (stat(zone_file, &st) != 0)
+	{
+		return errno;
+	}
+
+	src->size = (uint64_t) st.st_size;
+	src->mtime_sec = (int64_t) st.st_mtim.tv_sec;
+	src->mtime_nsec = (int64_t) st.st_mtim.tv_nsec;
+
+	/* Size and time alone do not catch files rewritten in place */
+	if ((rv = zd_map_file(zone_file, &map)) != 0)
+	{
+		return rv;
+	}
+
+	rv = zd_hash(ZD_HASH_FP128, (const uint8_t*) map.data, map.size, src->checksum);
+
+	zd_unmap_file(&map);
+
+	return rv;
+}
+
+/*
+ * Check that a record fits in the space that is left in the mapping, and
+ * that its owner name, fixed fields and RDATA add up to its length
+ */
+static int zd_index_rec_ok(const zd_rec* rec, const uint64_t avail)
+{
+	size_t	name_len	= 0;
+
+	if ((rec->len > avail) || (rec->len < 1 + 10))
+	{
+		return 0;
+	}
+
+	/* Uncompressed owner name, followed by type, class, TTL and RDLENGTH */
+	while (rec->wire[name_len] != 0)
+	{
+		if (rec->wire[name_len] > 63) return 0;
+
+		name_len += rec->wire[name_len] + 1;
+
+		if (name_len + 1 + 10 > rec->len) return 0;
+	}
+
+	name_len++;
+
+	return (name_len + 10 + ((rec->wire[name_len + 8] << 8) | rec->wire[name_len + 9]) == rec->len);
+}
+
+/*
+ * Load a zone from the index of a zone file, if there is one that matches
+ * the file and the options; returns 0 on success, or ENOENT if the zone
+ * needs to be parsed
+ */
+int zd_index_load(const char* zone_file, const zd_index_src* src, const zd_opts* opts, dnsz_zone* zone, ldns_rr** soa, char** zone_name, int* rr_count, int* line_count)
+{
+	assert(zone_file != NULL);
+	assert(src != NULL);
+	assert(opts != NULL);
+	assert(zone != NULL);
+	assert(soa != NULL);
+
+	char*			path		= zd_index_path(zone_file);
+	zd_map			map		= { 0 };
+	const zd_index_hdr*	hdr		= NULL;
+	const char*		strings		= NULL;
+	const uint64_t*		offsets		= NULL;
+	const size_t		origin_len	= (opts->origin != NULL) ? strlen(opts->origin) : 0;
+	uint64_t		recs_size	= 0;
+	uint64_t		i		= 0;
+	size_t			pos		= 0;
+
+	*soa = NULL;
+	memset(zone, 0, sizeof(dnsz_zone));
+	zone->hash_size = zd_hash_size(opts->hash_alg);
+
+	if ((path == NULL) || (zd_map_file(path, &map) != 0))
+	{
+		free(path);
+
+		return ENOENT;
+	}
+
+	free(path);
+
+	hdr = (const zd_index_hdr*) map.data;
+
+	/* Anything that does not match exactly means the index is stale */
+	if ((map.size < sizeof(zd_index_hdr)) ||
+	    (memcmp(hdr->magic, ZD_INDEX_MAGIC, sizeof(ZD_INDEX_MAGIC)) != 0) ||
+	    (hdr->version != ZD_INDEX_VERSION) ||
+	    (hdr->byte_order != ZD_INDEX_BYTE_ORDER) ||
+	    (hdr->file_size != map.size) ||
+	    (hdr->hash_alg != (uint32_t) opts->hash_alg) ||
+	    (hdr->hash_size != zone->hash_size) ||
+	    (hdr->filter != zd_index_filter(opts)) ||
+	    (hdr->sum.count != hdr->count) ||
+	    (memcmp(&hdr->src, src, sizeof(zd_index_src)) != 0) ||
+	    (hdr->origin_len != origin_len) ||
+	    (sizeof(zd_index_hdr) + (uint64_t) hdr->origin_len + hdr->zone_name_len + hdr->soa_len > hdr->hashes_ofs) ||
+	    (hdr->hashes_ofs + hdr->count * hdr->hash_size > hdr->offsets_ofs) ||
+	    (hdr->offsets_ofs + hdr->count * sizeof(uint64_t) > hdr->recs_ofs) ||
+	    (hdr->recs_ofs > map.size) ||
+	    (hdr->offsets_ofs % 8 != 0) ||
+	    (hdr->recs_ofs % 8 != 0))
+	{
+		zd_unmap_file(&map);
+
+		return ENOENT;
+	}
+
+	strings = map.data + sizeof(zd_index_hdr);
+
+	if ((origin_len > 0) && (memcmp(strings, opts->origin, origin_len) != 0))
+	{
+		zd_unmap_file(&map);
+
+		return ENOENT;
+	}
+
+	/* Only the record pointers are built; the records stay on disk until used */
+	if ((hdr->count > 0) && ((zone->recs = (zd_rec**) malloc(hdr->count * sizeof(zd_rec*))) == NULL))
+	{
+		zd_unmap_file(&map);
+
+		return ENOMEM;
+	}
+
+	offsets = (const uint64_t*) (map.data + hdr->offsets_ofs);
+	recs_size = map.size - hdr->recs_ofs;
+
+	for (i = 0; i < hdr->count; i++)
+	{
+		if ((offsets[i] % 4 != 0) ||
+		    (offsets[i] + sizeof(zd_rec) > recs_size) ||
+		    !zd_index_rec_ok((const zd_rec*) (map.data + hdr->recs_ofs + offsets[i]), recs_size - offsets[i] - sizeof(zd_rec)))
+		{
+			free(zone->recs);
+			zone->recs = NULL;
+			zd_unmap_file(&map);
+
+			return ENOENT;
+		}
+
+		zone->recs[i] = (zd_rec*) (map.data + hdr->recs_ofs + offsets[i]);
+	}
+
+	if ((hdr->soa_len > 0) && (ldns_wire2rr(soa, (const uint8_t*) strings + hdr->origin_len + hdr->zone_name_len, hdr->soa_len, &pos, LDNS_SECTION_ANSWER) != LDNS_STATUS_OK))
+	{
+		*soa = NULL;
+
+		free(zone->recs);
+		zone->recs = NULL;
+		zd_unmap_file(&map);
+
+		return ENOENT;
+	}
+
+	if (zone_name != NULL)
+	{
+		*zone_name = (hdr->zone_name_len > 0) ? strndup(strings + hdr->origin_len, hdr->zone_name_len) : NULL;
+	}
+
+	if (rr_count != NULL) *rr_count = hdr->rr_count;
+	if (line_count != NULL) *line_count = hdr->line_count;
+
+	/* The hashes are used straight from the mapping */
+	zone->rr_hashes = (unsigned char*) (map.data + hdr->hashes_ofs);
+	zone->count = hdr->count;
+	zone->capacity = hdr->count;
+	zone->map = map;
+	zone->sum = hdr->sum;
+	zone->sorted = 1;
+
+	return 0;
+}
+
+/* Write zero bytes up to an offset */
+static int zd_index_pad(FILE* fd, const uint64_t from, const uint64_t to)
+{
+	static const char	zeroes[8]	= { 0 };
+
+	return ((to > from) && (fwrite(zeroes, to - from, 1, fd) != 1)) ? EIO : 0;
+}
+
+/* Write the index for a sorted zone that was loaded from a zone file */
+int zd_index_write(const char* zone_file, const zd_index_src* src, const zd_opts* opts, const dnsz_zone* zone, const ldns_rr* soa, const char* zone_name, const int rr_count, const int line_count)
+{
+	assert(zone_file != NULL);
+	assert(src != NULL);
+	assert(opts != NULL);
+	assert(zone != NULL);
+
+	zd_index_hdr	hdr		= { { 0 } };
+	char*		path		= zd_index_path(zone_file);
+	char*		tmp_path	= NULL;
+	uint8_t*	soa_wire	= NULL;
+	size_t		soa_len		= 0;
+	FILE*		hashes_fd	= NULL;
+	FILE*		offsets_fd	= NULL;
+	FILE*		recs_fd		= NULL;
+	zd_zone_iter	iter		= { 0 };
+	uint64_t	rec_ofs		= 0;
+	uint64_t	written		= 0;
+	int		tmp_fd		= -1;
+	int		rv		= 0;
+
+	if ((path == NULL) || ((tmp_path = (char*) malloc(strlen(path) + 8)) == NULL))
+	{
+		free(path);
+
+		return ENOMEM;
+	}
+
+	if ((soa != NULL) && (ldns_rr2wire(&soa_wire, soa, LDNS_SECTION_ANSWER, &soa_len) != LDNS_STATUS_OK))
+	{
+		free(path);
+		free(tmp_path);
+
+		return EINVAL;
+	}
+
+	memcpy(hdr.magic, ZD_INDEX_MAGIC, sizeof(ZD_INDEX_MAGIC));
+	hdr.version = ZD_INDEX_VERSION;
+	hdr.byte_order = ZD_INDEX_BYTE_ORDER;
+	hdr.hash_alg = (uint32_t) opts->hash_alg;
+	hdr.hash_size = (uint32_t) zone->hash_size;
+	hdr.filter = zd_index_filter(opts);
+	hdr.origin_len = (opts->origin != NULL) ? strlen(opts->origin) : 0;
+	hdr.zone_name_len = (zone_name != NULL) ? strlen(zone_name) : 0;
+	hdr.soa_len = (uint32_t) soa_len;
+	hdr.rr_count = rr_count;
+	hdr.line_count = line_count;
+	hdr.src = *src;
+	hdr.count = zone->sum.count;
+	hdr.sum = zone->sum;
+	hdr.hashes_ofs = zd_align8(sizeof(zd_index_hdr) + hdr.origin_len + hdr.zone_name_len + hdr.soa_len);
+	hdr.offsets_ofs = zd_align8(hdr.hashes_ofs + hdr.count * hdr.hash_size);
+	hdr.recs_ofs = hdr.offsets_ofs + hdr.count * sizeof(uint64_t);
+
+	/* Write to a temporary file first, so readers never see half an index */
+	snprintf(tmp_path, strlen(path) + 8, "%s.XXXXXX", path);
+
+	if (((tmp_fd = mkstemp(tmp_path)) < 0) || ((hashes_fd = fdopen(tmp_fd, "w+b")) == NULL))
+	{
+		rv = errno;
+
+		if (tmp_fd >= 0) close(tmp_fd);
+
+		fprintf(stderr, "Failed to create index file for %s\n", zone_file);
+
+		free(path);
+		free(tmp_path);
+		free(soa_wire);
+
+		return rv;
+	}
+
+	/* The sections are written in one pass through separate streams */
+	if (((offsets_fd = fopen(tmp_path, "r+b")) == NULL) ||
+	    ((recs_fd = fopen(tmp_path, "r+b")) == NULL) ||
+	    (fseeko(offsets_fd, hdr.offsets_ofs, SEEK_SET) != 0) ||
+	    (fseeko(recs_fd, hdr.recs_ofs, SEEK_SET) != 0))
+	{
+		rv = (errno != 0) ? errno : EIO;
+		goto write_done;
+	}
+
+	/* The header is rewritten with the final size at the end */
+	if ((fwrite(&hdr, sizeof(zd_index_hdr), 1, hashes_fd) != 1) ||
+	    ((hdr.origin_len > 0) && (fwrite(opts->origin, hdr.origin_len, 1, hashes_fd) != 1)) ||
+	    ((hdr.zone_name_len > 0) && (fwrite(zone_name, hdr.zone_name_len, 1, hashes_fd) != 1)) ||
+	    ((hdr.soa_len > 0) && (fwrite(soa_wire, hdr.soa_len, 1, hashes_fd) != 1)) ||
+	    (zd_index_pad(hashes_fd, sizeof(zd_index_hdr) + hdr.origin_len + hdr.zone_name_len + hdr.soa_len, hdr.hashes_ofs) != 0))
+	{
+		rv = EIO;
+		goto write_done;
+	}
+
+	if ((rv = zd_zone_iter_init(&iter, zone, zd_hash_needs_verify(opts->hash_alg))) != 0)
+	{
+		goto write_done;
+	}
+
+	while ((iter.rec != NULL) && (written < hdr.count))
+	{
+		const size_t	size	= sizeof(zd_rec) + iter.rec->len;
+
+		if ((fwrite(iter.hash, hdr.hash_size, 1, hashes_fd) != 1) ||
+		    (fwrite(&rec_ofs, sizeof(uint64_t), 1, offsets_fd) != 1) ||
+		    (fwrite(iter.rec, size, 1, recs_fd) != 1) ||
+		    (zd_index_pad(recs_fd, size, (size + 3) & ~((size_t) 3)) != 0))
+		{
+			rv = EIO;
+			goto write_done;
+		}
+
+		rec_ofs += (size + 3) & ~((size_t) 3);
+		written++;
+
+		if ((rv = zd_zone_iter_next(&iter)) != 0)
+		{
+			goto write_done;
+		}
+	}
+
+	if ((written != hdr.count) || (iter.rec != NULL))
+	{
+		/* The record count does not match the zone */
+		rv = EINVAL;
+		goto write_done;
+	}
+
+	hdr.file_size = hdr.recs_ofs + rec_ofs;
+
+	if ((zd_index_pad(hashes_fd, hdr.hashes_ofs + hdr.count * hdr.hash_size, hdr.offsets_ofs) != 0) ||
+	    (fflush(hashes_fd) != 0) ||
+	    (fflush(offsets_fd) != 0) ||
+	    (fflush(recs_fd) != 0) ||
+	    (fseeko(hashes_fd, 0, SEEK_SET) != 0) ||
+	    (fwrite(&hdr, sizeof(zd_index_hdr), 1, hashes_fd) != 1) ||
+	    (fflush(hashes_fd) != 0))
+	{
+		rv = EIO;
+		goto write_done;
+	}
+
+write_done:
+	zd_zone_iter_free(&iter);
+
+	if (recs_fd != NULL) fclose(recs_fd);
+	if (offsets_fd != NULL) fclose(offsets_fd);
+
+	if ((fclose(hashes_fd) != 0) && (rv == 0))
+	{
+		rv = EIO;
+	}
+
+	if ((rv == 0) && (rename(tmp_path, path) != 0))
+	{
+		rv = errno;
+	}
+
+	if (rv != 0)
+	{
+		fprintf(stderr, "Failed to write index file %s\n", path);
+
+		unlink(tmp_path);
+	}
+
+	free(path);
+	free(tmp_path);
+	free(soa_wire);
+
+	return rv;
+}
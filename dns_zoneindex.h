@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#ifndef _LDNS_ZONEDIFF_DNS_ZONEINDEX_H
+#define _LDNS_ZONEDIFF_DNS_ZONEINDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <ldns/ldns.h>
+#include "dns_zonediff.h"
+#include "dns_zonestore.h"
+
+/* Index files are named after the zone file, with this suffix */
+#define ZD_INDEX_SUFFIX		".zdx"
+
+/* Identity of a zone file, as recorded in its index */
+typedef struct _zd_index_src
+{
+	uint64_t	size;
+	int64_t		mtime_sec;
+	int64_t		mtime_nsec;
+	unsigned char	checksum[16];
+}
+zd_index_src;
+
+/* Determine the identity of a zone file; returns 0 on success */
+int zd_index_source(const char* zone_file, zd_index_src* src);
+
+/*
+ * Load a zone from the index of a zone file, if there is one that matches
+ * the file and the options; returns 0 on success, or ENOENT if the zone
+ * needs to be parsed
+ */
+int zd_index_load(const char* zone_file, const zd_index_src* src, const zd_opts* opts, dnsz_zone* zone, ldns_rr** soa, char** zone_name, int* rr_count, int* line_count);
+
+/* Write the index for a sorted zone that was loaded from a zone file */
+int zd_index_write(const char* zone_file, const zd_index_src* src, const zd_opts* opts, const dnsz_zone* zone, const ldns_rr* soa, const char* zone_name, const int rr_count, const int line_count);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONEINDEX_H */
@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <ldns/ldns.h>
+#include "dns_zonemd.h"
+
+/* The only scheme and hash algorithm there are so far (RFC 8976, section 5) */
+#define ZD_ZONEMD_SIMPLE	1
+#define ZD_ZONEMD_SHA384	1
+
+/* Part of the records to put in canonical order, sorted on its own thread */
+typedef struct _zd_zonemd_slice
+{
+	const zd_rec**	recs;
+	size_t		count;
+	size_t		pos;
+}
+zd_zonemd_slice;
+
+/* Return the type of a record in wire format */
+static uint16_t zd_rec_type(const zd_rec* rec)
+{
+	const size_t	ofs	= zd_wire_rrset_len(rec->wire, rec->len) - 4;
+
+	return (uint16_t) ((rec->wire[ofs] << 8) | rec->wire[ofs + 1]);
+}
+
+/* Return the offset of the RDATA of a record in wire format */
+static size_t zd_rec_rdata_ofs(const zd_rec* rec)
+{
+	/* After the TTL and the RDATA length */
+	return zd_wire_rrset_len(rec->wire, rec->len) + 6;
+}
+
+/* Order records by owner name, type and RDATA (RFC 4034, section 6.3) */
+static int zd_rec_canon_cmp(const zd_rec* a, const zd_rec* b)
+{
+	const size_t	a_ofs	= zd_rec_rdata_ofs(a);
+	const size_t	b_ofs	= zd_rec_rdata_ofs(b);
+	const size_t	a_len	= (a->len > a_ofs) ? a->len - a_ofs : 0;
+	const size_t	b_len	= (b->len > b_ofs) ? b->len - b_ofs : 0;
+	const uint16_t	a_type	= zd_rec_type(a);
+	const uint16_t	b_type	= zd_rec_type(b);
+	int		rv	= zd_dname_canon_cmp(a->wire, b->wire);
+
+	if (rv != 0) return rv;
+
+	if (a_type != b_type) return (a_type < b_type) ? -1 : 1;
+
+	if ((rv = memcmp(&a->wire[a_ofs], &b->wire[b_ofs], (a_len < b_len) ? a_len : b_len)) != 0) return rv;
+
+	return (a_len < b_len) ? -1 : (a_len > b_len) ? 1 : 0;
+}
+
+/* Order pointers to records in canonical order, for qsort() */
+static int zd_rec_ptr_canon_cmp(const void* a, const void* b)
+{
+	return zd_rec_canon_cmp(*(const zd_rec* const*) a, *(const zd_rec* const*) b);
+}
+
+/* Thread entry point for sorting a slice */
+static void* zd_zonemd_sort_run(void* arg)
+{
+	zd_zonemd_slice*	slice	= (zd_zonemd_slice*) arg;
+
+	qsort(slice->recs, slice->count, sizeof(zd_rec*), zd_rec_ptr_canon_cmp);
+
+	return NULL;
+}
+
+/* Take the next record in canonical order from the sorted slices */
+static const zd_rec* zd_zonemd_next(zd_zonemd_slice* slices, const int slice_count)
+{
+	zd_zonemd_slice*	min	= NULL;
+	int			i	= 0;
+
+	for (i = 0; i < slice_count; i++)
+	{
+		if ((slices[i].pos < slices[i].count) &&
+		    ((min == NULL) || (zd_rec_canon_cmp(slices[i].recs[slices[i].pos], min->recs[min->pos]) < 0)))
+		{
+			min = &slices[i];
+		}
+	}
+
+	return (min != NULL) ? min->recs[min->pos++] : NULL;
+}
+
+/* Add a record to the digest, with its real TTL */
+static int zd_zonemd_update(EVP_MD_CTX* ctx, const zd_rec* rec)
+{
+	const size_t	ttl_ofs		= zd_wire_rrset_len(rec->wire, rec->len);
+	uint8_t		ttl[4]		= { 0 };
+
+	ttl[0] = (uint8_t) (rec->ttl >> 24);
+	ttl[1] = (uint8_t) (rec->ttl >> 16);
+	ttl[2] = (uint8_t) (rec->ttl >> 8);
+	ttl[3] = (uint8_t) rec->ttl;
+
+	if (ttl_ofs + 4 > rec->len) return EINVAL;
+
+	return ((EVP_DigestUpdate(ctx, rec->wire, ttl_ofs) == 1) &&
+	        (EVP_DigestUpdate(ctx, ttl, sizeof(ttl)) == 1) &&
+	        (EVP_DigestUpdate(ctx, &rec->wire[ttl_ofs + 4], rec->len - ttl_ofs - 4) == 1)) ? 0 : EINVAL;
+}
+
+/* Check the computed digest against the ZONEMD records at the apex */
+static int zd_zonemd_check(const zd_zonemd* zonemd, const ldns_rr* soa, const zd_rec** apex_recs, const size_t apex_count)
+{
+	const uint32_t	serial		= ldns_rdf2native_int32(ldns_rr_rdf(soa, 2));
+	const uint8_t*	digest		= NULL;
+	uint32_t	zonemd_serial	= 0;
+	int		supported	= 0;
+	size_t		i		= 0;
+
+	for (i = 0; i < apex_count; i++)
+	{
+		const size_t	ofs	= zd_rec_rdata_ofs(apex_recs[i]);
+		const uint8_t*	rdata	= &apex_recs[i]->wire[ofs];
+
+		/* Serial, scheme, hash algorithm and digest */
+		if ((apex_recs[i]->len != ofs + 6 + ZD_ZONEMD_SIZE) || (rdata[4] != ZD_ZONEMD_SIMPLE) || (rdata[5] != ZD_ZONEMD_SHA384))
+		{
+			continue;
+		}
+
+		zonemd_serial = ((uint32_t) rdata[0] << 24) | ((uint32_t) rdata[1] << 16) | ((uint32_t) rdata[2] << 8) | rdata[3];
+		digest = &rdata[6];
+		supported++;
+	}
+
+	if (supported == 0) return ZD_ZONEMD_MISSING;
+
+	/* More than one ZONEMD record with the same scheme and algorithm is an error */
+	if ((supported > 1) || (zonemd_serial != serial) || (memcmp(digest, zonemd->digest, ZD_ZONEMD_SIZE) != 0))
+	{
+		return ZD_ZONEMD_INVALID;
+	}
+
+	return ZD_ZONEMD_VALID;
+}
+
+/*
+ * Compute the SIMPLE/SHA384 digest of a zone and check it; the records
+ * are put in canonical order by sorting slices of them in parallel and
+ * merging those while hashing. The ZONEMD records at the apex and their
+ * signatures are left out, as are duplicate records.
+ */
+int zd_zonemd_compute(const dnsz_zone* zone, const ldns_rr* soa, const int threads, zd_zonemd* zonemd)
+{
+	const size_t		count		= zone->count + 1;
+	const int		slice_count	= ((threads > 1) && ((size_t) threads < count)) ? threads : 1;
+	const zd_rec**		recs		= NULL;
+	const zd_rec**		apex_recs	= NULL;
+	size_t			apex_count	= 0;
+	zd_zonemd_slice*	slices		= NULL;
+	pthread_t*		sorters		= NULL;
+	int*			threaded	= NULL;
+	zd_rec*			soa_rec		= NULL;
+	ldns_rr*		soa_rr		= NULL;
+	uint8_t*		soa_wire	= NULL;
+	size_t			soa_wire_size	= 0;
+	EVP_MD_CTX*		ctx		= NULL;
+	const zd_rec*		prev		= NULL;
+	const zd_rec*		rec		= NULL;
+	unsigned int		digest_size	= ZD_ZONEMD_SIZE;
+	size_t			i		= 0;
+	int			rv		= 0;
+
+	memset(zonemd, 0, sizeof(zd_zonemd));
+
+	/* The records have to be in memory, and still include every type */
+	if ((zone->runs != NULL) || (soa == NULL)) return EINVAL;
+
+	/* The SOA is kept apart from the other records, so it is added here */
+	if ((soa_rr = ldns_rr_clone(soa)) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	ldns_rr2canonical(soa_rr);
+
+	if ((ldns_rr2wire(&soa_wire, soa_rr, LDNS_SECTION_ANSWER, &soa_wire_size) != LDNS_STATUS_OK) ||
+	    ((soa_rec = (zd_rec*) malloc(sizeof(zd_rec) + soa_wire_size)) == NULL))
+	{
+		rv = ENOMEM;
+		goto cleanup;
+	}
+
+	soa_rec->ttl = ldns_rr_ttl(soa);
+	soa_rec->len = (uint32_t) soa_wire_size;
+	memcpy(soa_rec->wire, soa_wire, soa_wire_size);
+
+	recs = (const zd_rec**) malloc(count * sizeof(zd_rec*));
+	apex_recs = (const zd_rec**) malloc(count * sizeof(zd_rec*));
+	slices = (zd_zonemd_slice*) calloc(slice_count, sizeof(zd_zonemd_slice));
+	sorters = (pthread_t*) calloc(slice_count, sizeof(pthread_t));
+	threaded = (int*) calloc(slice_count, sizeof(int));
+
+	if ((recs == NULL) || (apex_recs == NULL) || (slices == NULL) || (sorters == NULL) || (threaded == NULL))
+	{
+		rv = ENOMEM;
+		goto cleanup;
+	}
+
+	memcpy(recs, zone->recs, zone->count * sizeof(zd_rec*));
+	recs[zone->count] = soa_rec;
+
+	for (i = 0; i < (size_t) slice_count; i++)
+	{
+		slices[i].recs = &recs[i * count / slice_count];
+		slices[i].count = (i + 1) * count / slice_count - i * count / slice_count;
+	}
+
+	/* Sort all but the first slice on worker threads */
+	for (i = 1; i < (size_t) slice_count; i++)
+	{
+		threaded[i] = (pthread_create(&sorters[i], NULL, zd_zonemd_sort_run, &slices[i]) == 0);
+	}
+
+	zd_zonemd_sort_run(&slices[0]);
+
+	for (i = 1; i < (size_t) slice_count; i++)
+	{
+		if (threaded[i])
+		{
+			pthread_join(sorters[i], NULL);
+		}
+		else
+		{
+			zd_zonemd_sort_run(&slices[i]);
+		}
+	}
+
+	if (((ctx = EVP_MD_CTX_create()) == NULL) || (EVP_DigestInit_ex(ctx, EVP_sha384(), NULL) != 1))
+	{
+		rv = ENOMEM;
+		goto cleanup;
+	}
+
+	while ((rec = zd_zonemd_next(slices, slice_count)) != NULL)
+	{
+		const uint16_t	type	= zd_rec_type(rec);
+
+		if ((prev != NULL) && (zd_rec_canon_cmp(prev, rec) == 0))
+		{
+			continue;
+		}
+
+		prev = rec;
+
+		if (zd_dname_canon_cmp(rec->wire, soa_rec->wire) == 0)
+		{
+			if (type == ZD_RR_TYPE_ZONEMD)
+			{
+				apex_recs[apex_count++] = rec;
+				continue;
+			}
+
+			/* The type an RRSIG covers is at the start of its RDATA */
+			if ((type == LDNS_RR_TYPE_RRSIG) && (rec->len >= zd_rec_rdata_ofs(rec) + 2) &&
+			    (((rec->wire[zd_rec_rdata_ofs(rec)] << 8) | rec->wire[zd_rec_rdata_ofs(rec) + 1]) == ZD_RR_TYPE_ZONEMD))
+			{
+				continue;
+			}
+		}
+
+		if ((rv = zd_zonemd_update(ctx, rec)) != 0)
+		{
+			goto cleanup;
+		}
+	}
+
+	if (EVP_DigestFinal_ex(ctx, zonemd->digest, &digest_size) != 1)
+	{
+		rv = EINVAL;
+		goto cleanup;
+	}
+
+	zonemd->status = zd_zonemd_check(zonemd, soa, apex_recs, apex_count);
+
+cleanup:
+	if (ctx != NULL) EVP_MD_CTX_destroy(ctx);
+	if (soa_rr != NULL) ldns_rr_free(soa_rr);
+
+	free(soa_wire);
+	free(soa_rec);
+	free(recs);
+	free(apex_recs);
+	free(slices);
+	free(sorters);
+	free(threaded);
+
+	return rv;
+}
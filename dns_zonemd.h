@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LDNS_ZONEDIFF_DNS_ZONEMD_H
+#define _LDNS_ZONEDIFF_DNS_ZONEMD_H
+
+#include <ldns/ldns.h>
+#include "dns_zonediff.h"
+#include "dns_zonestore.h"
+
+/* ZONEMD is newer than some ldns versions */
+#define ZD_RR_TYPE_ZONEMD	63
+
+/* The digest of a zone and how it compares to its ZONEMD record */
+typedef struct _zd_zonemd
+{
+	int		status;
+	unsigned char	digest[ZD_ZONEMD_SIZE];
+}
+zd_zonemd;
+
+/*
+ * Compute the SIMPLE/SHA384 digest (RFC 8976) of zone data that is all
+ * in memory and unfiltered, sorting it in canonical order on the specified
+ * number of threads, and check it against the ZONEMD record at the apex
+ */
+int zd_zonemd_compute(const dnsz_zone* zone, const ldns_rr* soa, const int threads, zd_zonemd* zonemd);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONEMD_H */
@@ -0,0 +1,457 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <ldns/ldns.h>
+#include "dns_zoneout.h"
+
+/* Initial size of the buffer used to format RDATA fields */
+#define ZD_OUT_SCRATCH_SIZE	4096
+
+/* Look up an output format by name */
+int zd_out_format_by_name(const char* name)
+{
+	if (strcmp(name, "text") == 0) return ZD_OUT_TEXT;
+	if (strcmp(name, "ixfr") == 0) return ZD_OUT_IXFR;
+	if (strcmp(name, "nsupdate") == 0) return ZD_OUT_NSUPDATE;
+	if (strcmp(name, "json") == 0) return ZD_OUT_JSON;
+	if (strcmp(name, "binary") == 0) return ZD_OUT_BINARY;
+
+	return -1;
+}
+
+/* Set up a writer for a file descriptor; returns 0 on success */
+int zd_out_init(zd_out* out, const int fd)
+{
+	assert(out != NULL);
+
+	memset(out, 0, sizeof(zd_out));
+
+	out->fd = fd;
+	out->size = ZD_OUT_BUFFER_SIZE;
+
+	if ((out->buf = (char*) malloc(out->size)) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	if ((out->scratch = ldns_buffer_new(ZD_OUT_SCRATCH_SIZE)) == NULL)
+	{
+		free(out->buf);
+		out->buf = NULL;
+
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+/* Write out everything collected so far; returns 0 on success */
+int zd_out_flush(zd_out* out)
+{
+	size_t	ofs	= 0;
+
+	while ((ofs < out->len) && !out->error)
+	{
+		ssize_t	written	= write(out->fd, &out->buf[ofs], out->len - ofs);
+
+		if (written < 0)
+		{
+			if (errno == EINTR) continue;
+
+			/* Drop further output, but remember that it failed */
+			out->error = errno;
+			break;
+		}
+
+		ofs += (size_t) written;
+	}
+
+	out->len = 0;
+
+	return out->error;
+}
+
+/* Make room for at least len more bytes */
+static int zd_out_reserve(zd_out* out, const size_t len)
+{
+	if (out->len + len <= out->size) return 0;
+
+	zd_out_flush(out);
+
+	/* Only a single line that is larger than the buffer makes it grow */
+	if (len > out->size)
+	{
+		char*	new_buf	= (char*) realloc(out->buf, len);
+
+		if (new_buf == NULL)
+		{
+			out->error = ENOMEM;
+
+			return ENOMEM;
+		}
+
+		out->buf = new_buf;
+		out->size = len;
+	}
+
+	return 0;
+}
+
+/* Append bytes to the output */
+void zd_out_bytes(zd_out* out, const char* data, const size_t len)
+{
+	if (zd_out_reserve(out, len) != 0) return;
+
+	memcpy(&out->buf[out->len], data, len);
+	out->len += len;
+}
+
+/* Append formatted text to the output */
+void zd_out_printf(zd_out* out, const char* fmt, ...)
+{
+	va_list	args;
+	int	len	= 0;
+
+	va_start(args, fmt);
+	len = vsnprintf(&out->buf[out->len], out->size - out->len, fmt, args);
+	va_end(args);
+
+	if (len < 0) return;
+
+	if ((size_t) len >= out->size - out->len)
+	{
+		/* It did not fit, so make room and format it again */
+		if (zd_out_reserve(out, (size_t) len + 1) != 0) return;
+
+		va_start(args, fmt);
+		vsnprintf(&out->buf[out->len], out->size - out->len, fmt, args);
+		va_end(args);
+	}
+
+	out->len += (size_t) len;
+}
+
+/*
+ * Append the contents of the scratch buffer, escaped for knotc or JSON if
+ * needed; presentation format escapes all other special characters
+ */
+static void zd_out_scratch(zd_out* out, const int escape)
+{
+	const char*	data	= (const char*) ldns_buffer_begin(out->scratch);
+	const size_t	len	= ldns_buffer_position(out->scratch);
+	size_t		i	= 0;
+
+	if (!escape)
+	{
+		zd_out_bytes(out, data, len);
+
+		return;
+	}
+
+	/* Escaping at most doubles the length */
+	if (zd_out_reserve(out, 2 * len) != 0) return;
+
+	for (i = 0; i < len; i++)
+	{
+		if ((data[i] == '\"') || (data[i] == '\\'))
+		{
+			out->buf[out->len++] = '\\';
+		}
+
+		out->buf[out->len++] = data[i];
+	}
+}
+
+/* Append the owner name, TTL, optionally the class, type and RDATA of a record */
+static void zd_out_rr_fields(zd_out* out, const ldns_rr* rr, const int with_class, const int output_knotc_commands)
+{
+	size_t	i	= 0;
+
+	/* Owner name, TTL and type */
+	ldns_buffer_clear(out->scratch);
+	ldns_rdf2buffer_str(out->scratch, ldns_rr_owner(rr));
+	zd_out_scratch(out, 0);
+
+	zd_out_printf(out, " %u ", ldns_rr_ttl(rr));
+
+	if (with_class)
+	{
+		ldns_buffer_clear(out->scratch);
+		ldns_rr_class2buffer_str(out->scratch, ldns_rr_get_class(rr));
+		zd_out_scratch(out, 0);
+		zd_out_bytes(out, " ", 1);
+	}
+
+	ldns_buffer_clear(out->scratch);
+	ldns_rr_type2buffer_str(out->scratch, ldns_rr_get_type(rr));
+	zd_out_scratch(out, 0);
+
+	zd_out_bytes(out, output_knotc_commands ? " \"" : " ", output_knotc_commands ? 2 : 1);
+
+	/* RDATA fields, separated by single spaces */
+	for (i = 0; i < ldns_rr_rd_count(rr); i++)
+	{
+		ldns_buffer_clear(out->scratch);
+		ldns_rdf2buffer_str(out->scratch, ldns_rr_rdf(rr, i));
+		zd_out_scratch(out, output_knotc_commands);
+		zd_out_bytes(out, " ", 1);
+	}
+
+	/* The last separator is not part of the output */
+	if (out->len > 0) out->len--;
+}
+
+/*
+ * Append a changed RR, either as "--"/"++" followed by the record or as
+ * a knotc zone-unset/zone-set command
+ */
+void zd_out_rr(zd_out* out, const char* zone_name, const ldns_rr* rr, const int remove, const int output_knotc_commands)
+{
+	assert(out != NULL);
+	assert(rr != NULL);
+
+	if (output_knotc_commands)
+	{
+		zd_out_printf(out, "%s %s ", remove ? "zone-unset" : "zone-set", zone_name);
+	}
+	else
+	{
+		zd_out_bytes(out, remove ? "-- " : "++ ", 3);
+	}
+
+	zd_out_rr_fields(out, rr, 0, output_knotc_commands);
+
+	zd_out_bytes(out, output_knotc_commands ? "\"\n" : "\n", output_knotc_commands ? 2 : 1);
+}
+
+/* Append a record in presentation format, with its class, without a newline */
+void zd_out_rr_str(zd_out* out, const ldns_rr* rr)
+{
+	assert(out != NULL);
+	assert(rr != NULL);
+
+	zd_out_rr_fields(out, rr, 1, 0);
+}
+
+/* Append data as lowercase hexadecimal digits */
+static void zd_out_hex(zd_out* out, const uint8_t* data, const size_t len)
+{
+	static const char	digits[]	= "0123456789abcdef";
+	size_t			i		= 0;
+
+	if (zd_out_reserve(out, 2 * len) != 0) return;
+
+	for (i = 0; i < len; i++)
+	{
+		out->buf[out->len++] = digits[data[i] >> 4];
+		out->buf[out->len++] = digits[data[i] & 0x0f];
+	}
+}
+
+/* Append the RDATA fields of a record to the scratch buffer, separated by single spaces */
+static void zd_out_rdata_str(ldns_buffer* buf, const ldns_rr* rr)
+{
+	size_t	i	= 0;
+
+	for (i = 0; i < ldns_rr_rd_count(rr); i++)
+	{
+		if (i > 0) ldns_buffer_printf(buf, " ");
+
+		ldns_rdf2buffer_str(buf, ldns_rr_rdf(rr, i));
+	}
+}
+
+/* Append a changed RR as a JSON line */
+static void zd_out_change_json(zd_out* out, const ldns_rr* rr, const int remove)
+{
+	zd_out_printf(out, "{\"op\":\"%s\",\"owner\":\"", remove ? "del" : "add");
+
+	ldns_buffer_clear(out->scratch);
+	ldns_rdf2buffer_str(out->scratch, ldns_rr_owner(rr));
+	zd_out_scratch(out, 1);
+
+	zd_out_printf(out, "\",\"type\":\"");
+
+	ldns_buffer_clear(out->scratch);
+	ldns_rr_type2buffer_str(out->scratch, ldns_rr_get_type(rr));
+	zd_out_scratch(out, 1);
+
+	zd_out_printf(out, "\",\"class\":\"");
+
+	ldns_buffer_clear(out->scratch);
+	ldns_rr_class2buffer_str(out->scratch, ldns_rr_get_class(rr));
+	zd_out_scratch(out, 1);
+
+	zd_out_printf(out, "\",\"ttl\":%u,\"rdata\":\"", ldns_rr_ttl(rr));
+
+	ldns_buffer_clear(out->scratch);
+	zd_out_rdata_str(out->scratch, rr);
+	zd_out_scratch(out, 1);
+
+	zd_out_printf(out, "\",\"rdata_wire\":\"");
+
+	ldns_buffer_clear(out->scratch);
+
+	if (ldns_rr_rdata2buffer_wire(out->scratch, rr) != LDNS_STATUS_OK)
+	{
+		out->error = ENOMEM;
+
+		return;
+	}
+
+	zd_out_hex(out, ldns_buffer_begin(out->scratch), ldns_buffer_position(out->scratch));
+
+	zd_out_bytes(out, "\"}\n", 3);
+}
+
+/* Append a changed RR as a length-prefixed binary record */
+static void zd_out_change_binary(zd_out* out, const ldns_rr* rr, const int remove)
+{
+	ldns_buffer*	buf	= out->scratch;
+	const ldns_rdf*	owner	= ldns_rr_owner(rr);
+	size_t		ofs	= 0;
+
+	/* The record is put together in the scratch buffer, so that its length is known */
+	ldns_buffer_clear(buf);
+
+	if (!ldns_buffer_reserve(buf, 4 + 1 + 2 + 2 + 4 + 1 + ldns_rdf_size(owner) + 2))
+	{
+		out->error = ENOMEM;
+
+		return;
+	}
+
+	ldns_buffer_write_u32(buf, 0);
+	ldns_buffer_write_u8(buf, remove ? 0 : 1);
+	ldns_buffer_write_u16(buf, ldns_rr_get_type(rr));
+	ldns_buffer_write_u16(buf, ldns_rr_get_class(rr));
+	ldns_buffer_write_u32(buf, ldns_rr_ttl(rr));
+	ldns_buffer_write_u8(buf, (uint8_t) ldns_rdf_size(owner));
+	ldns_buffer_write(buf, ldns_rdf_data(owner), ldns_rdf_size(owner));
+
+	/* Wire format RDATA */
+	ofs = ldns_buffer_position(buf);
+	ldns_buffer_write_u16(buf, 0);
+
+	if (ldns_rr_rdata2buffer_wire(buf, rr) != LDNS_STATUS_OK)
+	{
+		out->error = ENOMEM;
+
+		return;
+	}
+
+	ldns_buffer_write_u16_at(buf, ofs, ldns_buffer_position(buf) - ofs - 2);
+
+	/* Presentation format owner name */
+	if (!ldns_buffer_reserve(buf, 2))
+	{
+		out->error = ENOMEM;
+
+		return;
+	}
+
+	ofs = ldns_buffer_position(buf);
+	ldns_buffer_write_u16(buf, 0);
+	ldns_rdf2buffer_str(buf, owner);
+	ldns_buffer_write_u16_at(buf, ofs, ldns_buffer_position(buf) - ofs - 2);
+
+	/* Presentation format RDATA */
+	if (!ldns_buffer_reserve(buf, 4))
+	{
+		out->error = ENOMEM;
+
+		return;
+	}
+
+	ofs = ldns_buffer_position(buf);
+	ldns_buffer_write_u32(buf, 0);
+	zd_out_rdata_str(buf, rr);
+	ldns_buffer_write_u32_at(buf, ofs, ldns_buffer_position(buf) - ofs - 4);
+
+	if (!ldns_buffer_status_ok(buf))
+	{
+		out->error = ENOMEM;
+
+		return;
+	}
+
+	ldns_buffer_write_u32_at(buf, 0, ldns_buffer_position(buf) - 4);
+
+	zd_out_bytes(out, (const char*) ldns_buffer_begin(buf), ldns_buffer_position(buf));
+}
+
+/* Append a changed RR as a JSON line or as a binary record */
+void zd_out_change(zd_out* out, const int format, const ldns_rr* rr, const int remove)
+{
+	assert(out != NULL);
+	assert(rr != NULL);
+
+	if (format == ZD_OUT_BINARY)
+	{
+		zd_out_change_binary(out, rr, remove);
+	}
+	else
+	{
+		zd_out_change_json(out, rr, remove);
+	}
+}
+
+/* Flush and release a writer; returns 0 if all output was written */
+int zd_out_free(zd_out* out)
+{
+	int	rv	= 0;
+
+	if (out->buf != NULL)
+	{
+		rv = zd_out_flush(out);
+	}
+
+	if (out->scratch != NULL)
+	{
+		ldns_buffer_free(out->scratch);
+	}
+
+	free(out->buf);
+
+	out->buf = NULL;
+	out->scratch = NULL;
+	out->len = 0;
+	out->size = 0;
+
+	return rv;
+}
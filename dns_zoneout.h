@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#ifndef _LDNS_ZONEDIFF_DNS_ZONEOUT_H
+#define _LDNS_ZONEDIFF_DNS_ZONEOUT_H
+
+#include <stddef.h>
+#include <ldns/ldns.h>
+
+/* Output formats for differences */
+#define ZD_OUT_TEXT		0	/* "--"/"++" records, or knotc commands */
+#define ZD_OUT_IXFR		1	/* IXFR response messages (RFC 1995) */
+#define ZD_OUT_NSUPDATE		2	/* nsupdate scripts */
+#define ZD_OUT_JSON		3	/* one JSON object per changed record */
+#define ZD_OUT_BINARY		4	/* one length-prefixed record per change */
+
+/* Output is collected until it reaches this size, then written at once */
+#define ZD_OUT_BUFFER_SIZE	(1024 * 1024)
+
+/* Buffered writer for diff output */
+typedef struct _zd_out
+{
+	int		fd;
+	char*		buf;
+	size_t		len;
+	size_t		size;
+	ldns_buffer*	scratch;
+	int		error;
+}
+zd_out;
+
+/* Look up an output format by name; returns -1 if unknown */
+int zd_out_format_by_name(const char* name);
+
+/* Set up a writer for a file descriptor; returns 0 on success */
+int zd_out_init(zd_out* out, const int fd);
+
+/* Append bytes to the output */
+void zd_out_bytes(zd_out* out, const char* data, const size_t len);
+
+/* Append formatted text to the output */
+void zd_out_printf(zd_out* out, const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+/*
+ * Append a changed RR, either as "--"/"++" followed by the record or as
+ * a knotc zone-unset/zone-set command
+ */
+void zd_out_rr(zd_out* out, const char* zone_name, const ldns_rr* rr, const int remove, const int output_knotc_commands);
+
+/* Append a record in presentation format, with its class, without a newline */
+void zd_out_rr_str(zd_out* out, const ldns_rr* rr);
+
+/*
+ * Append a changed RR as a JSON line (ZD_OUT_JSON):
+ *
+ *   {"op":"del","owner":"www.example.","type":"A","class":"IN",
+ *    "ttl":3600,"rdata":"192.0.2.1","rdata_wire":"c0000201"}
+ *
+ * or as a binary record (ZD_OUT_BINARY), with all integers in network
+ * byte order:
+ *
+ *   uint32	length of the rest of the record
+ *   uint8	operation, 0 for removed and 1 for added
+ *   uint16	type
+ *   uint16	class
+ *   uint32	TTL
+ *   uint8	length of the owner name, followed by it in wire format
+ *   uint16	length of the RDATA, followed by it in wire format
+ *   uint16	length of the owner name, followed by it in presentation format
+ *   uint32	length of the RDATA, followed by it in presentation format
+ */
+void zd_out_change(zd_out* out, const int format, const ldns_rr* rr, const int remove);
+
+/* Write out everything collected so far; returns 0 on success */
+int zd_out_flush(zd_out* out);
+
+/* Flush and release a writer; returns 0 if all output was written */
+int zd_out_free(zd_out* out);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONEOUT_H */
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "dns_zonesort.h"
+
+/* Buckets smaller than this are finished off with an insertion sort */
+#define ZD_RADIX_CUTOFF		32
+
+/* Largest key that can be swapped through the stack */
+#define ZD_RADIX_MAX_KEY	64
+
+/* Swap two keys and their values */
+static inline void zd_radix_swap(unsigned char* keys, const size_t key_size, void** vals, const size_t a, const size_t b)
+{
+	unsigned char	tmp_key[ZD_RADIX_MAX_KEY];
+	void*		tmp_val	= vals[a];
+
+	memcpy(tmp_key, &keys[a * key_size], key_size);
+	memcpy(&keys[a * key_size], &keys[b * key_size], key_size);
+	memcpy(&keys[b * key_size], tmp_key, key_size);
+
+	vals[a] = vals[b];
+	vals[b] = tmp_val;
+}
+
+/* Sort a small range of keys that are known to be equal up to depth */
+static void zd_insertion_sort(unsigned char* keys, const size_t key_size, void** vals, const size_t lo, const size_t hi, const size_t depth, zd_tie_cmp tie_cmp)
+{
+	size_t	i	= 0;
+	size_t	j	= 0;
+
+	for (i = lo + 1; i < hi; i++)
+	{
+		for (j = i; j > lo; j--)
+		{
+			int	cmp	= memcmp(&keys[(j-1) * key_size + depth], &keys[j * key_size + depth], key_size - depth);
+
+			if ((cmp == 0) && (tie_cmp != NULL))
+			{
+				cmp = tie_cmp(vals[j-1], vals[j]);
+			}
+
+			if (cmp <= 0)
+			{
+				break;
+			}
+
+			zd_radix_swap(keys, key_size, vals, j-1, j);
+		}
+	}
+}
+
+/* In-place MSD radix sort (American flag sort) on the byte at depth */
+static void zd_msd_sort(unsigned char* keys, const size_t key_size, void** vals, const size_t lo, const size_t hi, const size_t depth, zd_tie_cmp tie_cmp)
+{
+	size_t	count[256]	= { 0 };
+	size_t	next[256]	= { 0 };
+	size_t	end[256]	= { 0 };
+	size_t	ofs		= lo;
+	size_t	i		= 0;
+	int	b		= 0;
+
+	if (hi - lo < 2) return;
+
+	if ((depth >= key_size) || (hi - lo <= ZD_RADIX_CUTOFF))
+	{
+		/* All keys are identical or the range is small */
+		if ((depth < key_size) || (tie_cmp != NULL))
+		{
+			zd_insertion_sort(keys, key_size, vals, lo, hi, depth, tie_cmp);
+		}
+
+		return;
+	}
+
+	for (i = lo; i < hi; i++)
+	{
+		count[keys[i * key_size + depth]]++;
+	}
+
+	for (b = 0; b < 256; b++)
+	{
+		next[b] = ofs;
+		ofs += count[b];
+		end[b] = ofs;
+	}
+
+	/* Move every key into its bucket by following swap cycles */
+	for (b = 0; b < 256; b++)
+	{
+		while (next[b] < end[b])
+		{
+			const unsigned char	v	= keys[next[b] * key_size + depth];
+
+			if (v == b)
+			{
+				next[b]++;
+			}
+			else
+			{
+				zd_radix_swap(keys, key_size, vals, next[b], next[v]);
+				next[v]++;
+			}
+		}
+	}
+
+	for (b = 0, ofs = lo; b < 256; b++)
+	{
+		zd_msd_sort(keys, key_size, vals, ofs, end[b], depth + 1, tie_cmp);
+		ofs = end[b];
+	}
+}
+
+/*
+ * Sort count keys of key_size bytes each in ascending memcmp() order,
+ * moving the values at the same positions along with them. This sorts in
+ * place; for uniformly distributed keys, such as hash digests, only the
+ * first few bytes are ever looked at. If tie_cmp is not NULL, values with
+ * identical keys are ordered using tie_cmp.
+ */
+void zd_radix_sort(unsigned char* keys, const size_t key_size, void** vals, const size_t count, zd_tie_cmp tie_cmp)
+{
+	assert(key_size > 0);
+	assert(key_size <= ZD_RADIX_MAX_KEY);
+	assert((keys != NULL) || (count == 0));
+	assert((vals != NULL) || (count == 0));
+
+	zd_msd_sort(keys, key_size, vals, 0, count, 0, tie_cmp);
+}
@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "dns_zonesplit.h"
+
+#define ZD_SPLIT_BUF_SIZE	(1024*1024)
+#define ZD_SPLIT_MIN_CHUNK	(256*1024)
+#define ZD_SPLIT_TOK_SIZE	1024
+
+/* What the first character of a logical line says about the line */
+#define ZD_LINE_NONE		0
+#define ZD_LINE_DIRECTIVE	1
+#define ZD_LINE_OWNER		2
+
+/* Lexical state of the scanner; this mirrors the tokenizer in ldns */
+typedef struct _zd_split_state
+{
+	int	line_no;
+	int	depth;
+	int	in_quote;
+	int	in_comment;
+	int	escaped;
+	int	line_start;
+	int	line_kind;
+	int	in_tok;
+	int	tok_count;
+	int	overflow;
+	char	tok[2][ZD_SPLIT_TOK_SIZE];
+	size_t	tok_len[2];
+	int	tok_overflow[2];
+	char*	origin;
+	char*	ttl;
+	char*	owner;
+	char*	owner_origin;
+}
+zd_split_state;
+
+/* Replace a heap-allocated string with a copy of another one */
+static int zd_replace_str(char** dst, const char* src)
+{
+	char*	copy	= NULL;
+
+	if ((src != NULL) && ((copy = strdup(src)) == NULL))
+	{
+		return ENOMEM;
+	}
+
+	free(*dst);
+	*dst = copy;
+
+	return 0;
+}
+
+/* Add a character to one of the first two tokens of the current line */
+static void zd_split_tok_add(zd_split_state* s, const char c)
+{
+	if (!s->in_tok)
+	{
+		s->in_tok = 1;
+
+		if (s->tok_count < 2)
+		{
+			s->tok_len[s->tok_count] = 0;
+			s->tok_overflow[s->tok_count] = 0;
+		}
+
+		s->tok_count++;
+	}
+
+	if (s->tok_count <= 2)
+	{
+		if (s->tok_len[s->tok_count-1] < ZD_SPLIT_TOK_SIZE-1)
+		{
+			s->tok[s->tok_count-1][s->tok_len[s->tok_count-1]++] = c;
+		}
+		else
+		{
+			s->tok_overflow[s->tok_count-1] = 1;
+		}
+	}
+}
+
+/* Apply the effect of a completed logical line on the parser state */
+static int zd_split_finish_line(zd_split_state* s)
+{
+	int	i	= 0;
+	int	rv	= 0;
+
+	for (i = 0; (i < s->tok_count) && (i < 2); i++)
+	{
+		s->tok[i][s->tok_len[i]] = '\0';
+	}
+
+	/* Names that do not fit are beyond what we can track safely */
+	if (((s->line_kind == ZD_LINE_DIRECTIVE) && (s->tok_overflow[0] || ((s->tok_count >= 2) && s->tok_overflow[1]))) ||
+	    ((s->line_kind == ZD_LINE_OWNER) && s->tok_overflow[0]))
+	{
+		s->overflow = 1;
+
+		return 0;
+	}
+
+	if ((s->line_kind == ZD_LINE_DIRECTIVE) && (s->tok_count >= 2))
+	{
+		if (strcmp(s->tok[0], "$ORIGIN") == 0)
+		{
+			rv = zd_replace_str(&s->origin, s->tok[1]);
+		}
+		else if (strcmp(s->tok[0], "$TTL") == 0)
+		{
+			rv = zd_replace_str(&s->ttl, s->tok[1]);
+		}
+	}
+	else if ((s->line_kind == ZD_LINE_OWNER) && (s->tok_count >= 1))
+	{
+		if ((rv = zd_replace_str(&s->owner, s->tok[0])) == 0)
+		{
+			rv = zd_replace_str(&s->owner_origin, s->origin);
+		}
+	}
+
+	s->line_kind = ZD_LINE_NONE;
+	s->tok_count = 0;
+	s->in_tok = 0;
+
+	return rv;
+}
+
+/* Record a range starting at the current position with the current state */
+static int zd_split_emit(zd_split_state* s, zd_chunk* chunk, const off_t pos)
+{
+	chunk->start = pos;
+	chunk->line_no = s->line_no;
+
+	if ((zd_replace_str(&chunk->origin, s->origin) != 0) ||
+	    (zd_replace_str(&chunk->ttl, s->ttl) != 0) ||
+	    (zd_replace_str(&chunk->owner, s->owner) != 0) ||
+	    (zd_replace_str(&chunk->owner_origin, s->owner_origin) != 0))
+	{
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+/* Free the ranges returned by zd_split_zone() */
+void zd_free_chunks(zd_chunk* chunks, const int chunk_count)
+{
+	int	i	= 0;
+
+	if (chunks == NULL) return;
+
+	for (i = 0; i < chunk_count; i++)
+	{
+		free(chunks[i].origin);
+		free(chunks[i].ttl);
+		free(chunks[i].owner);
+		free(chunks[i].owner_origin);
+	}
+
+	free(chunks);
+}
+
+/*
+ * Split a zone file in at most max_chunks ranges that can be parsed
+ * independently. Ranges only start at the beginning of a logical line,
+ * i.e. outside of parentheses, quoted strings and comments, and carry the
+ * $ORIGIN, $TTL and previous owner name that are in effect at that point.
+ * Only a cheap lexical scan is performed, full parsing is left to ldns.
+ */
+int zd_split_zone(const char* zone_file, const int max_chunks, zd_chunk** chunks, int* chunk_count)
+{
+	assert(zone_file != NULL);
+	assert(chunks != NULL);
+	assert(chunk_count != NULL);
+
+	FILE*		zone_fd	= fopen(zone_file, "r");
+	struct stat	st;
+	zd_split_state*	s	= NULL;
+	char*		buf	= NULL;
+	size_t		len	= 0;
+	size_t		i	= 0;
+	off_t		base	= 0;
+	off_t		target	= 0;
+	int		n	= max_chunks;
+	int		found	= 1;
+	int		done	= 0;
+	int		rv	= 0;
+
+	*chunks = NULL;
+	*chunk_count = 0;
+
+	if (zone_fd == NULL)
+	{
+		rv = errno;
+
+		fprintf(stderr, "Failed to open zone file %s\n", zone_file);
+
+		return rv;
+	}
+
+	if (fstat(fileno(zone_fd), &st) != 0)
+	{
+		rv = errno;
+
+		fprintf(stderr, "Failed to determine the size of zone file %s\n", zone_file);
+
+		fclose(zone_fd);
+
+		return rv;
+	}
+
+	/* Do not bother splitting small zones */
+	if (st.st_size / ZD_SPLIT_MIN_CHUNK < n)
+	{
+		n = (int) (st.st_size / ZD_SPLIT_MIN_CHUNK);
+	}
+
+	if (n < 1) n = 1;
+
+	*chunks = (zd_chunk*) calloc(n, sizeof(zd_chunk));
+	s = (zd_split_state*) calloc(1, sizeof(zd_split_state));
+	buf = (char*) malloc(ZD_SPLIT_BUF_SIZE);
+
+	if ((*chunks == NULL) || (s == NULL) || (buf == NULL))
+	{
+		rv = ENOMEM;
+		goto split_done;
+	}
+
+	s->line_start = 1;
+	target = st.st_size / n;
+
+	while (!done && (n > 1) && ((len = fread(buf, 1, ZD_SPLIT_BUF_SIZE, zone_fd)) > 0))
+	{
+		for (i = 0; i < len; i++)
+		{
+			const char	c	= buf[i];
+
+			if (s->line_start)
+			{
+				if ((c == '\n') || (c == '\r') || (c == '\f') || (c == '\v'))
+				{
+					if (c == '\n') s->line_no++;
+
+					continue;
+				}
+
+				/* A new logical line; split here if we are past the target */
+				if (base + (off_t) i >= target)
+				{
+					if ((rv = zd_split_emit(s, &(*chunks)[found], base + (off_t) i)) != 0)
+					{
+						goto split_done;
+					}
+
+					found++;
+
+					if (found == n)
+					{
+						done = 1;
+						break;
+					}
+
+					target = (st.st_size / n) * found;
+				}
+
+				s->line_start = 0;
+
+				if (c == '$')
+				{
+					s->line_kind = ZD_LINE_DIRECTIVE;
+				}
+				else if ((c == ' ') || (c == '\t') || (c == ';') || (c == '('))
+				{
+					s->line_kind = ZD_LINE_NONE;
+				}
+				else
+				{
+					s->line_kind = ZD_LINE_OWNER;
+				}
+			}
+
+			if (s->in_comment)
+			{
+				if (c != '\n') continue;
+
+				s->in_comment = 0;
+			}
+			else if (s->escaped)
+			{
+				s->escaped = 0;
+				zd_split_tok_add(s, c);
+				continue;
+			}
+			else if (c == '\\')
+			{
+				s->escaped = 1;
+				zd_split_tok_add(s, c);
+				continue;
+			}
+			else if (c == '"')
+			{
+				s->in_quote = !s->in_quote;
+				zd_split_tok_add(s, c);
+				continue;
+			}
+			else if (s->in_quote)
+			{
+				if (c == '\n') s->line_no++;
+
+				zd_split_tok_add(s, c);
+				continue;
+			}
+			else if (c == ';')
+			{
+				s->in_comment = 1;
+				s->in_tok = 0;
+				continue;
+			}
+			else if ((c == '(') || (c == ')'))
+			{
+				if (c == '(') s->depth++;
+				else if (s->depth > 0) s->depth--;
+
+				s->in_tok = 0;
+				continue;
+			}
+
+			if (c == '\n')
+			{
+				s->line_no++;
+				s->in_tok = 0;
+
+				if (s->depth == 0)
+				{
+					if ((rv = zd_split_finish_line(s)) != 0)
+					{
+						goto split_done;
+					}
+
+					/* The state after this line is unknown, so stop splitting */
+					if (s->overflow)
+					{
+						done = 1;
+						break;
+					}
+
+					s->line_start = 1;
+				}
+			}
+			else if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\f') || (c == '\v'))
+			{
+				s->in_tok = 0;
+			}
+			else
+			{
+				zd_split_tok_add(s, c);
+			}
+		}
+
+		base += (off_t) len;
+	}
+
+	if (ferror(zone_fd))
+	{
+		rv = EIO;
+
+		fprintf(stderr, "Failed to read zone file %s\n", zone_file);
+
+		goto split_done;
+	}
+
+	/* If scanning stopped early, the last range simply runs to the end */
+	for (i = 0; i + 1 < (size_t) found; i++)
+	{
+		(*chunks)[i].end = (*chunks)[i+1].start;
+	}
+
+	(*chunks)[found-1].end = st.st_size;
+	*chunk_count = found;
+
+split_done:
+	if (s != NULL)
+	{
+		free(s->origin);
+		free(s->ttl);
+		free(s->owner);
+		free(s->owner_origin);
+		free(s);
+	}
+
+	free(buf);
+	fclose(zone_fd);
+
+	if (rv != 0)
+	{
+		zd_free_chunks(*chunks, n);
+		*chunks = NULL;
+	}
+
+	return rv;
+}
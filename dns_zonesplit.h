@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LDNS_ZONEDIFF_DNS_ZONESPLIT_H
+#define _LDNS_ZONEDIFF_DNS_ZONESPLIT_H
+
+#include <sys/types.h>
+
+/*
+ * A byte range of a zone file that starts on a record boundary, together
+ * with the parser state that is in effect at the start of the range. All
+ * strings are the raw presentation format tokens from the zone file.
+ */
+typedef struct _zd_chunk
+{
+	off_t	start;
+	off_t	end;
+	int	line_no;
+	char*	origin;		/* Argument of the last $ORIGIN before start, if any */
+	char*	ttl;		/* Argument of the last $TTL before start, if any */
+	char*	owner;		/* Last explicit owner name before start, if any */
+	char*	owner_origin;	/* Argument of the $ORIGIN in effect for owner, if any */
+}
+zd_chunk;
+
+/* Split a zone file in at most max_chunks ranges that can be parsed independently */
+int zd_split_zone(const char* zone_file, const int max_chunks, zd_chunk** chunks, int* chunk_count);
+
+/* Free the ranges returned by zd_split_zone() */
+void zd_free_chunks(zd_chunk* chunks, const int chunk_count);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONESPLIT_H */
+ 
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <ldns/ldns.h>
+#include "dns_zonestats.h"
+
+static const char* zd_phase_names[ZD_PHASES] =
+{
+	"load",
+	"diff",
+	"total"
+};
+
+/* Look up a statistics format by name; returns -1 if unknown */
+int zd_stats_by_name(const char* name)
+{
+	if (strcmp(name, "text") == 0) return ZD_STATS_TEXT;
+	if (strcmp(name, "json") == 0) return ZD_STATS_JSON;
+
+	return -1;
+}
+
+/* Return the wall clock time in seconds, for measuring intervals */
+double zd_stats_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/* Return the CPU time used by all threads of the process so far */
+static double zd_stats_cpu(void)
+{
+	struct rusage	usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+
+	return (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+	       (double) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/* Start timing a phase; a phase may be timed more than once */
+void zd_stats_begin(zd_clock* phase)
+{
+	phase->wall -= zd_stats_now();
+	phase->cpu -= zd_stats_cpu();
+}
+
+/* Stop timing a phase */
+void zd_stats_end(zd_clock* phase)
+{
+	phase->wall += zd_stats_now();
+	phase->cpu += zd_stats_cpu();
+}
+
+/* Return the peak resident set size in kilobytes */
+static long zd_stats_peak_rss(void)
+{
+	struct rusage	usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+
+	return usage.ru_maxrss;
+}
+
+/* Return the rate of a number of items over a time, or 0 if no time was measured */
+static double zd_stats_rate(const size_t count, const double seconds)
+{
+	return (seconds > 0) ? (double) count / seconds : 0;
+}
+
+/* Write a string as a JSON string */
+static void zd_stats_json_str(FILE* fd, const char* str)
+{
+	fputc('"', fd);
+
+	for (; *str != '\0'; str++)
+	{
+		if ((*str == '"') || (*str == '\\'))
+		{
+			fprintf(fd, "\\%c", *str);
+		}
+		else if ((unsigned char) *str < 0x20)
+		{
+			fprintf(fd, "\\u%04x", (unsigned char) *str);
+		}
+		else
+		{
+			fputc(*str, fd);
+		}
+	}
+
+	fputc('"', fd);
+}
+
+/* Write the statistics of one zone as text */
+static void zd_stats_print_zone_text(FILE* fd, const char* side, const char* zone_file, const zd_zone_stats* zone)
+{
+	int	i	= 0;
+
+	fprintf(fd, "; %s zone %s: %d records from %d lines%s\n", side, zone_file, zone->records, zone->lines, zone->from_index ? " (from index)" : "");
+
+	if (zone->parse_time > 0)
+	{
+		fprintf(fd, ";   parsed and hashed in %.3fs (%.0f records/s), sorted in %.3fs\n",
+			zone->parse_time,
+			zd_stats_rate(zone->records, zone->parse_time),
+			zone->sort_time);
+	}
+
+	for (i = 0; i < ZD_STATS_TYPES; i++)
+	{
+		if (zone->filtered[i] > 0)
+		{
+			char*	type	= ldns_rr_type2str((ldns_rr_type) i);
+
+			fprintf(fd, ";   filtered %zu %s records\n", zone->filtered[i], (type != NULL) ? type : "?");
+
+			free(type);
+		}
+	}
+}
+
+/* Write the statistics of one zone as a JSON object */
+static void zd_stats_print_zone_json(FILE* fd, const char* zone_file, const zd_zone_stats* zone)
+{
+	int	i	= 0;
+	int	first	= 1;
+
+	fprintf(fd, "{\"file\":");
+	zd_stats_json_str(fd, zone_file);
+	fprintf(fd, ",\"records\":%d,\"lines\":%d,\"from_index\":%s,\"parse_seconds\":%.6f,\"parse_rate\":%.0f,\"sort_seconds\":%.6f,\"filtered\":{",
+		zone->records,
+		zone->lines,
+		zone->from_index ? "true" : "false",
+		zone->parse_time,
+		zd_stats_rate(zone->records, zone->parse_time),
+		zone->sort_time);
+
+	for (i = 0; i < ZD_STATS_TYPES; i++)
+	{
+		if (zone->filtered[i] > 0)
+		{
+			char*	type	= ldns_rr_type2str((ldns_rr_type) i);
+
+			fprintf(fd, "%s\"%s\":%zu", first ? "" : ",", (type != NULL) ? type : "?", zone->filtered[i]);
+
+			free(type);
+			first = 0;
+		}
+	}
+
+	fprintf(fd, "}}");
+}
+
+/* Write the statistics in the specified format */
+void zd_stats_print(FILE* fd, const zd_stats* stats, const char* left_zone, const char* right_zone, const int format)
+{
+	int	i	= 0;
+
+	if (format == ZD_STATS_JSON)
+	{
+		fprintf(fd, "{\"left\":");
+		zd_stats_print_zone_json(fd, left_zone, &stats->left);
+		fprintf(fd, ",\"right\":");
+		zd_stats_print_zone_json(fd, right_zone, &stats->right);
+		fprintf(fd, ",\"phases\":{");
+
+		for (i = 0; i < ZD_PHASES; i++)
+		{
+			fprintf(fd, "%s\"%s\":{\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f}", (i > 0) ? "," : "", zd_phase_names[i], stats->phases[i].wall, stats->phases[i].cpu);
+		}
+
+		fprintf(fd, "},\"diff\":{\"added\":%zu,\"removed\":%zu,\"ttl_changed\":%zu,\"soa_changed\":%zu},\"peak_rss_kb\":%ld}\n",
+			stats->added,
+			stats->removed,
+			stats->ttl_changed,
+			stats->soa_changed,
+			zd_stats_peak_rss());
+	}
+	else if (format == ZD_STATS_TEXT)
+	{
+		zd_stats_print_zone_text(fd, "Left", left_zone, &stats->left);
+		zd_stats_print_zone_text(fd, "Right", right_zone, &stats->right);
+
+		for (i = 0; i < ZD_PHASES; i++)
+		{
+			fprintf(fd, "; %-5s %10.3fs wall %10.3fs CPU\n", zd_phase_names[i], stats->phases[i].wall, stats->phases[i].cpu);
+		}
+
+		fprintf(fd, "; Differences: %zu added, %zu removed, %zu TTL changed, %zu SOA changed\n",
+			stats->added,
+			stats->removed,
+			stats->ttl_changed,
+			stats->soa_changed);
+		fprintf(fd, "; Peak RSS: %ld kB\n", zd_stats_peak_rss());
+	}
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LDNS_ZONEDIFF_DNS_ZONESTATS_H
+#define _LDNS_ZONEDIFF_DNS_ZONESTATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <ldns/ldns.h>
+
+/* Formats for runtime statistics */
+#define ZD_STATS_NONE		0
+#define ZD_STATS_TEXT		1
+#define ZD_STATS_JSON		2
+
+/* All record types that can be left out of the comparison are below this */
+#define ZD_STATS_TYPES		(LDNS_RR_TYPE_NSEC3PARAM + 1)
+
+/* Timed phases of a comparison */
+#define ZD_PHASE_LOAD		0	/* Loading both zones, including sorting */
+#define ZD_PHASE_DIFF		1	/* Comparing the zones and writing the differences */
+#define ZD_PHASE_TOTAL		2
+#define ZD_PHASES		3
+
+/* Wall clock and CPU time spent in a phase, in seconds */
+typedef struct _zd_clock
+{
+	double	wall;
+	double	cpu;
+}
+zd_clock;
+
+/* Statistics for loading one zone */
+typedef struct _zd_zone_stats
+{
+	int	records;
+	int	lines;
+	int	from_index;
+	double	parse_time;			/* Parsing and hashing */
+	double	sort_time;
+	size_t	filtered[ZD_STATS_TYPES];	/* Records left out, by type */
+}
+zd_zone_stats;
+
+/* Statistics for a comparison */
+typedef struct _zd_stats
+{
+	zd_zone_stats	left;
+	zd_zone_stats	right;
+	zd_clock	phases[ZD_PHASES];
+	size_t		added;
+	size_t		removed;
+	size_t		ttl_changed;
+	size_t		soa_changed;
+}
+zd_stats;
+
+/* Look up a statistics format by name; returns -1 if unknown */
+int zd_stats_by_name(const char* name);
+
+/* Return the wall clock time in seconds, for measuring intervals */
+double zd_stats_now(void);
+
+/* Start timing a phase; a phase may be timed more than once */
+void zd_stats_begin(zd_clock* phase);
+
+/* Stop timing a phase */
+void zd_stats_end(zd_clock* phase);
+
+/* Write the statistics in the specified format */
+void zd_stats_print(FILE* fd, const zd_stats* stats, const char* left_zone, const char* right_zone, const int format);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONESTATS_H */
+ 
@@ -0,0 +1,1226 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <ldns/ldns.h>
+#include "dns_zonestore.h"
+#include "dns_zonesort.h"
+#include "dns_zonehash.h"
+
+/* Returned by zd_run_read() at the end of a run */
+#define ZD_RUN_END	-1
+
+struct _zd_run
+{
+	zd_run*		next;
+	FILE*		fd;
+	int		level;
+	unsigned char	hash[ZD_HASH_MAX_SIZE];
+	zd_rec*		rec;
+	size_t		rec_size;
+};
+
+/* Order records with identical hashes; the TTL is ignored, as for hashing */
+int zd_rec_cmp(const void* a, const void* b)
+{
+	const zd_rec*	rec_a	= (const zd_rec*) a;
+	const zd_rec*	rec_b	= (const zd_rec*) b;
+	int		rv	= memcmp(rec_a->wire, rec_b->wire, (rec_a->len < rec_b->len) ? rec_a->len : rec_b->len);
+
+	if (rv != 0) return rv;
+
+	return (rec_a->len < rec_b->len) ? -1 : (rec_a->len > rec_b->len) ? 1 : 0;
+}
+
+/* Compare two lowercased names in wire format in DNSSEC canonical order (RFC 4034, section 6.1) */
+int zd_dname_canon_cmp(const uint8_t* a, const uint8_t* b)
+{
+	size_t	a_labels[128];
+	size_t	b_labels[128];
+	int	a_count	= 0;
+	int	b_count	= 0;
+	size_t	i	= 0;
+
+	for (i = 0; a[i] != 0; i += a[i] + 1)
+	{
+		a_labels[a_count++] = i;
+	}
+
+	for (i = 0; b[i] != 0; i += b[i] + 1)
+	{
+		b_labels[b_count++] = i;
+	}
+
+	/* Compare labels from the root down */
+	while ((a_count > 0) && (b_count > 0))
+	{
+		const uint8_t*	a_label	= &a[a_labels[--a_count]];
+		const uint8_t*	b_label	= &b[b_labels[--b_count]];
+		int		rv	= memcmp(&a_label[1], &b_label[1], (a_label[0] < b_label[0]) ? a_label[0] : b_label[0]);
+
+		if (rv != 0) return rv;
+
+		if (a_label[0] != b_label[0]) return (a_label[0] < b_label[0]) ? -1 : 1;
+	}
+
+	return (a_count > 0) ? 1 : (b_count > 0) ? -1 : 0;
+}
+
+/* Turn a stored record back into an ldns RR, for output */
+ldns_rr* zd_rec2rr(const zd_rec* rec)
+{
+	ldns_rr*	rr	= NULL;
+	size_t		pos	= 0;
+
+	if (ldns_wire2rr(&rr, rec->wire, rec->len, &pos, LDNS_SECTION_ANSWER) != LDNS_STATUS_OK)
+	{
+		return NULL;
+	}
+
+	ldns_rr_set_ttl(rr, rec->ttl);
+
+	return rr;
+}
+
+/* Make sure a zone has room for at least the specified number of records */
+static int zd_zone_reserve(dnsz_zone* zone, const size_t capacity)
+{
+	unsigned char*	new_hashes	= NULL;
+	zd_rec**	new_recs	= NULL;
+	size_t		new_capacity	= (zone->capacity > 0) ? zone->capacity : ZD_ZONE_INITIAL_SIZE;
+
+	if (capacity <= zone->capacity) return 0;
+
+	while (new_capacity < capacity)
+	{
+		new_capacity *= 2;
+	}
+
+	if ((new_hashes = (unsigned char*) realloc(zone->rr_hashes, new_capacity * zone->hash_size)) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	zone->rr_hashes = new_hashes;
+
+	if ((new_recs = (zd_rec**) realloc(zone->recs, new_capacity * sizeof(zd_rec*))) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	zone->recs = new_recs;
+	zone->capacity = new_capacity;
+
+	return 0;
+}
+
+/* Add a record to the sum of a zone */
+static void zd_zone_sum_add(zd_zone_sum* sum, const unsigned char* digest, const size_t hash_size, const uint32_t ttl)
+{
+	uint64_t	word	= 0;
+	uint64_t	mix	= 0;
+	size_t		i	= 0;
+
+	for (i = 0; i < hash_size / 8; i++)
+	{
+		memcpy(&word, &digest[i * 8], sizeof(word));
+		sum->hash[i] += word;
+	}
+
+	/* Mix the TTL with the record it belongs to, so moving a TTL from one
+	 * record to another changes the sum too (splitmix64 finalizer) */
+	memcpy(&mix, digest, sizeof(mix));
+	mix += ttl;
+	mix = (mix ^ (mix >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	mix = (mix ^ (mix >> 27)) * 0x94d049bb133111ebULL;
+	mix ^= mix >> 31;
+
+	sum->ttl += mix;
+	sum->count++;
+}
+
+/* Copy a record in wire format and its hash to the end of a zone */
+int zd_zone_add(dnsz_zone* zone, const unsigned char* digest, const uint8_t* wire, const size_t wire_len, const uint32_t ttl)
+{
+	zd_rec*	rec	= NULL;
+
+	if ((zone->count == zone->capacity) && (zd_zone_reserve(zone, zone->count + 1) != 0))
+	{
+		return ENOMEM;
+	}
+
+	if ((rec = (zd_rec*) zd_arena_alloc(&zone->arena, sizeof(zd_rec) + wire_len)) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	rec->ttl = ttl;
+	rec->len = (uint32_t) wire_len;
+	memcpy(rec->wire, wire, wire_len);
+
+	memcpy(&zone->rr_hashes[zone->count * zone->hash_size], digest, zone->hash_size);
+	zone->recs[zone->count] = rec;
+	zone->count++;
+	zone->sorted = 0;
+
+	zd_zone_sum_add(&zone->sum, digest, zone->hash_size, ttl);
+
+	return 0;
+}
+
+/* Move all records from one zone to the end of another */
+int zd_zone_append(dnsz_zone* zone, dnsz_zone* from)
+{
+	assert(zone->hash_size == from->hash_size);
+
+	size_t	i	= 0;
+
+	/* Spilled runs are simply handed over */
+	if (from->runs != NULL)
+	{
+		zd_run*	tail	= from->runs;
+
+		while (tail->next != NULL)
+		{
+			tail = tail->next;
+		}
+
+		tail->next = zone->runs;
+		zone->runs = from->runs;
+		zone->run_count += from->run_count;
+
+		from->runs = NULL;
+		from->run_count = 0;
+	}
+
+	/* Sums do not depend on the order of the records, so they add up */
+	for (i = 0; i < ZD_HASH_MAX_SIZE / 8; i++)
+	{
+		zone->sum.hash[i] += from->sum.hash[i];
+	}
+
+	zone->sum.ttl += from->sum.ttl;
+	zone->sum.count += from->sum.count;
+
+	if (from->count == 0) return 0;
+
+	zone->sorted = 0;
+
+	if (zone->count == 0)
+	{
+		/* Just take over the arrays */
+		free(zone->rr_hashes);
+		free(zone->recs);
+		zd_arena_free(&zone->arena);
+
+		zone->rr_hashes = from->rr_hashes;
+		zone->recs = from->recs;
+		zone->count = from->count;
+		zone->capacity = from->capacity;
+		zone->arena = from->arena;
+	}
+	else
+	{
+		if (zd_zone_reserve(zone, zone->count + from->count) != 0)
+		{
+			return ENOMEM;
+		}
+
+		memcpy(&zone->rr_hashes[zone->count * zone->hash_size], from->rr_hashes, from->count * zone->hash_size);
+		memcpy(&zone->recs[zone->count], from->recs, from->count * sizeof(zd_rec*));
+		zone->count += from->count;
+
+		/* The records themselves stay where they are */
+		zd_arena_move(&zone->arena, &from->arena);
+
+		free(from->rr_hashes);
+		free(from->recs);
+	}
+
+	*from = (dnsz_zone) { .hash_size = zone->hash_size };
+
+	return 0;
+}
+
+/*
+ * Return the amount of memory the records of a zone take up; untouched
+ * parts of arena blocks are not resident, so only what is used counts
+ */
+size_t zd_zone_mem(const dnsz_zone* zone)
+{
+	return zone->arena.used + zone->capacity * (zone->hash_size + sizeof(zd_rec*)) + (size_t) zone->run_count * ZD_RUN_MEM;
+}
+
+/*
+ * Sort the records in memory in hash order; if equal hashes do not
+ * guarantee equal records (verify), the records decide the order
+ */
+void zd_zone_sort(dnsz_zone* zone, const int verify)
+{
+	if (zone->sorted) return;
+
+	zd_radix_sort(zone->rr_hashes, zone->hash_size, (void**) zone->recs, zone->count, verify ? zd_rec_cmp : NULL);
+
+	zone->sorted = 1;
+}
+
+/* Create an anonymous temporary file in $TMPDIR, or /tmp; returns NULL on failure */
+FILE* zd_tmpfile(void)
+{
+	const char*	tmp_dir		= getenv("TMPDIR");
+	char		path[PATH_MAX]	= { 0 };
+	FILE*		fd		= NULL;
+	int		tmp_fd		= -1;
+
+	snprintf(path, PATH_MAX, "%s/ldns-zonediff.XXXXXX", ((tmp_dir != NULL) && (*tmp_dir != '\0')) ? tmp_dir : "/tmp");
+
+	if ((tmp_fd = mkstemp(path)) < 0)
+	{
+		return NULL;
+	}
+
+	/* The file disappears as soon as it is closed */
+	unlink(path);
+
+	if ((fd = fdopen(tmp_fd, "w+b")) == NULL)
+	{
+		close(tmp_fd);
+
+		return NULL;
+	}
+
+	/* Keep the buffer small, as many runs can be open at once */
+	setvbuf(fd, NULL, _IOFBF, ZD_RUN_BUFFER_SIZE);
+
+	return fd;
+}
+
+/* Free a run and close its file */
+static void zd_run_free(zd_run* run)
+{
+	fclose(run->fd);
+	free(run->rec);
+	free(run);
+}
+
+/* Check if the first ZD_RUN_MERGE_FANIN runs of a list are on the same level */
+static int zd_run_level_full(const zd_run* runs)
+{
+	const zd_run*	run	= runs;
+	int		i	= 0;
+
+	for (i = 0; (i < ZD_RUN_MERGE_FANIN) && (run != NULL); i++, run = run->next)
+	{
+		if (run->level != runs->level) return 0;
+	}
+
+	return (i == ZD_RUN_MERGE_FANIN);
+}
+
+/* Merge the first count runs of a zone into a single run that replaces them */
+static int zd_zone_merge_runs(dnsz_zone* zone, const int count, const int verify)
+{
+	dnsz_zone	merged		= { .hash_size = zone->hash_size };
+	zd_zone_iter	iter		= { 0 };
+	zd_run*		run		= NULL;
+	zd_run*		last		= zone->runs;
+	zd_run*		rest		= NULL;
+	int		level		= 0;
+	int		i		= 0;
+	int		rv		= 0;
+
+	for (i = 1; i < count; i++)
+	{
+		last = last->next;
+	}
+
+	/* The iterator reads the runs to merge as if they were a zone of their own */
+	rest = last->next;
+	last->next = NULL;
+
+	merged.runs = zone->runs;
+	merged.run_count = count;
+
+	if ((run = (zd_run*) calloc(1, sizeof(zd_run))) == NULL)
+	{
+		last->next = rest;
+
+		return ENOMEM;
+	}
+
+	if ((run->fd = zd_tmpfile()) == NULL)
+	{
+		rv = errno;
+
+		fprintf(stderr, "Failed to create a temporary file for spilling zone data\n");
+
+		last->next = rest;
+		free(run);
+
+		return rv;
+	}
+
+	if ((rv = zd_zone_iter_init(&iter, &merged, verify)) == 0)
+	{
+		while ((iter.rec != NULL) && (rv == 0))
+		{
+			if ((fwrite(iter.hash, zone->hash_size, 1, run->fd) != 1) ||
+			    (fwrite(iter.rec, sizeof(zd_rec) + iter.rec->len, 1, run->fd) != 1))
+			{
+				rv = (errno != 0) ? errno : EIO;
+
+				fprintf(stderr, "Failed to write spilled zone data to disk\n");
+			}
+			else
+			{
+				rv = zd_zone_iter_next(&iter);
+			}
+		}
+
+		zd_zone_iter_free(&iter);
+	}
+
+	if ((rv == 0) && (fflush(run->fd) != 0))
+	{
+		rv = (errno != 0) ? errno : EIO;
+
+		fprintf(stderr, "Failed to write spilled zone data to disk\n");
+	}
+
+	if (rv != 0)
+	{
+		last->next = rest;
+		zd_run_free(run);
+
+		return rv;
+	}
+
+	/* The merged run replaces the runs it was made from */
+	while (merged.runs != NULL)
+	{
+		zd_run*	next	= merged.runs->next;
+
+		if (merged.runs->level > level) level = merged.runs->level;
+
+		zd_run_free(merged.runs);
+		merged.runs = next;
+	}
+
+	run->level = level + 1;
+	run->next = rest;
+	zone->runs = run;
+	zone->run_count -= count - 1;
+
+	return 0;
+}
+
+/* Sort the records in memory, write them to a new run on disk and free them */
+int zd_zone_spill(dnsz_zone* zone, const int verify)
+{
+	zd_run*	run	= NULL;
+	size_t	i	= 0;
+	int	rv	= 0;
+
+	if (zone->count == 0) return 0;
+
+	if ((run = (zd_run*) calloc(1, sizeof(zd_run))) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	if ((run->fd = zd_tmpfile()) == NULL)
+	{
+		rv = errno;
+
+		fprintf(stderr, "Failed to create a temporary file for spilling zone data\n");
+
+		free(run);
+
+		return rv;
+	}
+
+	zd_zone_sort(zone, verify);
+
+	/* Each entry is the hash followed by the record */
+	for (i = 0; i < zone->count; i++)
+	{
+		if ((fwrite(zd_zone_hash(zone, i), zone->hash_size, 1, run->fd) != 1) ||
+		    (fwrite(zone->recs[i], sizeof(zd_rec) + zone->recs[i]->len, 1, run->fd) != 1))
+		{
+			break;
+		}
+	}
+
+	if ((i < zone->count) || (fflush(run->fd) != 0))
+	{
+		rv = (errno != 0) ? errno : EIO;
+
+		fprintf(stderr, "Failed to write spilled zone data to disk\n");
+
+		fclose(run->fd);
+		free(run);
+
+		return rv;
+	}
+
+	run->next = zone->runs;
+	zone->runs = run;
+	zone->run_count++;
+
+	/* Start over with an empty zone in memory */
+	free(zone->rr_hashes);
+	free(zone->recs);
+	zd_arena_free(&zone->arena);
+
+	zone->rr_hashes = NULL;
+	zone->recs = NULL;
+	zone->count = 0;
+	zone->capacity = 0;
+
+	/*
+	 * The newest runs come first and the list is ordered by level; once
+	 * the first ZD_RUN_MERGE_FANIN runs are on the same level, they are
+	 * merged into one run on the next level
+	 */
+	while (zd_run_level_full(zone->runs))
+	{
+		if ((rv = zd_zone_merge_runs(zone, ZD_RUN_MERGE_FANIN, verify)) != 0)
+		{
+			return rv;
+		}
+	}
+
+	return 0;
+}
+
+/* Merge spilled runs until there are at most max_runs of them */
+int zd_zone_compact(dnsz_zone* zone, const int verify, const int max_runs)
+{
+	int	rv	= 0;
+
+	assert(max_runs >= 2);
+
+	while (zone->run_count > max_runs)
+	{
+		const int	count	= zone->run_count - max_runs + 1;
+
+		if ((rv = zd_zone_merge_runs(zone, (count < ZD_RUN_MAX_FANIN) ? count : ZD_RUN_MAX_FANIN, verify)) != 0)
+		{
+			return rv;
+		}
+	}
+
+	return 0;
+}
+
+/* Free zone data, including spilled runs */
+void zd_free_zone(dnsz_zone* zone)
+{
+	assert(zone != NULL);
+
+	while (zone->runs != NULL)
+	{
+		zd_run*	next	= zone->runs->next;
+
+		zd_run_free(zone->runs);
+
+		zone->runs = next;
+	}
+
+	/* The hashes of an indexed zone are part of the mapping */
+	if (zone->map.data != NULL)
+	{
+		zd_unmap_file(&zone->map);
+	}
+	else
+	{
+		free(zone->rr_hashes);
+	}
+
+	free(zone->recs);
+	zd_arena_free(&zone->arena);
+
+	zone->rr_hashes = NULL;
+	zone->recs = NULL;
+	zone->count = 0;
+	zone->capacity = 0;
+	zone->run_count = 0;
+	zone->sorted = 0;
+
+	memset(&zone->sum, 0, sizeof(zd_zone_sum));
+}
+
+/*
+ * Drop the records in memory for which keep() returns zero; their memory
+ * is only released with the zone. The sum only covers what is kept.
+ */
+int zd_zone_filter(dnsz_zone* zone, zd_keep_fn keep, void* arg)
+{
+	size_t	kept	= 0;
+	size_t	i	= 0;
+
+	if ((zone->runs != NULL) || (zone->map.data != NULL)) return EINVAL;
+
+	memset(&zone->sum, 0, sizeof(zd_zone_sum));
+
+	for (i = 0; i < zone->count; i++)
+	{
+		if (!keep(zone->recs[i], arg)) continue;
+
+		if (kept != i)
+		{
+			memcpy(&zone->rr_hashes[kept * zone->hash_size], zd_zone_hash(zone, i), zone->hash_size);
+			zone->recs[kept] = zone->recs[i];
+		}
+
+		zd_zone_sum_add(&zone->sum, zd_zone_hash(zone, kept), zone->hash_size, zone->recs[kept]->ttl);
+		kept++;
+	}
+
+	zone->count = kept;
+
+	return 0;
+}
+
+/* Check if two zones certainly differ, without looking at their records */
+int zd_zone_sum_differs(const dnsz_zone* left, const dnsz_zone* right)
+{
+	return memcmp(&left->sum, &right->sum, sizeof(zd_zone_sum)) != 0;
+}
+
+/* Read the next entry of a run; returns 0, ZD_RUN_END or an error */
+static int zd_run_read(zd_run* run, const size_t hash_size)
+{
+	zd_rec	hdr	= { 0 };
+
+	if (fread(run->hash, hash_size, 1, run->fd) != 1)
+	{
+		return feof(run->fd) ? ZD_RUN_END : EIO;
+	}
+
+	if (fread(&hdr, sizeof(zd_rec), 1, run->fd) != 1)
+	{
+		return EIO;
+	}
+
+	if (sizeof(zd_rec) + hdr.len > run->rec_size)
+	{
+		zd_rec*	new_rec	= (zd_rec*) realloc(run->rec, sizeof(zd_rec) + hdr.len);
+
+		if (new_rec == NULL) return ENOMEM;
+
+		run->rec = new_rec;
+		run->rec_size = sizeof(zd_rec) + hdr.len;
+	}
+
+	*run->rec = hdr;
+
+	if ((hdr.len > 0) && (fread(run->rec->wire, hdr.len, 1, run->fd) != 1))
+	{
+		return EIO;
+	}
+
+	return 0;
+}
+
+/* Compare the current entries of two cursors */
+static int zd_cursor_cmp(const zd_zone_iter* iter, const zd_cursor* a, const zd_cursor* b)
+{
+	int	rv	= memcmp(a->hash, b->hash, iter->zone->hash_size);
+
+	if ((rv == 0) && iter->verify)
+	{
+		rv = zd_rec_cmp(a->rec, b->rec);
+	}
+
+	return rv;
+}
+
+/* Restore the heap order from the top down */
+static void zd_heap_down(zd_zone_iter* iter, int i)
+{
+	for (;;)
+	{
+		int		smallest	= i;
+		const int	l		= 2 * i + 1;
+		const int	r		= 2 * i + 2;
+		zd_cursor	tmp;
+
+		if ((l < iter->heap_count) && (zd_cursor_cmp(iter, &iter->heap[l], &iter->heap[smallest]) < 0)) smallest = l;
+		if ((r < iter->heap_count) && (zd_cursor_cmp(iter, &iter->heap[r], &iter->heap[smallest]) < 0)) smallest = r;
+
+		if (smallest == i) return;
+
+		tmp = iter->heap[i];
+		iter->heap[i] = iter->heap[smallest];
+		iter->heap[smallest] = tmp;
+
+		i = smallest;
+	}
+}
+
+/* Make the smallest entry the current one */
+static void zd_iter_update(zd_zone_iter* iter)
+{
+	iter->hash = (iter->heap_count > 0) ? iter->heap[0].hash : NULL;
+	iter->rec = (iter->heap_count > 0) ? iter->heap[0].rec : NULL;
+}
+
+/*
+ * Start iterating over a sorted zone; runs are read from the start, so
+ * there can only be one iterator per zone at a time. Returns 0 on success.
+ */
+int zd_zone_iter_init(zd_zone_iter* iter, const dnsz_zone* zone, const int verify)
+{
+	zd_run*	run	= NULL;
+	int	i	= 0;
+	int	rv	= 0;
+
+	memset(iter, 0, sizeof(zd_zone_iter));
+
+	iter->zone = zone;
+	iter->verify = verify;
+
+	if ((iter->heap = (zd_cursor*) calloc(zone->run_count + 1, sizeof(zd_cursor))) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	if (zone->count > 0)
+	{
+		iter->heap[iter->heap_count].hash = zd_zone_hash(zone, 0);
+		iter->heap[iter->heap_count].rec = zone->recs[0];
+		iter->heap_count++;
+	}
+
+	for (run = zone->runs; run != NULL; run = run->next)
+	{
+		if (fseeko(run->fd, 0, SEEK_SET) != 0)
+		{
+			rv = errno;
+		}
+		else if ((rv = zd_run_read(run, zone->hash_size)) == 0)
+		{
+			iter->heap[iter->heap_count].hash = run->hash;
+			iter->heap[iter->heap_count].rec = run->rec;
+			iter->heap[iter->heap_count].run = run;
+			iter->heap_count++;
+		}
+
+		if (rv == ZD_RUN_END)
+		{
+			rv = 0;
+		}
+		else if (rv != 0)
+		{
+			fprintf(stderr, "Failed to read spilled zone data from disk\n");
+
+			zd_zone_iter_free(iter);
+
+			return rv;
+		}
+	}
+
+	for (i = iter->heap_count / 2 - 1; i >= 0; i--)
+	{
+		zd_heap_down(iter, i);
+	}
+
+	zd_iter_update(iter);
+
+	return 0;
+}
+
+/* Advance to the next record; iter->rec is NULL at the end. Returns 0 on success */
+int zd_zone_iter_next(zd_zone_iter* iter)
+{
+	zd_cursor*	top	= NULL;
+	int		rv	= 0;
+
+	if (iter->heap_count == 0) return 0;
+
+	top = &iter->heap[0];
+
+	if (top->run == NULL)
+	{
+		/* The records in memory */
+		if (++iter->pos < iter->zone->count)
+		{
+			top->hash = zd_zone_hash(iter->zone, iter->pos);
+			top->rec = iter->zone->recs[iter->pos];
+		}
+		else
+		{
+			rv = ZD_RUN_END;
+		}
+	}
+	else if ((rv = zd_run_read(top->run, iter->zone->hash_size)) == 0)
+	{
+		/* The buffer may have moved */
+		top->rec = top->run->rec;
+	}
+
+	if (rv == ZD_RUN_END)
+	{
+		iter->heap[0] = iter->heap[--iter->heap_count];
+		rv = 0;
+	}
+	else if (rv != 0)
+	{
+		fprintf(stderr, "Failed to read spilled zone data from disk\n");
+
+		return rv;
+	}
+
+	zd_heap_down(iter, 0);
+	zd_iter_update(iter);
+
+	return 0;
+}
+
+/* Release an iterator */
+void zd_zone_iter_free(zd_zone_iter* iter)
+{
+	free(iter->heap);
+
+	iter->heap = NULL;
+	iter->heap_count = 0;
+	iter->hash = NULL;
+	iter->rec = NULL;
+}
+
+/* Walk two sorted zones side by side and report their differences */
+int zd_zone_merge(const dnsz_zone* left, const dnsz_zone* right, const int verify, zd_merge_cb cb, void* ctx)
+{
+	assert(left != NULL);
+	assert(right != NULL);
+	assert(left->hash_size == right->hash_size);
+
+	zd_zone_iter	left_iter	= { 0 };
+	zd_zone_iter	right_iter	= { 0 };
+	int		rv		= 0;
+
+	if (((rv = zd_zone_iter_init(&left_iter, left, verify)) != 0) ||
+	    ((rv = zd_zone_iter_init(&right_iter, right, verify)) != 0))
+	{
+		goto cleanup;
+	}
+
+	while ((left_iter.rec != NULL) || (right_iter.rec != NULL))
+	{
+		const zd_rec*	rr2del = NULL;
+		const zd_rec*	rr2add = NULL;
+		int		left_next = 0;
+		int		right_next = 0;
+
+		if ((left_iter.rec != NULL) && (right_iter.rec != NULL))
+		{
+			int lr_comp = memcmp(left_iter.hash, right_iter.hash, left->hash_size);
+
+			/* Equal hashes from a non-cryptographic hash must be confirmed */
+			if ((lr_comp == 0) && verify)
+			{
+				lr_comp = zd_rec_cmp(left_iter.rec, right_iter.rec);
+			}
+
+			if (lr_comp == 0)
+			{
+				/* The TTL may still differ, because these were not hashed */
+				if (left_iter.rec->ttl != right_iter.rec->ttl)
+				{
+					rr2del = left_iter.rec;
+					rr2add = right_iter.rec;
+				}
+				/* Left and right hashes are in sync, advance both */
+				left_next = 1;
+				right_next = 1;
+			}
+			else if (lr_comp < 0)
+			{
+				/* Record from left zone is not in right zone */
+				rr2del = left_iter.rec;
+				left_next = 1;
+			}
+			else
+			{
+				/* Record from right zone is not in left zone */
+				rr2add = right_iter.rec;
+				right_next = 1;
+			}
+		}
+		else if (right_iter.rec != NULL)
+		{
+			/* Additional records in right zone that are not present in the left zone */
+			rr2add = right_iter.rec;
+
+			/* Advance right iterator */
+			right_next = 1;
+
+		}
+		else
+		{
+			/* Additional records in the left zone that are not present in the right zone */
+			rr2del = left_iter.rec;
+
+			/* Advance left iterator */
+			left_next = 1;
+		}
+
+		if (((rr2del != NULL) || (rr2add != NULL)) && ((rv = cb(rr2del, rr2add, ctx)) != 0))
+		{
+			goto cleanup;
+		}
+
+		/* Records read back from disk are only valid until the next step */
+		if ((left_next && ((rv = zd_zone_iter_next(&left_iter)) != 0)) ||
+		    (right_next && ((rv = zd_zone_iter_next(&right_iter)) != 0)))
+		{
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	zd_zone_iter_free(&left_iter);
+	zd_zone_iter_free(&right_iter);
+
+	return rv;
+}
+
+/* Return the length of the owner name, type and class a record starts with */
+size_t zd_wire_rrset_len(const uint8_t* wire, const size_t len)
+{
+	size_t	pos	= 0;
+
+	/* Names in canonical wire format are never compressed */
+	while ((pos < len) && (wire[pos] != 0))
+	{
+		pos += wire[pos] + 1;
+	}
+
+	/* The root label, type and class */
+	return (pos + 5 <= len) ? pos + 5 : len;
+}
+
+/* Check if two records belong to the same RRset */
+static int zd_rec_same_rrset(const zd_rec* a, const zd_rec* b)
+{
+	const size_t	len	= zd_wire_rrset_len(a->wire, a->len);
+
+	return (len == zd_wire_rrset_len(b->wire, b->len)) && (memcmp(a->wire, b->wire, len) == 0);
+}
+
+/* Order pointers to records like zd_rec_cmp() orders records, for qsort() */
+int zd_rec_ptr_cmp(const void* a, const void* b)
+{
+	return zd_rec_cmp(*(const zd_rec* const*) a, *(const zd_rec* const*) b);
+}
+
+/* The records of one RRset, while grouping */
+typedef struct _zd_rrset_group
+{
+	size_t	first;
+	size_t	last;
+	size_t	count;
+	size_t	size;
+}
+zd_rrset_group;
+
+/*
+ * Replace the records of a zone by one entry per RRset, see zd_zone_group();
+ * the members are sorted, so the fingerprint does not depend on file order
+ */
+static int zd_zone_add_rrset(dnsz_zone* grouped, const dnsz_zone* zone, const zd_rrset_group* group, const size_t* next, const int hash_alg, const zd_rec** members, uint8_t* blob)
+{
+	unsigned char	digest[ZD_HASH_MAX_SIZE]	= { 0 };
+	size_t		i				= 0;
+	size_t		pos				= 0;
+	size_t		cur				= group->first;
+
+	for (i = 0; i < group->count; i++)
+	{
+		members[i] = zone->recs[cur];
+		cur = next[cur];
+	}
+
+	qsort(members, group->count, sizeof(zd_rec*), zd_rec_ptr_cmp);
+
+	for (i = 0; i < group->count; i++)
+	{
+		memcpy(&blob[pos], members[i], sizeof(zd_rec) + members[i]->len);
+		pos += sizeof(zd_rec) + members[i]->len;
+
+		/* Padding is hashed too, so it must not hold bytes of earlier RRsets */
+		memset(&blob[pos], 0, ZD_SET_ALIGN(members[i]->len) - members[i]->len);
+		pos += ZD_SET_ALIGN(members[i]->len) - members[i]->len;
+	}
+
+	/* The real TTLs are part of the blob, so they count for the fingerprint */
+	if (zd_hash(hash_alg, blob, group->size, digest) != 0)
+	{
+		return EINVAL;
+	}
+
+	return zd_zone_add(grouped, digest, blob, group->size, 0);
+}
+
+/*
+ * Turn a zone in which the hash of each record identifies its RRset (owner,
+ * class and type) into a zone with one entry per RRset, fingerprinted as a
+ * whole. The records of an RRset follow each other in the wire data of its
+ * entry; use zd_set_next() to walk them. Spilled zones cannot be grouped.
+ */
+int zd_zone_group(dnsz_zone* zone, const int hash_alg)
+{
+	dnsz_zone	grouped		= { .hash_size = zone->hash_size };
+	zd_rrset_group*	groups		= NULL;
+	size_t		group_count	= 0;
+	size_t*		table		= NULL;
+	size_t		table_size	= 16;
+	size_t*		next		= NULL;
+	const zd_rec**	members		= NULL;
+	uint8_t*	blob		= NULL;
+	size_t		max_count	= 0;
+	size_t		max_size	= 0;
+	size_t		i		= 0;
+	int		rv		= 0;
+
+	if (zone->runs != NULL) return EINVAL;
+
+	if (zone->count == 0) return 0;
+
+	while (table_size < zone->count * 2)
+	{
+		table_size *= 2;
+	}
+
+	/* The table holds group numbers plus one, so zero marks a free slot */
+	table = (size_t*) calloc(table_size, sizeof(size_t));
+	next = (size_t*) malloc(zone->count * sizeof(size_t));
+	groups = (zd_rrset_group*) malloc(zone->count * sizeof(zd_rrset_group));
+
+	if ((table == NULL) || (next == NULL) || (groups == NULL))
+	{
+		rv = ENOMEM;
+		goto cleanup;
+	}
+
+	/* Chain the records of each RRset together in file order */
+	for (i = 0; i < zone->count; i++)
+	{
+		const zd_rec*	rec	= zone->recs[i];
+		zd_rrset_group*	group	= NULL;
+		uint64_t	key	= 0;
+		size_t		slot	= 0;
+
+		memcpy(&key, zd_zone_hash(zone, i), sizeof(key));
+		slot = (size_t) key & (table_size - 1);
+
+		while ((table[slot] != 0) && !zd_rec_same_rrset(zone->recs[groups[table[slot] - 1].first], rec))
+		{
+			slot = (slot + 1) & (table_size - 1);
+		}
+
+		if (table[slot] == 0)
+		{
+			groups[group_count] = (zd_rrset_group) { i, i, 0, 0 };
+			table[slot] = ++group_count;
+		}
+		else
+		{
+			next[groups[table[slot] - 1].last] = i;
+			groups[table[slot] - 1].last = i;
+		}
+
+		group = &groups[table[slot] - 1];
+		next[i] = SIZE_MAX;
+		group->count++;
+		group->size += sizeof(zd_rec) + ZD_SET_ALIGN(rec->len);
+
+		if (group->count > max_count) max_count = group->count;
+		if (group->size > max_size) max_size = group->size;
+	}
+
+	free(table);
+	table = NULL;
+
+	members = (const zd_rec**) malloc(max_count * sizeof(zd_rec*));
+
+	blob = (uint8_t*) malloc(max_size);
+
+	if ((members == NULL) || (blob == NULL))
+	{
+		rv = ENOMEM;
+		goto cleanup;
+	}
+
+	for (i = 0; i < group_count; i++)
+	{
+		if ((rv = zd_zone_add_rrset(&grouped, zone, &groups[i], next, hash_alg, members, blob)) != 0)
+		{
+			goto cleanup;
+		}
+	}
+
+	zd_free_zone(zone);
+	*zone = grouped;
+	grouped = (dnsz_zone) { .hash_size = zone->hash_size };
+
+cleanup:
+	zd_free_zone(&grouped);
+	free(table);
+	free(next);
+	free(groups);
+	free(members);
+	free(blob);
+
+	return rv;
+}
+
+/* Records of the RRsets that differ between two zones */
+typedef struct _zd_rrset_diff
+{
+	const zd_rec**	recs[2];
+	size_t		count[2];
+	size_t		capacity[2];
+}
+zd_rrset_diff;
+
+/* Add the records of an RRset to one side of a zd_rrset_diff */
+static int zd_rrset_diff_add(zd_rrset_diff* diff, const int side, const zd_rec* set)
+{
+	const zd_rec*	member	= NULL;
+
+	while ((member = zd_set_next(set, member)) != NULL)
+	{
+		if (diff->count[side] == diff->capacity[side])
+		{
+			size_t		new_capacity	= (diff->capacity[side] > 0) ? diff->capacity[side] * 2 : ZD_ZONE_INITIAL_SIZE;
+			const zd_rec**	new_recs	= (const zd_rec**) realloc(diff->recs[side], new_capacity * sizeof(zd_rec*));
+
+			if (new_recs == NULL)
+			{
+				return ENOMEM;
+			}
+
+			diff->recs[side] = new_recs;
+			diff->capacity[side] = new_capacity;
+		}
+
+		diff->recs[side][diff->count[side]++] = member;
+	}
+
+	return 0;
+}
+
+/* Collect the RRsets reported by zd_zone_merge() */
+static int zd_rrset_diff_collect(const zd_rec* rr2del, const zd_rec* rr2add, void* ctx)
+{
+	zd_rrset_diff*	diff	= (zd_rrset_diff*) ctx;
+	int		rv	= 0;
+
+	if ((rr2del != NULL) && ((rv = zd_rrset_diff_add(diff, 0, rr2del)) != 0))
+	{
+		return rv;
+	}
+
+	if (rr2add != NULL)
+	{
+		rv = zd_rrset_diff_add(diff, 1, rr2add);
+	}
+
+	return rv;
+}
+
+/*
+ * Walk two zones grouped by zd_zone_group() side by side; only the records
+ * of RRsets with a different fingerprint are compared one by one, and
+ * reported to cb just like zd_zone_merge() does
+ */
+int zd_zone_merge_rrsets(const dnsz_zone* left, const dnsz_zone* right, const int verify, zd_merge_cb cb, void* ctx)
+{
+	zd_rrset_diff	diff	= { { NULL, NULL }, { 0, 0 }, { 0, 0 } };
+	size_t		i	= 0;
+	size_t		j	= 0;
+	int		rv	= 0;
+
+	/* Grouped zones are never spilled, so the RRsets stay put */
+	if ((rv = zd_zone_merge(left, right, verify, zd_rrset_diff_collect, &diff)) != 0)
+	{
+		goto cleanup;
+	}
+
+	/* Drill down into the changed RRsets only */
+	qsort(diff.recs[0], diff.count[0], sizeof(zd_rec*), zd_rec_ptr_cmp);
+	qsort(diff.recs[1], diff.count[1], sizeof(zd_rec*), zd_rec_ptr_cmp);
+
+	while ((i < diff.count[0]) || (j < diff.count[1]))
+	{
+		const zd_rec*	rr2del	= NULL;
+		const zd_rec*	rr2add	= NULL;
+		int		lr_comp	= (i == diff.count[0]) ? 1 : (j == diff.count[1]) ? -1 : zd_rec_cmp(diff.recs[0][i], diff.recs[1][j]);
+
+		if (lr_comp == 0)
+		{
+			if (diff.recs[0][i]->ttl != diff.recs[1][j]->ttl)
+			{
+				rr2del = diff.recs[0][i];
+				rr2add = diff.recs[1][j];
+			}
+
+			i++;
+			j++;
+		}
+		else if (lr_comp < 0)
+		{
+			rr2del = diff.recs[0][i++];
+		}
+		else
+		{
+			rr2add = diff.recs[1][j++];
+		}
+
+		if (((rr2del != NULL) || (rr2add != NULL)) && ((rv = cb(rr2del, rr2add, ctx)) != 0))
+		{
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	free(diff.recs[0]);
+	free(diff.recs[1]);
+
+	return rv;
+}
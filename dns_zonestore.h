@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#ifndef _LDNS_ZONEDIFF_DNS_ZONESTORE_H
+#define _LDNS_ZONEDIFF_DNS_ZONESTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ldns/ldns.h>
+#include "dns_zonearena.h"
+#include "dns_zonetok.h"
+#include "dns_zonehash.h"
+
+/* Initial number of records a zone has room for */
+#define ZD_ZONE_INITIAL_SIZE	1024
+
+/*
+ * A record in canonical wire format, with the TTL in the wire data set
+ * to LDNS_DEFAULT_TTL; these are the exact bytes that were hashed. The
+ * real TTL is kept alongside.
+ */
+typedef struct _zd_rec
+{
+	uint32_t	ttl;
+	uint32_t	len;
+	uint8_t		wire[];
+}
+zd_rec;
+
+/* Records of an RRset are padded to keep the next one aligned */
+#define ZD_SET_ALIGN(len)	(((size_t) (len) + 3) & ~((size_t) 3))
+
+/* A sorted run of records that was spilled to a temporary file */
+typedef struct _zd_run zd_run;
+
+/* Size of the stdio buffer of a run */
+#define ZD_RUN_BUFFER_SIZE	(8 * 1024)
+
+/* Memory an open run takes up: its buffer and the record being read */
+#define ZD_RUN_MEM		(2 * ZD_RUN_BUFFER_SIZE)
+
+/* Runs of the same size are merged once there are this many of them */
+#define ZD_RUN_MERGE_FANIN	16
+
+/* Most runs that are ever read at the same time for a zone */
+#define ZD_RUN_MAX_FANIN	64
+
+/*
+ * Order-independent sum of the hashes and TTLs of all records that were
+ * added to a zone, spilled or not; zones with different sums differ
+ */
+typedef struct _zd_zone_sum
+{
+	uint64_t	hash[ZD_HASH_MAX_SIZE / 8];
+	uint64_t	ttl;
+	uint64_t	count;
+}
+zd_zone_sum;
+
+/*
+ * Zone data; the hashes are kept in a contiguous array of their own, so
+ * sorting and merging walk memory linearly. The record at index i belongs
+ * to the hash at offset i * hash_size. Records live in the arena. Zones
+ * that do not fit in memory also have sorted runs on disk; zones loaded
+ * from an index point into its mapping instead.
+ */
+typedef struct _dnsz_zone
+{
+	size_t		hash_size;
+	unsigned char*	rr_hashes;
+	zd_rec**	recs;
+	size_t		count;
+	size_t		capacity;
+	zd_arena	arena;
+	zd_run*		runs;
+	int		run_count;
+	zd_map		map;
+	zd_zone_sum	sum;
+	int		sorted;
+}
+dnsz_zone;
+
+/* Position in one of the sources an iterator merges */
+typedef struct _zd_cursor
+{
+	const unsigned char*	hash;
+	const zd_rec*		rec;
+	zd_run*			run;
+}
+zd_cursor;
+
+/* Iterator over all records of a zone in hash order, in memory and on disk */
+typedef struct _zd_zone_iter
+{
+	const dnsz_zone*	zone;
+	int			verify;
+	size_t			pos;
+	zd_cursor*		heap;
+	int			heap_count;
+	const unsigned char*	hash;
+	const zd_rec*		rec;
+}
+zd_zone_iter;
+
+/* Return the hash of the record at the specified index */
+static inline const unsigned char* zd_zone_hash(const dnsz_zone* zone, const size_t i)
+{
+	return &zone->rr_hashes[i * zone->hash_size];
+}
+
+/*
+ * Walk the records of an RRset made by zd_zone_group(); start with a NULL
+ * member. Returns NULL after the last record.
+ */
+static inline const zd_rec* zd_set_next(const zd_rec* set, const zd_rec* member)
+{
+	const uint8_t*	next	= (member == NULL) ? set->wire : member->wire + ZD_SET_ALIGN(member->len);
+
+	return (next < set->wire + set->len) ? (const zd_rec*) next : NULL;
+}
+
+/* Order records with identical hashes; the TTL is ignored, as for hashing */
+int zd_rec_cmp(const void* a, const void* b);
+
+/* Order pointers to records like zd_rec_cmp() orders records, for qsort() */
+int zd_rec_ptr_cmp(const void* a, const void* b);
+
+/* Compare two lowercased names in wire format in DNSSEC canonical order (RFC 4034, section 6.1) */
+int zd_dname_canon_cmp(const uint8_t* a, const uint8_t* b);
+
+/* Turn a stored record back into an ldns RR, for output */
+ldns_rr* zd_rec2rr(const zd_rec* rec);
+
+/* Copy a record in wire format and its hash to the end of a zone */
+int zd_zone_add(dnsz_zone* zone, const unsigned char* digest, const uint8_t* wire, const size_t wire_len, const uint32_t ttl);
+
+/* Move all records from one zone to the end of another */
+int zd_zone_append(dnsz_zone* zone, dnsz_zone* from);
+
+/* Return the amount of memory the records and open runs of a zone take up */
+size_t zd_zone_mem(const dnsz_zone* zone);
+
+/*
+ * Sort the records in memory in hash order; if equal hashes do not
+ * guarantee equal records (verify), the records decide the order
+ */
+void zd_zone_sort(dnsz_zone* zone, const int verify);
+
+/*
+ * Sort the records in memory, write them to a new run on disk and free
+ * them; runs of the same size are merged, so that the number of runs
+ * only grows with the logarithm of the zone size
+ */
+int zd_zone_spill(dnsz_zone* zone, const int verify);
+
+/*
+ * Merge spilled runs until there are at most max_runs of them, reading
+ * no more than ZD_RUN_MAX_FANIN at a time; returns 0 on success
+ */
+int zd_zone_compact(dnsz_zone* zone, const int verify, const int max_runs);
+
+/* Free zone data, including spilled runs */
+void zd_free_zone(dnsz_zone* zone);
+
+/*
+ * Create an anonymous temporary file in $TMPDIR, or /tmp, with a buffer
+ * of ZD_RUN_BUFFER_SIZE; returns NULL on failure
+ */
+FILE* zd_tmpfile(void);
+
+/* Decides which records zd_zone_filter() keeps */
+typedef int (*zd_keep_fn)(const zd_rec* rec, void* arg);
+
+/* Drop the records in memory for which keep() returns zero */
+int zd_zone_filter(dnsz_zone* zone, zd_keep_fn keep, void* arg);
+
+/* Check if two zones certainly differ, without looking at their records */
+int zd_zone_sum_differs(const dnsz_zone* left, const dnsz_zone* right);
+
+/* Start iterating over a sorted zone; returns 0 on success */
+int zd_zone_iter_init(zd_zone_iter* iter, const dnsz_zone* zone, const int verify);
+
+/* Advance to the next record; iter->rec is NULL at the end. Returns 0 on success */
+int zd_zone_iter_next(zd_zone_iter* iter);
+
+/* Release an iterator */
+void zd_zone_iter_free(zd_zone_iter* iter);
+
+/*
+ * Called by zd_zone_merge() for each difference: a record that is only
+ * on the left (rr2del), only on the right (rr2add), or on both sides with
+ * a different TTL (both set). A non-zero return value stops the merge.
+ */
+typedef int (*zd_merge_cb)(const zd_rec* rr2del, const zd_rec* rr2add, void* ctx);
+
+/* Walk two sorted zones side by side and report their differences */
+int zd_zone_merge(const dnsz_zone* left, const dnsz_zone* right, const int verify, zd_merge_cb cb, void* ctx);
+
+/* Return the length of the owner name, type and class a record starts with */
+size_t zd_wire_rrset_len(const uint8_t* wire, const size_t len);
+
+/* Replace the TTL of a record in wire format by a fixed one, so it does not affect hashing */
+static inline void zd_wire_mask_ttl(uint8_t* wire, const size_t ttl_ofs)
+{
+	wire[ttl_ofs]     = (uint8_t) (LDNS_DEFAULT_TTL >> 24);
+	wire[ttl_ofs + 1] = (uint8_t) (LDNS_DEFAULT_TTL >> 16);
+	wire[ttl_ofs + 2] = (uint8_t) (LDNS_DEFAULT_TTL >> 8);
+	wire[ttl_ofs + 3] = (uint8_t) LDNS_DEFAULT_TTL;
+}
+
+/*
+ * Turn a zone in which the hash of each record identifies its RRset into
+ * a zone with one entry per RRset, fingerprinted as a whole
+ */
+int zd_zone_group(dnsz_zone* zone, const int hash_alg);
+
+/* Walk two grouped zones side by side, comparing records of changed RRsets only */
+int zd_zone_merge_rrsets(const dnsz_zone* left, const dnsz_zone* right, const int verify, zd_merge_cb cb, void* ctx);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONESTORE_H */
@@ -0,0 +1,1393 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <ldns/ldns.h>
+#include "dns_zonetok.h"
+
+/* Largest RR in wire format: owner, fixed fields and RDATA */
+#define ZD_TOK_WIRE_MAX		(LDNS_MAX_DOMAINLEN + 1 + 10 + 65535)
+
+/* Initial number of tokens per logical line we have room for */
+#define ZD_TOK_INITIAL_TOKENS	64
+
+/* Returned by the record encoders if ldns should parse the record instead */
+#define ZD_TOK_FALLBACK		-1
+
+/* A token in the current logical line; these point into the mapping */
+typedef struct _zd_token
+{
+	const char*	s;
+	size_t		len;
+	int		quoted;
+}
+zd_token;
+
+struct _zd_tok
+{
+	const char*	p;
+	const char*	end;
+	const char*	limit;
+	int		line_no;
+	uint32_t	default_ttl;
+	ldns_rdf*	origin_rdf;
+	uint8_t		origin[LDNS_MAX_DOMAINLEN + 1];
+	size_t		origin_len;
+	uint8_t		prev[LDNS_MAX_DOMAINLEN + 1];
+	size_t		prev_len;
+	zd_token*	toks;
+	size_t		tok_count;
+	size_t		tok_cap;
+	int		leading_ws;
+	uint8_t		wire[ZD_TOK_WIRE_MAX];
+	size_t		wire_len;
+	int		wire_overflow;
+	char*		text;
+	size_t		text_cap;
+	uint8_t		bitmap[256][32];
+	uint8_t		window_len[256];
+	uint8_t		skip[ZD_TOK_SKIP_TYPES / 8];
+	size_t*		skipped;
+};
+
+/* Map a zone file into memory for sequential reading; returns 0 on success */
+int zd_map_file(const char* zone_file, zd_map* map)
+{
+	assert(zone_file != NULL);
+	assert(map != NULL);
+
+	struct stat	st;
+	void*		data	= NULL;
+	int		fd	= open(zone_file, O_RDONLY);
+	int		rv	= 0;
+
+	map->data = NULL;
+	map->size = 0;
+
+	if (fd < 0)
+	{
+		return errno;
+	}
+
+	if (fstat(fd, &st) != 0)
+	{
+		rv = errno;
+		close(fd);
+
+		return rv;
+	}
+
+	/* Only regular files can be mapped; pipes and the like cannot */
+	if (!S_ISREG(st.st_mode))
+	{
+		close(fd);
+
+		return ENODEV;
+	}
+
+	if (st.st_size == 0)
+	{
+		/* An empty mapping is not allowed, but an empty zone is */
+		close(fd);
+
+		map->data = "";
+
+		return 0;
+	}
+
+	data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	rv = errno;
+
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		return rv;
+	}
+
+	/* Zones are read once from front to back */
+	madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+	map->data = (const char*) data;
+	map->size = (size_t) st.st_size;
+
+	return 0;
+}
+
+/* Release a mapping made by zd_map_file() */
+void zd_unmap_file(zd_map* map)
+{
+	assert(map != NULL);
+
+	if (map->size > 0)
+	{
+		munmap((void*) map->data, map->size);
+	}
+
+	map->data = NULL;
+	map->size = 0;
+}
+
+/* Replace the origin with a name parsed by ldns; returns 0 on success */
+static int zd_tok_set_origin(zd_tok* t, ldns_rdf* origin)
+{
+	if (t->origin_rdf != NULL)
+	{
+		ldns_rdf_deep_free(t->origin_rdf);
+	}
+
+	t->origin_rdf = origin;
+	t->origin_len = 0;
+
+	if (origin != NULL)
+	{
+		if (ldns_rdf_size(origin) > sizeof(t->origin))
+		{
+			return -1;
+		}
+
+		memcpy(t->origin, ldns_rdf_data(origin), ldns_rdf_size(origin));
+		t->origin_len = ldns_rdf_size(origin);
+	}
+
+	return 0;
+}
+
+/*
+ * Create a tokenizer for a range of a mapped zone file, starting out with
+ * the given parser state; the tokenizer takes over the origin
+ */
+zd_tok* zd_tok_new(const zd_map* map, const zd_chunk* chunk, ldns_rdf* origin, const uint32_t ttl, const ldns_rdf* prev)
+{
+	assert(map != NULL);
+	assert(chunk != NULL);
+
+	zd_tok*	t	= (zd_tok*) calloc(1, sizeof(zd_tok));
+	size_t	i	= 0;
+
+	if (t == NULL)
+	{
+		if (origin != NULL) ldns_rdf_deep_free(origin);
+
+		return NULL;
+	}
+
+	t->p = map->data + chunk->start;
+	t->end = (chunk->end < 0) ? map->data + map->size : map->data + chunk->end;
+	t->limit = map->data + map->size;
+	t->line_no = chunk->line_no;
+	t->default_ttl = ttl;
+	t->tok_cap = ZD_TOK_INITIAL_TOKENS;
+
+	if ((zd_tok_set_origin(t, origin) != 0) ||
+	    ((t->toks = (zd_token*) malloc(t->tok_cap * sizeof(zd_token))) == NULL))
+	{
+		zd_tok_free(t);
+
+		return NULL;
+	}
+
+	if ((prev != NULL) && (ldns_rdf_size(prev) <= sizeof(t->prev)))
+	{
+		memcpy(t->prev, ldns_rdf_data(prev), ldns_rdf_size(prev));
+		t->prev_len = ldns_rdf_size(prev);
+
+		/* Owner names are kept in canonical form */
+		for (i = 0; i < t->prev_len; i++)
+		{
+			if ((t->prev[i] >= 'A') && (t->prev[i] <= 'Z')) t->prev[i] += 'a' - 'A';
+		}
+	}
+
+	return t;
+}
+
+/* Skip records of a type as soon as their type is known */
+void zd_tok_skip_type(zd_tok* t, const uint16_t type, size_t* counts)
+{
+	assert(t != NULL);
+	assert(type < ZD_TOK_SKIP_TYPES);
+	assert(counts != NULL);
+
+	t->skip[type / 8] |= (uint8_t) (1 << (type % 8));
+	t->skipped = counts;
+}
+
+/* Free a tokenizer */
+void zd_tok_free(zd_tok* t)
+{
+	if (t == NULL) return;
+
+	if (t->origin_rdf != NULL)
+	{
+		ldns_rdf_deep_free(t->origin_rdf);
+	}
+
+	free(t->toks);
+	free(t->text);
+	free(t);
+}
+
+/* Return the current line number */
+int zd_tok_line_no(const zd_tok* t)
+{
+	return t->line_no;
+}
+
+/* Return the current origin in presentation format, or NULL if none */
+char* zd_tok_origin_str(const zd_tok* t)
+{
+	return (t->origin_rdf != NULL) ? ldns_rdf2str(t->origin_rdf) : NULL;
+}
+
+/* Add a token to the current logical line */
+static int zd_tok_push(zd_tok* t, const char* s, const size_t len, const int quoted)
+{
+	if (t->tok_count == t->tok_cap)
+	{
+		zd_token*	new_toks	= (zd_token*) realloc(t->toks, 2 * t->tok_cap * sizeof(zd_token));
+
+		if (new_toks == NULL) return ENOMEM;
+
+		t->toks = new_toks;
+		t->tok_cap *= 2;
+	}
+
+	t->toks[t->tok_count].s = s;
+	t->toks[t->tok_count].len = len;
+	t->toks[t->tok_count].quoted = quoted;
+	t->tok_count++;
+
+	return 0;
+}
+
+/*
+ * Split the next logical line into tokens, following the same lexical rules
+ * as ldns: comments are dropped, parentheses join lines and are dropped and
+ * quoted strings are kept together. Returns 0, ZD_TOK_END, ENOMEM or
+ * LDNS_STATUS_SYNTAX_ERR for unbalanced parentheses or an unterminated
+ * string.
+ */
+static int zd_tok_read_line(zd_tok* t)
+{
+	const char*	p	= t->p;
+	int		depth	= 0;
+	int		rv	= 0;
+
+	t->tok_count = 0;
+
+	if (p >= t->end)
+	{
+		return ZD_TOK_END;
+	}
+
+	t->leading_ws = ((*p == ' ') || (*p == '\t'));
+
+	while (p < t->limit)
+	{
+		const char	c	= *p;
+
+		if (c == '\n')
+		{
+			t->line_no++;
+			p++;
+
+			if (depth == 0) break;
+		}
+		else if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\f') || (c == '\v'))
+		{
+			p++;
+		}
+		else if (c == ';')
+		{
+			const char*	eol	= memchr(p, '\n', t->limit - p);
+
+			p = (eol != NULL) ? eol : t->limit;
+		}
+		else if (c == '(')
+		{
+			depth++;
+			p++;
+		}
+		else if (c == ')')
+		{
+			p++;
+
+			if (depth-- == 0)
+			{
+				t->p = p;
+
+				return LDNS_STATUS_SYNTAX_ERR;
+			}
+		}
+		else if (c == '"')
+		{
+			const char*	start	= ++p;
+
+			while ((p < t->limit) && (*p != '"'))
+			{
+				if (*p == '\n') t->line_no++;
+
+				if ((*p == '\\') && (p + 1 < t->limit))
+				{
+					if (p[1] == '\n') t->line_no++;
+
+					p++;
+				}
+
+				p++;
+			}
+
+			if (p >= t->limit)
+			{
+				/* Unterminated string */
+				t->p = p;
+
+				return LDNS_STATUS_SYNTAX_ERR;
+			}
+
+			if ((rv = zd_tok_push(t, start, p - start, 1)) != 0) return rv;
+
+			p++;
+		}
+		else
+		{
+			const char*	start	= p;
+
+			while (p < t->limit)
+			{
+				const char	d	= *p;
+
+				if ((d == ' ') || (d == '\t') || (d == '\n') || (d == '\r') || (d == '\f') || (d == '\v') ||
+				    (d == ';') || (d == '(') || (d == ')') || (d == '"'))
+				{
+					break;
+				}
+
+				if ((d == '\\') && (p + 1 < t->limit) && (p[1] != '\n'))
+				{
+					p++;
+				}
+
+				p++;
+			}
+
+			if ((rv = zd_tok_push(t, start, p - start, 0)) != 0) return rv;
+		}
+	}
+
+	t->p = p;
+
+	return (depth != 0) ? LDNS_STATUS_SYNTAX_ERR : 0;
+}
+
+/* Compare a token to a keyword */
+static inline int zd_tok_is(const zd_token* tok, const char* word)
+{
+	return (!tok->quoted && (tok->len == strlen(word)) && (strncasecmp(tok->s, word, tok->len) == 0));
+}
+
+/* Copy a token to a NUL-terminated buffer; returns -1 if it does not fit */
+static int zd_tok_cstr(const zd_token* tok, char* buf, const size_t buf_size)
+{
+	if (tok->len >= buf_size) return -1;
+
+	memcpy(buf, tok->s, tok->len);
+	buf[tok->len] = '\0';
+
+	return 0;
+}
+
+/* Parse an unsigned decimal number no larger than max */
+static int zd_tok_uint(const zd_token* tok, const uint32_t max, uint32_t* val)
+{
+	uint64_t	v	= 0;
+	size_t		i	= 0;
+
+	if (tok->quoted || (tok->len == 0) || (tok->len > 10)) return ZD_TOK_FALLBACK;
+
+	for (i = 0; i < tok->len; i++)
+	{
+		if ((tok->s[i] < '0') || (tok->s[i] > '9')) return ZD_TOK_FALLBACK;
+
+		v = v * 10 + (tok->s[i] - '0');
+	}
+
+	if (v > max) return ZD_TOK_FALLBACK;
+
+	*val = (uint32_t) v;
+
+	return 0;
+}
+
+/* Append bytes to the wire format record */
+static inline void zd_tok_put(zd_tok* t, const void* data, const size_t len)
+{
+	if (t->wire_len + len > sizeof(t->wire))
+	{
+		t->wire_overflow = 1;
+
+		return;
+	}
+
+	memcpy(&t->wire[t->wire_len], data, len);
+	t->wire_len += len;
+}
+
+static inline void zd_tok_put8(zd_tok* t, const uint32_t v)
+{
+	uint8_t	b	= (uint8_t) v;
+
+	zd_tok_put(t, &b, 1);
+}
+
+static inline void zd_tok_put16(zd_tok* t, const uint32_t v)
+{
+	uint8_t	b[2]	= { (uint8_t) (v >> 8), (uint8_t) v };
+
+	zd_tok_put(t, b, 2);
+}
+
+static inline void zd_tok_put32(zd_tok* t, const uint32_t v)
+{
+	uint8_t	b[4]	= { (uint8_t) (v >> 24), (uint8_t) (v >> 16), (uint8_t) (v >> 8), (uint8_t) v };
+
+	zd_tok_put(t, b, 4);
+}
+
+/* Parse and append an unsigned number of the given size in bytes */
+static int zd_tok_put_uint(zd_tok* t, const zd_token* tok, const int size)
+{
+	uint32_t	v	= 0;
+	const uint32_t	max	= (size == 1) ? 0xFF : (size == 2) ? 0xFFFF : 0xFFFFFFFF;
+
+	if (zd_tok_uint(tok, max, &v) != 0) return ZD_TOK_FALLBACK;
+
+	if (size == 1) zd_tok_put8(t, v);
+	else if (size == 2) zd_tok_put16(t, v);
+	else zd_tok_put32(t, v);
+
+	return 0;
+}
+
+/*
+ * Parse a domain name into wire format, in the same way ldns does: "@" is
+ * the origin, relative names get the origin appended and, if there is no
+ * origin, are taken to be absolute. Canonical names are lowercased.
+ */
+static int zd_tok_name(const zd_tok* t, const zd_token* tok, const int lower, uint8_t* out, size_t* out_len)
+{
+	const char*	s	= tok->s;
+	const size_t	len	= tok->len;
+	size_t		i	= 0;
+	size_t		lab	= 0;
+	size_t		n	= 1;
+	int		absolute	= 0;
+
+	if (tok->quoted || (len == 0)) return ZD_TOK_FALLBACK;
+
+	if ((len == 1) && (s[0] == '@'))
+	{
+		if (t->origin_len == 0) return ZD_TOK_FALLBACK;
+
+		memcpy(out, t->origin, t->origin_len);
+		n = t->origin_len;
+	}
+	else if ((len == 1) && (s[0] == '.'))
+	{
+		out[0] = 0;
+		n = 1;
+	}
+	else
+	{
+		out[0] = 0;
+
+		while (i < len)
+		{
+			unsigned int	c	= (unsigned char) s[i++];
+
+			if (c == '.')
+			{
+				if (n - lab - 1 == 0) return ZD_TOK_FALLBACK;
+
+				out[lab] = (uint8_t) (n - lab - 1);
+
+				if (i == len)
+				{
+					absolute = 1;
+					break;
+				}
+
+				lab = n++;
+
+				if (n > LDNS_MAX_DOMAINLEN) return ZD_TOK_FALLBACK;
+
+				continue;
+			}
+
+			if (c == '\\')
+			{
+				if (i >= len) return ZD_TOK_FALLBACK;
+
+				if ((s[i] >= '0') && (s[i] <= '9'))
+				{
+					if ((i + 2 >= len) || (s[i+1] < '0') || (s[i+1] > '9') || (s[i+2] < '0') || (s[i+2] > '9'))
+					{
+						return ZD_TOK_FALLBACK;
+					}
+
+					c = (s[i] - '0') * 100 + (s[i+1] - '0') * 10 + (s[i+2] - '0');
+					i += 3;
+
+					if (c > 255) return ZD_TOK_FALLBACK;
+				}
+				else
+				{
+					c = (unsigned char) s[i++];
+				}
+			}
+
+			if ((n - lab - 1 >= 63) || (n >= LDNS_MAX_DOMAINLEN)) return ZD_TOK_FALLBACK;
+
+			out[n++] = (uint8_t) c;
+		}
+
+		if (absolute)
+		{
+			out[n++] = 0;
+		}
+		else
+		{
+			out[lab] = (uint8_t) (n - lab - 1);
+
+			if (t->origin_len > 0)
+			{
+				if (n + t->origin_len > LDNS_MAX_DOMAINLEN) return ZD_TOK_FALLBACK;
+
+				memcpy(&out[n], t->origin, t->origin_len);
+				n += t->origin_len;
+			}
+			else
+			{
+				out[n++] = 0;
+			}
+		}
+	}
+
+	/* Label lengths never fall in the range A-Z, so lowercasing is easy */
+	if (lower)
+	{
+		for (i = 0; i < n; i++)
+		{
+			if ((out[i] >= 'A') && (out[i] <= 'Z')) out[i] += 'a' - 'A';
+		}
+	}
+
+	*out_len = n;
+
+	return 0;
+}
+
+/* Parse and append a domain name */
+static int zd_tok_put_name(zd_tok* t, const zd_token* tok, const int lower)
+{
+	uint8_t	name[LDNS_MAX_DOMAINLEN + 1];
+	size_t	name_len	= 0;
+
+	if (zd_tok_name(t, tok, lower, name, &name_len) != 0) return ZD_TOK_FALLBACK;
+
+	zd_tok_put(t, name, name_len);
+
+	return 0;
+}
+
+/* Parse and append a character string, with \X and \DDD escapes */
+static int zd_tok_put_string(zd_tok* t, const zd_token* tok)
+{
+	uint8_t	str[256];
+	size_t	n	= 0;
+	size_t	i	= 0;
+
+	while (i < tok->len)
+	{
+		unsigned int	c	= (unsigned char) tok->s[i++];
+
+		if (c == '\\')
+		{
+			if (i >= tok->len) return ZD_TOK_FALLBACK;
+
+			if ((tok->s[i] >= '0') && (tok->s[i] <= '9'))
+			{
+				if ((i + 2 >= tok->len) || (tok->s[i+1] < '0') || (tok->s[i+1] > '9') || (tok->s[i+2] < '0') || (tok->s[i+2] > '9'))
+				{
+					return ZD_TOK_FALLBACK;
+				}
+
+				c = (tok->s[i] - '0') * 100 + (tok->s[i+1] - '0') * 10 + (tok->s[i+2] - '0');
+				i += 3;
+
+				if (c > 255) return ZD_TOK_FALLBACK;
+			}
+			else
+			{
+				c = (unsigned char) tok->s[i++];
+			}
+		}
+
+		if (n >= 255) return ZD_TOK_FALLBACK;
+
+		str[n++] = (uint8_t) c;
+	}
+
+	zd_tok_put8(t, n);
+	zd_tok_put(t, str, n);
+
+	return 0;
+}
+
+/* Decode a hexadecimal digit, or return -1 */
+static inline int zd_hex_val(const char c)
+{
+	if ((c >= '0') && (c <= '9')) return c - '0';
+	if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+
+	return -1;
+}
+
+/* Parse and append hexadecimal data spread over tokens first..count-1 */
+static int zd_tok_put_hex(zd_tok* t, const size_t first, const size_t count)
+{
+	size_t	i	= 0;
+	size_t	j	= 0;
+	int	hi	= -1;
+
+	if (first >= count) return ZD_TOK_FALLBACK;
+
+	for (i = first; i < count; i++)
+	{
+		if (t->toks[i].quoted) return ZD_TOK_FALLBACK;
+
+		for (j = 0; j < t->toks[i].len; j++)
+		{
+			const int	v	= zd_hex_val(t->toks[i].s[j]);
+
+			if (v < 0) return ZD_TOK_FALLBACK;
+
+			if (hi < 0)
+			{
+				hi = v;
+			}
+			else
+			{
+				zd_tok_put8(t, (hi << 4) | v);
+				hi = -1;
+			}
+		}
+	}
+
+	return (hi < 0) ? 0 : ZD_TOK_FALLBACK;
+}
+
+/* Decode a base64 digit, or return -1 */
+static inline int zd_b64_val(const char c)
+{
+	if ((c >= 'A') && (c <= 'Z')) return c - 'A';
+	if ((c >= 'a') && (c <= 'z')) return c - 'a' + 26;
+	if ((c >= '0') && (c <= '9')) return c - '0' + 52;
+	if (c == '+') return 62;
+	if (c == '/') return 63;
+
+	return -1;
+}
+
+/* Parse and append base64 data spread over tokens first..count-1 */
+static int zd_tok_put_b64(zd_tok* t, const size_t first, const size_t count)
+{
+	uint32_t	acc	= 0;
+	int		bits	= 0;
+	int		pad	= 0;
+	size_t		i	= 0;
+	size_t		j	= 0;
+
+	if (first >= count) return ZD_TOK_FALLBACK;
+
+	for (i = first; i < count; i++)
+	{
+		if (t->toks[i].quoted) return ZD_TOK_FALLBACK;
+
+		for (j = 0; j < t->toks[i].len; j++)
+		{
+			const char	c	= t->toks[i].s[j];
+			int		v	= 0;
+
+			if (c == '=')
+			{
+				pad++;
+				continue;
+			}
+
+			/* No data may follow the padding */
+			if (pad || ((v = zd_b64_val(c)) < 0)) return ZD_TOK_FALLBACK;
+
+			acc = (acc << 6) | (uint32_t) v;
+			bits += 6;
+
+			if (bits >= 8)
+			{
+				bits -= 8;
+				zd_tok_put8(t, acc >> bits);
+			}
+		}
+	}
+
+	/* Left-over bits must be padding */
+	if ((pad > 2) || (bits >= 6) || ((acc & ((1u << bits) - 1)) != 0)) return ZD_TOK_FALLBACK;
+
+	return 0;
+}
+
+/* Decode a base32hex digit, or return -1 */
+static inline int zd_b32hex_val(const char c)
+{
+	if ((c >= '0') && (c <= '9')) return c - '0';
+	if ((c >= 'a') && (c <= 'v')) return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'V')) return c - 'A' + 10;
+
+	return -1;
+}
+
+/* Parse and append a length-prefixed base32hex string (NSEC3 next owner) */
+static int zd_tok_put_b32hex(zd_tok* t, const zd_token* tok)
+{
+	uint8_t		data[256];
+	size_t		n	= 0;
+	uint32_t	acc	= 0;
+	int		bits	= 0;
+	size_t		i	= 0;
+
+	if (tok->quoted || (tok->len == 0)) return ZD_TOK_FALLBACK;
+
+	for (i = 0; i < tok->len; i++)
+	{
+		const int	v	= zd_b32hex_val(tok->s[i]);
+
+		if (v < 0) return ZD_TOK_FALLBACK;
+
+		acc = (acc << 5) | (uint32_t) v;
+		bits += 5;
+
+		if (bits >= 8)
+		{
+			bits -= 8;
+
+			if (n >= 255) return ZD_TOK_FALLBACK;
+
+			data[n++] = (uint8_t) (acc >> bits);
+		}
+	}
+
+	if ((bits >= 5) || ((acc & ((1u << bits) - 1)) != 0)) return ZD_TOK_FALLBACK;
+
+	zd_tok_put8(t, n);
+	zd_tok_put(t, data, n);
+
+	return 0;
+}
+
+/* Parse and append a length-prefixed NSEC3 salt, "-" meaning empty */
+static int zd_tok_put_salt(zd_tok* t, const zd_token* tok)
+{
+	size_t	len_ofs	= t->wire_len;
+	int	rv	= 0;
+
+	if ((tok->len == 1) && (tok->s[0] == '-') && !tok->quoted)
+	{
+		zd_tok_put8(t, 0);
+
+		return 0;
+	}
+
+	zd_tok_put8(t, 0);
+
+	if ((rv = zd_tok_put_hex(t, (size_t) (tok - t->toks), (size_t) (tok - t->toks) + 1)) != 0) return rv;
+
+	if (t->wire_overflow || (t->wire_len - len_ofs - 1 > 255)) return ZD_TOK_FALLBACK;
+
+	t->wire[len_ofs] = (uint8_t) (t->wire_len - len_ofs - 1);
+
+	return 0;
+}
+
+/* Parse and append an NSEC(3) type bitmap from tokens first..count-1 */
+static int zd_tok_put_bitmap(zd_tok* t, const size_t first, const size_t count)
+{
+	char	name[32];
+	size_t	i	= 0;
+	int	w	= 0;
+
+	memset(t->window_len, 0, sizeof(t->window_len));
+
+	for (i = first; i < count; i++)
+	{
+		ldns_rr_type	type	= 0;
+
+		if (t->toks[i].quoted || (zd_tok_cstr(&t->toks[i], name, sizeof(name)) != 0)) return ZD_TOK_FALLBACK;
+
+		if ((type = ldns_get_rr_type_by_name(name)) == 0) return ZD_TOK_FALLBACK;
+
+		w = type >> 8;
+
+		if (t->window_len[w] == 0)
+		{
+			memset(t->bitmap[w], 0, sizeof(t->bitmap[w]));
+		}
+
+		t->bitmap[w][(type & 0xFF) >> 3] |= (uint8_t) (0x80 >> (type & 0x07));
+
+		if (((type & 0xFF) >> 3) + 1 > t->window_len[w])
+		{
+			t->window_len[w] = ((type & 0xFF) >> 3) + 1;
+		}
+	}
+
+	for (w = 0; w < 256; w++)
+	{
+		if (t->window_len[w] == 0) continue;
+
+		zd_tok_put8(t, w);
+		zd_tok_put8(t, t->window_len[w]);
+		zd_tok_put(t, t->bitmap[w], t->window_len[w]);
+	}
+
+	return 0;
+}
+
+/* Return non-zero if the year is a leap year */
+static inline int zd_leap(const int y)
+{
+	return ((y % 4 == 0) && (y % 100 != 0)) || (y % 400 == 0);
+}
+
+/* Parse and append a YYYYMMDDHHmmSS timestamp as seconds since the epoch */
+static int zd_tok_put_time(zd_tok* t, const zd_token* tok)
+{
+	static const int	mdays[12]	= { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	int			f[6]		= { 0 };
+	const int		w[6]		= { 4, 2, 2, 2, 2, 2 };
+	const char*		s		= tok->s;
+	int64_t			days		= 0;
+	int			i		= 0;
+	int			j		= 0;
+	int			y		= 0;
+
+	/* Plain numbers and anything unusual are left to ldns */
+	if (tok->quoted || (tok->len != 14)) return ZD_TOK_FALLBACK;
+
+	for (i = 0; i < 6; i++)
+	{
+		for (j = 0; j < w[i]; j++, s++)
+		{
+			if ((*s < '0') || (*s > '9')) return ZD_TOK_FALLBACK;
+
+			f[i] = f[i] * 10 + (*s - '0');
+		}
+	}
+
+	if ((f[0] < 1970) || (f[1] < 1) || (f[1] > 12) || (f[2] < 1) || (f[2] > 31) || (f[3] > 23) || (f[4] > 59) || (f[5] > 59))
+	{
+		return ZD_TOK_FALLBACK;
+	}
+
+	if (f[2] > mdays[f[1]-1] + (((f[1] == 2) && zd_leap(f[0])) ? 1 : 0)) return ZD_TOK_FALLBACK;
+
+	for (y = 1970; y < f[0]; y++)
+	{
+		days += zd_leap(y) ? 366 : 365;
+	}
+
+	for (i = 0; i < f[1] - 1; i++)
+	{
+		days += mdays[i] + (((i == 1) && zd_leap(f[0])) ? 1 : 0);
+	}
+
+	days += f[2] - 1;
+
+	/* Serial number arithmetic, so wrap around like ldns does */
+	zd_tok_put32(t, (uint32_t) (days * 86400 + f[3] * 3600 + f[4] * 60 + f[5]));
+
+	return 0;
+}
+
+/* Encode the RDATA of a type we know how to handle */
+static int zd_tok_rdata(zd_tok* t, const ldns_rr_type type, const size_t first)
+{
+	const size_t	count	= t->tok_count;
+	const size_t	n	= count - first;
+	const zd_token*	r	= &t->toks[first];
+	char		addr[64];
+	uint8_t		bin[16];
+	uint32_t	v	= 0;
+	size_t		i	= 0;
+
+	/* Generic RDATA is left to ldns */
+	if ((n > 0) && !r[0].quoted && (r[0].len == 2) && (r[0].s[0] == '\\') && (r[0].s[1] == '#'))
+	{
+		return ZD_TOK_FALLBACK;
+	}
+
+	switch(type)
+	{
+	case LDNS_RR_TYPE_A:
+		if ((n != 1) || r[0].quoted || (zd_tok_cstr(&r[0], addr, sizeof(addr)) != 0) || (inet_pton(AF_INET, addr, bin) != 1)) return ZD_TOK_FALLBACK;
+
+		zd_tok_put(t, bin, 4);
+
+		return 0;
+	case LDNS_RR_TYPE_AAAA:
+		if ((n != 1) || r[0].quoted || (zd_tok_cstr(&r[0], addr, sizeof(addr)) != 0) || (inet_pton(AF_INET6, addr, bin) != 1)) return ZD_TOK_FALLBACK;
+
+		zd_tok_put(t, bin, 16);
+
+		return 0;
+	case LDNS_RR_TYPE_NS:
+	case LDNS_RR_TYPE_CNAME:
+	case LDNS_RR_TYPE_DNAME:
+	case LDNS_RR_TYPE_PTR:
+		if (n != 1) return ZD_TOK_FALLBACK;
+
+		return zd_tok_put_name(t, &r[0], 1);
+	case LDNS_RR_TYPE_MX:
+		if ((n != 2) || (zd_tok_put_uint(t, &r[0], 2) != 0)) return ZD_TOK_FALLBACK;
+
+		return zd_tok_put_name(t, &r[1], 1);
+	case LDNS_RR_TYPE_SRV:
+		if ((n != 4) || (zd_tok_put_uint(t, &r[0], 2) != 0) || (zd_tok_put_uint(t, &r[1], 2) != 0) || (zd_tok_put_uint(t, &r[2], 2) != 0)) return ZD_TOK_FALLBACK;
+
+		return zd_tok_put_name(t, &r[3], 1);
+	case LDNS_RR_TYPE_TXT:
+		if (n == 0) return ZD_TOK_FALLBACK;
+
+		for (i = 0; i < n; i++)
+		{
+			if (zd_tok_put_string(t, &r[i]) != 0) return ZD_TOK_FALLBACK;
+		}
+
+		return 0;
+	case LDNS_RR_TYPE_DS:
+		if ((n < 4) || (zd_tok_put_uint(t, &r[0], 2) != 0) || (zd_tok_put_uint(t, &r[1], 1) != 0) || (zd_tok_put_uint(t, &r[2], 1) != 0)) return ZD_TOK_FALLBACK;
+
+		return zd_tok_put_hex(t, first + 3, count);
+	case LDNS_RR_TYPE_DNSKEY:
+		if ((n < 4) || (zd_tok_put_uint(t, &r[0], 2) != 0) || (zd_tok_put_uint(t, &r[1], 1) != 0) || (zd_tok_put_uint(t, &r[2], 1) != 0)) return ZD_TOK_FALLBACK;
+
+		return zd_tok_put_b64(t, first + 3, count);
+	case LDNS_RR_TYPE_RRSIG:
+		if ((n < 9) || r[0].quoted || (zd_tok_cstr(&r[0], addr, sizeof(addr)) != 0) || ((v = ldns_get_rr_type_by_name(addr)) == 0)) return ZD_TOK_FALLBACK;
+
+		zd_tok_put16(t, v);
+
+		if ((zd_tok_put_uint(t, &r[1], 1) != 0) ||
+		    (zd_tok_put_uint(t, &r[2], 1) != 0) ||
+		    (zd_tok_put_uint(t, &r[3], 4) != 0) ||
+		    (zd_tok_put_time(t, &r[4]) != 0) ||
+		    (zd_tok_put_time(t, &r[5]) != 0) ||
+		    (zd_tok_put_uint(t, &r[6], 2) != 0) ||
+		    (zd_tok_put_name(t, &r[7], 1) != 0))
+		{
+			return ZD_TOK_FALLBACK;
+		}
+
+		return zd_tok_put_b64(t, first + 8, count);
+	case LDNS_RR_TYPE_NSEC:
+		/* The next name is not part of the canonical form (RFC 6840) */
+		if ((n < 1) || (zd_tok_put_name(t, &r[0], 0) != 0)) return ZD_TOK_FALLBACK;
+
+		return zd_tok_put_bitmap(t, first + 1, count);
+	case LDNS_RR_TYPE_NSEC3:
+		if ((n < 5) ||
+		    (zd_tok_put_uint(t, &r[0], 1) != 0) ||
+		    (zd_tok_put_uint(t, &r[1], 1) != 0) ||
+		    (zd_tok_put_uint(t, &r[2], 2) != 0) ||
+		    (zd_tok_put_salt(t, &r[3]) != 0) ||
+		    (zd_tok_put_b32hex(t, &r[4]) != 0))
+		{
+			return ZD_TOK_FALLBACK;
+		}
+
+		return zd_tok_put_bitmap(t, first + 5, count);
+	case LDNS_RR_TYPE_NSEC3PARAM:
+		if ((n != 4) ||
+		    (zd_tok_put_uint(t, &r[0], 1) != 0) ||
+		    (zd_tok_put_uint(t, &r[1], 1) != 0) ||
+		    (zd_tok_put_uint(t, &r[2], 2) != 0))
+		{
+			return ZD_TOK_FALLBACK;
+		}
+
+		return zd_tok_put_salt(t, &r[3]);
+	default:
+		return ZD_TOK_FALLBACK;
+	}
+}
+
+/* Try to encode the current logical line without ldns */
+static int zd_tok_fast(zd_tok* t, zd_tok_rr* rec)
+{
+	uint8_t		owner[LDNS_MAX_DOMAINLEN + 1];
+	size_t		owner_len	= 0;
+	size_t		i		= 0;
+	uint32_t	ttl		= (t->default_ttl != 0) ? t->default_ttl : LDNS_DEFAULT_TTL;
+	ldns_rr_type	type		= 0;
+	char		buf[32];
+	size_t		rdlen_ofs	= 0;
+
+	/* Owner name, either explicit or inherited from the previous record */
+	if (t->leading_ws)
+	{
+		if (t->prev_len == 0) return ZD_TOK_FALLBACK;
+
+		memcpy(owner, t->prev, t->prev_len);
+		owner_len = t->prev_len;
+	}
+	else
+	{
+		if ((t->tok_count < 1) || (zd_tok_name(t, &t->toks[0], 1, owner, &owner_len) != 0)) return ZD_TOK_FALLBACK;
+
+		i = 1;
+	}
+
+	/* Optional TTL and class, in that order, as ldns accepts them */
+	if ((i < t->tok_count) && !t->toks[i].quoted && (t->toks[i].len > 0) && (t->toks[i].s[0] >= '0') && (t->toks[i].s[0] <= '9'))
+	{
+		const char*	endptr	= NULL;
+
+		if (zd_tok_cstr(&t->toks[i], buf, sizeof(buf)) != 0) return ZD_TOK_FALLBACK;
+
+		ttl = ldns_str2period(buf, &endptr);
+
+		if (*endptr != '\0') return ZD_TOK_FALLBACK;
+
+		i++;
+	}
+
+	if ((i < t->tok_count) && zd_tok_is(&t->toks[i], "IN"))
+	{
+		i++;
+	}
+
+	if ((i >= t->tok_count) || t->toks[i].quoted || (zd_tok_cstr(&t->toks[i], buf, sizeof(buf)) != 0)) return ZD_TOK_FALLBACK;
+
+	/* Other classes are rare enough to leave to ldns */
+	if ((type = ldns_get_rr_type_by_name(buf)) == 0) return ZD_TOK_FALLBACK;
+
+	i++;
+
+	t->wire_len = 0;
+	t->wire_overflow = 0;
+
+	zd_tok_put(t, owner, owner_len);
+	zd_tok_put16(t, type);
+	zd_tok_put16(t, LDNS_RR_CLASS_IN);
+	zd_tok_put32(t, ttl);
+	rdlen_ofs = t->wire_len;
+	zd_tok_put16(t, 0);
+
+	if (zd_tok_rdata(t, type, i) != 0) return ZD_TOK_FALLBACK;
+
+	if (t->wire_overflow || (t->wire_len - rdlen_ofs - 2 > 0xFFFF)) return ZD_TOK_FALLBACK;
+
+	t->wire[rdlen_ofs] = (uint8_t) ((t->wire_len - rdlen_ofs - 2) >> 8);
+	t->wire[rdlen_ofs + 1] = (uint8_t) (t->wire_len - rdlen_ofs - 2);
+
+	memcpy(t->prev, owner, owner_len);
+	t->prev_len = owner_len;
+
+	rec->wire = t->wire;
+	rec->wire_len = t->wire_len;
+	rec->ttl_ofs = owner_len + 4;
+	rec->type = type;
+	rec->ttl = ttl;
+	rec->rr = NULL;
+
+	return 0;
+}
+
+/*
+ * Check if the current logical line holds a record of a type to skip,
+ * looking only at the fields before the RDATA; anything out of the
+ * ordinary is left to the full parse, so it is reported as usual. The
+ * owner name of a skipped record still applies to the records after it.
+ */
+static int zd_tok_sniff(zd_tok* t)
+{
+	uint8_t		owner[LDNS_MAX_DOMAINLEN + 1];
+	size_t		owner_len	= 0;
+	size_t		i		= t->leading_ws ? 0 : 1;
+	ldns_rr_type	type		= 0;
+	char		buf[32];
+
+	if (t->skipped == NULL) return 0;
+
+	if ((i < t->tok_count) && !t->toks[i].quoted && (t->toks[i].len > 0) && (t->toks[i].s[0] >= '0') && (t->toks[i].s[0] <= '9'))
+	{
+		const char*	endptr	= NULL;
+
+		if (zd_tok_cstr(&t->toks[i], buf, sizeof(buf)) != 0) return 0;
+
+		ldns_str2period(buf, &endptr);
+
+		if (*endptr != '\0') return 0;
+
+		i++;
+	}
+
+	if ((i < t->tok_count) && zd_tok_is(&t->toks[i], "IN"))
+	{
+		i++;
+	}
+
+	/* The type must be followed by RDATA */
+	if ((i + 1 >= t->tok_count) || t->toks[i].quoted || (zd_tok_cstr(&t->toks[i], buf, sizeof(buf)) != 0)) return 0;
+
+	type = ldns_get_rr_type_by_name(buf);
+
+	if ((type == 0) || (type >= ZD_TOK_SKIP_TYPES) || !(t->skip[type / 8] & (1 << (type % 8)))) return 0;
+
+	if (t->leading_ws)
+	{
+		if (t->prev_len == 0) return 0;
+	}
+	else
+	{
+		if (zd_tok_name(t, &t->toks[0], 1, owner, &owner_len) != 0) return 0;
+
+		memcpy(t->prev, owner, owner_len);
+		t->prev_len = owner_len;
+	}
+
+	t->skipped[type]++;
+
+	return 1;
+}
+
+/* Rebuild the current logical line as text and have ldns parse it */
+static int zd_tok_ldns(zd_tok* t, zd_tok_rr* rec)
+{
+	size_t		need	= 2;
+	size_t		ofs	= 0;
+	size_t		i	= 0;
+	ldns_rdf*	prev	= NULL;
+	ldns_rr*	rr	= NULL;
+	uint8_t*	wire	= NULL;
+	size_t		wire_size	= 0;
+	int		rv	= 0;
+
+	for (i = 0; i < t->tok_count; i++)
+	{
+		need += t->toks[i].len + 3;
+	}
+
+	if (need > t->text_cap)
+	{
+		char*	new_text	= (char*) realloc(t->text, need);
+
+		if (new_text == NULL) return LDNS_STATUS_MEM_ERR;
+
+		t->text = new_text;
+		t->text_cap = need;
+	}
+
+	/* A leading blank tells ldns to use the previous owner name */
+	if (t->leading_ws) t->text[ofs++] = ' ';
+
+	for (i = 0; i < t->tok_count; i++)
+	{
+		if (i > 0) t->text[ofs++] = ' ';
+		if (t->toks[i].quoted) t->text[ofs++] = '"';
+
+		memcpy(&t->text[ofs], t->toks[i].s, t->toks[i].len);
+		ofs += t->toks[i].len;
+
+		if (t->toks[i].quoted) t->text[ofs++] = '"';
+	}
+
+	t->text[ofs] = '\0';
+
+	if (t->prev_len > 0)
+	{
+		prev = ldns_dname_new_frm_data((uint16_t) t->prev_len, t->prev);
+	}
+
+	rv = ldns_rr_new_frm_str(&rr, t->text, t->default_ttl, t->origin_rdf, &prev);
+
+	if (prev != NULL)
+	{
+		if (ldns_rdf_size(prev) <= sizeof(t->prev))
+		{
+			ldns_dname2canonical(prev);
+			memcpy(t->prev, ldns_rdf_data(prev), ldns_rdf_size(prev));
+			t->prev_len = ldns_rdf_size(prev);
+		}
+
+		ldns_rdf_deep_free(prev);
+	}
+
+	if (rv != LDNS_STATUS_OK) return rv;
+
+	ldns_rr2canonical(rr);
+
+	if ((rv = ldns_rr2wire(&wire, rr, LDNS_SECTION_ANSWER, &wire_size)) != LDNS_STATUS_OK)
+	{
+		ldns_rr_free(rr);
+
+		return rv;
+	}
+
+	if (wire_size > sizeof(t->wire))
+	{
+		free(wire);
+		ldns_rr_free(rr);
+
+		return LDNS_STATUS_ERR;
+	}
+
+	memcpy(t->wire, wire, wire_size);
+	free(wire);
+
+	t->wire_len = wire_size;
+
+	rec->wire = t->wire;
+	rec->wire_len = wire_size;
+	rec->ttl_ofs = ldns_rdf_size(ldns_rr_owner(rr)) + 4;
+	rec->type = ldns_rr_get_type(rr);
+	rec->ttl = ldns_rr_ttl(rr);
+	rec->rr = rr;
+
+	return LDNS_STATUS_OK;
+}
+
+/* Handle a $ORIGIN, $TTL or $INCLUDE directive */
+static int zd_tok_directive(zd_tok* t)
+{
+	char*	arg	= NULL;
+	int	rv	= LDNS_STATUS_OK;
+
+	if (t->tok_count < 2)
+	{
+		return LDNS_STATUS_SYNTAX_ERR;
+	}
+
+	if ((arg = strndup(t->toks[1].s, t->toks[1].len)) == NULL)
+	{
+		return LDNS_STATUS_MEM_ERR;
+	}
+
+	if (zd_tok_is(&t->toks[0], "$ORIGIN"))
+	{
+		ldns_rdf*	origin	= ldns_rdf_new_frm_str(LDNS_RDF_TYPE_DNAME, arg);
+
+		if ((origin == NULL) || (zd_tok_set_origin(t, origin) != 0))
+		{
+			rv = LDNS_STATUS_SYNTAX_DNAME_ERR;
+		}
+	}
+	else
+	{
+		const char*	endptr	= NULL;
+
+		t->default_ttl = ldns_str2period(arg, &endptr);
+	}
+
+	free(arg);
+
+	return rv;
+}
+
+/*
+ * Read the next record in the range; returns LDNS_STATUS_OK, ZD_TOK_END
+ * or an ldns error status. The wire data is valid until the next call.
+ */
+int zd_tok_next(zd_tok* t, zd_tok_rr* rec)
+{
+	assert(t != NULL);
+	assert(rec != NULL);
+
+	int	rv	= 0;
+
+	while ((rv = zd_tok_read_line(t)) == 0)
+	{
+		if (t->tok_count == 0)
+		{
+			/* Empty line or comment */
+			continue;
+		}
+
+		if (!t->leading_ws && !t->toks[0].quoted && (t->toks[0].len > 0) && (t->toks[0].s[0] == '$'))
+		{
+			if (zd_tok_is(&t->toks[0], "$INCLUDE"))
+			{
+				return LDNS_STATUS_SYNTAX_INCLUDE;
+			}
+
+			if (zd_tok_is(&t->toks[0], "$ORIGIN") || zd_tok_is(&t->toks[0], "$TTL"))
+			{
+				if ((rv = zd_tok_directive(t)) != LDNS_STATUS_OK) return rv;
+
+				continue;
+			}
+		}
+
+		if (zd_tok_sniff(t))
+		{
+			continue;
+		}
+
+		if (zd_tok_fast(t, rec) == 0)
+		{
+			return LDNS_STATUS_OK;
+		}
+
+		return zd_tok_ldns(t, rec);
+	}
+
+	return (rv == ENOMEM) ? LDNS_STATUS_MEM_ERR : rv;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LDNS_ZONEDIFF_DNS_ZONETOK_H
+#define _LDNS_ZONEDIFF_DNS_ZONETOK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ldns/ldns.h>
+#include "dns_zonesplit.h"
+
+/* Returned by zd_tok_next() at the end of the range */
+#define ZD_TOK_END	-1
+
+/* Only record types below this can be skipped */
+#define ZD_TOK_SKIP_TYPES	256
+
+/* A zone file mapped into memory */
+typedef struct _zd_map
+{
+	const char*	data;
+	size_t		size;
+}
+zd_map;
+
+/* A record produced by the tokenizer, in canonical wire format */
+typedef struct _zd_tok_rr
+{
+	uint8_t*	wire;		/* Owner, type, class, TTL, RDLENGTH and RDATA */
+	size_t		wire_len;
+	size_t		ttl_ofs;	/* Offset of the TTL in wire */
+	uint16_t	type;
+	uint32_t	ttl;
+	ldns_rr*	rr;		/* Set if ldns parsed the record; owned by the caller */
+}
+zd_tok_rr;
+
+typedef struct _zd_tok zd_tok;
+
+/* Map a zone file into memory for sequential reading; returns 0 on success */
+int zd_map_file(const char* zone_file, zd_map* map);
+
+/* Release a mapping made by zd_map_file() */
+void zd_unmap_file(zd_map* map);
+
+/*
+ * Create a tokenizer for a range of a mapped zone file, starting out with
+ * the given parser state; the tokenizer takes over the origin
+ */
+zd_tok* zd_tok_new(const zd_map* map, const zd_chunk* chunk, ldns_rdf* origin, const uint32_t ttl, const ldns_rdf* prev);
+
+/* Free a tokenizer */
+void zd_tok_free(zd_tok* tok);
+
+/*
+ * Skip records of a type as soon as their type is known, without parsing
+ * their RDATA; skipped records are counted in counts[type]
+ */
+void zd_tok_skip_type(zd_tok* tok, const uint16_t type, size_t* counts);
+
+/*
+ * Read the next record in the range; returns LDNS_STATUS_OK, ZD_TOK_END
+ * or an ldns error status. The wire data is valid until the next call.
+ */
+int zd_tok_next(zd_tok* tok, zd_tok_rr* rec);
+
+/* Return the current line number */
+int zd_tok_line_no(const zd_tok* tok);
+
+/* Return the current origin in presentation format, or NULL if none */
+char* zd_tok_origin_str(const zd_tok* tok);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONETOK_H */
+ 
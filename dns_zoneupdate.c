@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <ldns/ldns.h>
+#include "dns_zonediff.h"
+#include "dns_zonestore.h"
+#include "dns_zoneupdate.h"
+
+/* Largest DNS message over TCP, which is how IXFR responses are sent */
+#define ZD_IXFR_MAX_MSG		65535
+
+/* Size of a DNS message header */
+#define ZD_UPDATE_HEADER_SIZE	12
+
+/*
+ * Largest UPDATE message an nsupdate script sends at once; nsupdate
+ * switches to TCP for these by itself, but smaller updates keep the
+ * time a server spends applying each one short
+ */
+#define ZD_NSUPDATE_MAX_SIZE	16384
+
+/* Set up a writer for the differences from the left to the right zone */
+int zd_update_init(zd_update* u, zd_out* out, const int format, const char* zone_name, const ldns_rr* left_soa, const ldns_rr* right_soa, const int spill)
+{
+	assert(u != NULL);
+	assert(out != NULL);
+	assert(left_soa != NULL);
+	assert(right_soa != NULL);
+
+	memset(u, 0, sizeof(zd_update));
+
+	u->out = out;
+	u->format = format;
+	u->zone_name = zone_name;
+	u->old_soa = left_soa;
+
+	if (((u->new_soa = ldns_rr_clone(right_soa)) == NULL) ||
+	    ((u->scratch = ldns_buffer_new(LDNS_MAX_PACKETLEN)) == NULL) ||
+	    ((format == ZD_OUT_IXFR) && (((u->msg = (uint8_t*) malloc(ZD_IXFR_MAX_MSG)) == NULL) || ((u->adds = ldns_buffer_new(LDNS_MAX_PACKETLEN)) == NULL))))
+	{
+		zd_update_free(u);
+
+		return ENOMEM;
+	}
+
+	if ((format == ZD_OUT_IXFR) && spill && ((u->adds_fd = zd_tmpfile()) == NULL))
+	{
+		fprintf(stderr, "Failed to create a temporary file for IXFR additions\n");
+
+		zd_update_free(u);
+
+		return EIO;
+	}
+
+	return 0;
+}
+
+/* Convert a record to uncompressed wire format in the scratch buffer */
+static int zd_update_wire(zd_update* u, const ldns_rr* rr)
+{
+	ldns_buffer_clear(u->scratch);
+
+	return (ldns_rr2buffer_wire(u->scratch, rr, LDNS_SECTION_ANSWER) == LDNS_STATUS_OK) ? 0 : EINVAL;
+}
+
+/* Write the current IXFR message, preceded by its length */
+static void zd_ixfr_end_msg(zd_update* u)
+{
+	uint8_t	len[2]	= { (uint8_t) (u->msg_len >> 8), (uint8_t) u->msg_len };
+
+	u->msg[6] = (uint8_t) (u->rr_count >> 8);
+	u->msg[7] = (uint8_t) u->rr_count;
+
+	zd_out_bytes(u->out, (const char*) len, 2);
+	zd_out_bytes(u->out, (const char*) u->msg, u->msg_len);
+
+	u->msg_len = 0;
+	u->rr_count = 0;
+	u->msg_count++;
+}
+
+/* Start an IXFR message; only the first one repeats the question */
+static void zd_ixfr_start_msg(zd_update* u)
+{
+	const ldns_rdf*	apex	= ldns_rr_owner(u->old_soa);
+
+	memset(u->msg, 0, ZD_UPDATE_HEADER_SIZE);
+
+	/* A response (QR) from an authoritative server (AA) */
+	u->msg[2] = 0x84;
+	u->msg_len = ZD_UPDATE_HEADER_SIZE;
+
+	if (u->msg_count == 0)
+	{
+		u->msg[5] = 1;
+
+		memcpy(&u->msg[u->msg_len], ldns_rdf_data(apex), ldns_rdf_size(apex));
+		u->msg_len += ldns_rdf_size(apex);
+
+		u->msg[u->msg_len++] = 0;
+		u->msg[u->msg_len++] = LDNS_RR_TYPE_IXFR;
+		u->msg[u->msg_len++] = 0;
+		u->msg[u->msg_len++] = LDNS_RR_CLASS_IN;
+	}
+}
+
+/* Add a record in wire format to the answer section of the IXFR response */
+static int zd_ixfr_put(zd_update* u, const uint8_t* wire, const size_t len)
+{
+	if (u->msg_len == 0)
+	{
+		zd_ixfr_start_msg(u);
+	}
+
+	if (u->msg_len + len > ZD_IXFR_MAX_MSG)
+	{
+		if (u->rr_count == 0) return EMSGSIZE;
+
+		zd_ixfr_end_msg(u);
+		zd_ixfr_start_msg(u);
+
+		if (u->msg_len + len > ZD_IXFR_MAX_MSG) return EMSGSIZE;
+	}
+
+	memcpy(&u->msg[u->msg_len], wire, len);
+
+	u->msg_len += len;
+	u->rr_count++;
+
+	return 0;
+}
+
+/* Add a record to the answer section of the IXFR response */
+static int zd_ixfr_put_rr(zd_update* u, const ldns_rr* rr)
+{
+	int	rv	= 0;
+
+	if ((rv = zd_update_wire(u, rr)) != 0) return rv;
+
+	return zd_ixfr_put(u, ldns_buffer_begin(u->scratch), ldns_buffer_position(u->scratch));
+}
+
+/* Keep an added record in wire format until all deletions are written */
+static int zd_ixfr_keep(zd_update* u, const ldns_rr* rr)
+{
+	int	rv	= 0;
+	size_t	len	= 0;
+
+	if ((rv = zd_update_wire(u, rr)) != 0) return rv;
+
+	len = ldns_buffer_position(u->scratch);
+
+	if (u->adds_fd != NULL)
+	{
+		const uint8_t	len16[2]	= { (uint8_t) (len >> 8), (uint8_t) len };
+
+		if ((fwrite(len16, 2, 1, u->adds_fd) != 1) || (fwrite(ldns_buffer_begin(u->scratch), len, 1, u->adds_fd) != 1))
+		{
+			fprintf(stderr, "Failed to write IXFR additions to disk\n");
+
+			return EIO;
+		}
+
+		return 0;
+	}
+
+	if (!ldns_buffer_reserve(u->adds, 2 + len)) return ENOMEM;
+
+	ldns_buffer_write_u16(u->adds, (uint16_t) len);
+	ldns_buffer_write(u->adds, ldns_buffer_begin(u->scratch), len);
+
+	return 0;
+}
+
+/* Start an UPDATE message in the nsupdate script */
+static void zd_nsupdate_start(zd_update* u)
+{
+	zd_out_printf(u->out, "zone %s\n", u->zone_name);
+
+	u->msg_len = ZD_UPDATE_HEADER_SIZE + ldns_rdf_size(ldns_rr_owner(u->old_soa)) + 4;
+	u->rr_count = 0;
+}
+
+/* Send the current UPDATE message in the nsupdate script */
+static void zd_nsupdate_send(zd_update* u)
+{
+	zd_out_bytes(u->out, "send\n", 5);
+
+	u->msg_len = 0;
+	u->msg_count++;
+}
+
+/* Write an "update add" or "update delete" line for a record */
+static void zd_nsupdate_rr(zd_update* u, const ldns_rr* rr, const int remove)
+{
+	zd_out_bytes(u->out, remove ? "update delete " : "update add ", remove ? 14 : 11);
+	zd_out_rr_str(u->out, rr);
+	zd_out_bytes(u->out, "\n", 1);
+
+	u->rr_count++;
+}
+
+/*
+ * Start writing changes. An IXFR response opens with the new SOA and the
+ * old SOA, which starts the deletions (RFC 1995, section 4); an nsupdate
+ * script sends a changed SOA first
+ */
+static int zd_update_begin(zd_update* u)
+{
+	uint32_t	old_serial	= ldns_rdf2native_int32(ldns_rr_rdf(u->old_soa, 2));
+	ldns_rdf*	serial		= NULL;
+	int		rv		= 0;
+
+	u->started = 1;
+
+	if (u->format == ZD_OUT_NSUPDATE)
+	{
+		zd_nsupdate_start(u);
+
+		if (u->soa_changed)
+		{
+			if ((rv = zd_update_wire(u, u->new_soa)) != 0) return rv;
+
+			zd_nsupdate_rr(u, u->new_soa, 0);
+
+			u->msg_len += ldns_buffer_position(u->scratch);
+		}
+
+		return 0;
+	}
+
+	/* Changes that leave the SOA as it is still need a newer serial */
+	if (!u->soa_changed && (ldns_rdf2native_int32(ldns_rr_rdf(u->new_soa, 2)) <= old_serial))
+	{
+		if ((serial = ldns_native2rdf_int32(LDNS_RDF_TYPE_INT32, old_serial + 1)) == NULL) return ENOMEM;
+
+		ldns_rdf_deep_free(ldns_rr_set_rdf(u->new_soa, serial, 2));
+	}
+
+	if (((rv = zd_ixfr_put_rr(u, u->new_soa)) != 0) ||
+	    ((rv = zd_ixfr_put_rr(u, u->old_soa)) != 0))
+	{
+		return rv;
+	}
+
+	return 0;
+}
+
+/* Write a difference, as reported by zd_diff_zones() */
+int zd_update_change(zd_update* u, const int change, const ldns_rr* old_rr, const ldns_rr* new_rr)
+{
+	assert(u != NULL);
+
+	size_t	size	= 0;
+	int	rv	= 0;
+
+	/* The SOA is reported before any other change, and frames the others */
+	if (change == ZD_CHANGE_SOA)
+	{
+		ldns_rr*	new_soa	= ldns_rr_clone(new_rr);
+
+		if (u->started) return EINVAL;
+
+		if (new_soa == NULL) return ENOMEM;
+
+		ldns_rr_free(u->new_soa);
+
+		u->new_soa = new_soa;
+		u->soa_changed = 1;
+
+		return 0;
+	}
+
+	if (!u->started && ((rv = zd_update_begin(u)) != 0))
+	{
+		return rv;
+	}
+
+	if (u->format == ZD_OUT_IXFR)
+	{
+		if ((old_rr != NULL) && ((rv = zd_ixfr_put_rr(u, old_rr)) != 0)) return rv;
+		if ((new_rr != NULL) && ((rv = zd_ixfr_keep(u, new_rr)) != 0)) return rv;
+
+		return 0;
+	}
+
+	/* Both halves of a TTL change go into the same UPDATE message */
+	if (old_rr != NULL)
+	{
+		if ((rv = zd_update_wire(u, old_rr)) != 0) return rv;
+
+		size += ldns_buffer_position(u->scratch);
+	}
+
+	if (new_rr != NULL)
+	{
+		if ((rv = zd_update_wire(u, new_rr)) != 0) return rv;
+
+		size += ldns_buffer_position(u->scratch);
+	}
+
+	if ((u->rr_count > 0) && (u->msg_len + size > ZD_NSUPDATE_MAX_SIZE))
+	{
+		zd_nsupdate_send(u);
+		zd_nsupdate_start(u);
+	}
+
+	if (old_rr != NULL) zd_nsupdate_rr(u, old_rr, 1);
+	if (new_rr != NULL) zd_nsupdate_rr(u, new_rr, 0);
+
+	u->msg_len += size;
+
+	return 0;
+}
+
+/* Add the additions that were kept on disk to the IXFR response */
+static int zd_ixfr_put_spilled(zd_update* u)
+{
+	uint8_t	len16[2];
+	size_t	len	= 0;
+	int	rv	= 0;
+
+	if ((fflush(u->adds_fd) != 0) || (fseeko(u->adds_fd, 0, SEEK_SET) != 0))
+	{
+		fprintf(stderr, "Failed to read IXFR additions from disk\n");
+
+		return EIO;
+	}
+
+	while (fread(len16, 2, 1, u->adds_fd) == 1)
+	{
+		len = (len16[0] << 8) | len16[1];
+
+		ldns_buffer_clear(u->scratch);
+
+		if (!ldns_buffer_reserve(u->scratch, len)) return ENOMEM;
+
+		if (fread(ldns_buffer_begin(u->scratch), len, 1, u->adds_fd) != 1)
+		{
+			fprintf(stderr, "Failed to read IXFR additions from disk\n");
+
+			return EIO;
+		}
+
+		if ((rv = zd_ixfr_put(u, ldns_buffer_begin(u->scratch), len)) != 0)
+		{
+			return rv;
+		}
+	}
+
+	if (ferror(u->adds_fd))
+	{
+		fprintf(stderr, "Failed to read IXFR additions from disk\n");
+
+		return EIO;
+	}
+
+	return 0;
+}
+
+/* Write whatever is left once all differences are reported */
+int zd_update_finish(zd_update* u)
+{
+	assert(u != NULL);
+
+	const uint8_t*	adds	= NULL;
+	size_t		pos	= 0;
+	size_t		len	= 0;
+	int		rv	= 0;
+
+	if (!u->started)
+	{
+		/* Without any changes, an IXFR response is just the current SOA */
+		if (!u->soa_changed)
+		{
+			if (u->format != ZD_OUT_IXFR) return 0;
+
+			if ((rv = zd_ixfr_put_rr(u, u->new_soa)) == 0)
+			{
+				zd_ixfr_end_msg(u);
+			}
+
+			return rv;
+		}
+
+		if ((rv = zd_update_begin(u)) != 0)
+		{
+			return rv;
+		}
+	}
+
+	if (u->format == ZD_OUT_NSUPDATE)
+	{
+		zd_nsupdate_send(u);
+
+		return 0;
+	}
+
+	/* The new SOA ends the deletions and starts the additions, and ends
+	 * the response after them */
+	if ((rv = zd_ixfr_put_rr(u, u->new_soa)) != 0)
+	{
+		return rv;
+	}
+
+	if (u->adds_fd != NULL)
+	{
+		if ((rv = zd_ixfr_put_spilled(u)) != 0)
+		{
+			return rv;
+		}
+	}
+
+	adds = ldns_buffer_begin(u->adds);
+
+	while (pos < ldns_buffer_position(u->adds))
+	{
+		len = (adds[pos] << 8) | adds[pos + 1];
+
+		if ((rv = zd_ixfr_put(u, &adds[pos + 2], len)) != 0)
+		{
+			return rv;
+		}
+
+		pos += 2 + len;
+	}
+
+	if ((rv = zd_ixfr_put_rr(u, u->new_soa)) != 0)
+	{
+		return rv;
+	}
+
+	zd_ixfr_end_msg(u);
+
+	return 0;
+}
+
+/* Release a writer */
+void zd_update_free(zd_update* u)
+{
+	assert(u != NULL);
+
+	if (u->new_soa != NULL) ldns_rr_free(u->new_soa);
+	if (u->scratch != NULL) ldns_buffer_free(u->scratch);
+	if (u->adds != NULL) ldns_buffer_free(u->adds);
+	if (u->adds_fd != NULL) fclose(u->adds_fd);
+
+	free(u->msg);
+
+	memset(u, 0, sizeof(zd_update));
+}
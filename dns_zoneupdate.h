@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LDNS_ZONEDIFF_DNS_ZONEUPDATE_H
+#define _LDNS_ZONEDIFF_DNS_ZONEUPDATE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ldns/ldns.h>
+#include "dns_zoneout.h"
+
+/*
+ * Writer for differences in a form that secondaries can apply directly:
+ * IXFR response messages (ZD_OUT_IXFR) or nsupdate scripts
+ * (ZD_OUT_NSUPDATE). Changes are written as they are reported, except
+ * for IXFR additions, which must follow all deletions; these are kept in
+ * wire format until the end, in memory or, to keep memory use bounded,
+ * in a temporary file.
+ */
+typedef struct _zd_update
+{
+	zd_out*		out;
+	int		format;
+	const char*	zone_name;
+	const ldns_rr*	old_soa;
+	ldns_rr*	new_soa;
+	int		soa_changed;
+	int		started;
+	ldns_buffer*	scratch;
+	uint8_t*	msg;
+	size_t		msg_len;
+	unsigned int	rr_count;
+	unsigned int	msg_count;
+	ldns_buffer*	adds;
+	FILE*		adds_fd;
+}
+zd_update;
+
+/*
+ * Set up a writer for the differences from the left to the right zone;
+ * the SOA records must stay valid until the writer is freed. If spill is
+ * set, IXFR additions are kept on disk. Returns 0 on success.
+ */
+int zd_update_init(zd_update* update, zd_out* out, const int format, const char* zone_name, const ldns_rr* left_soa, const ldns_rr* right_soa, const int spill);
+
+/* Write a difference, as reported by zd_diff_zones(); returns 0 on success */
+int zd_update_change(zd_update* update, const int change, const ldns_rr* old_rr, const ldns_rr* new_rr);
+
+/* Write whatever is left once all differences are reported; returns 0 on success */
+int zd_update_finish(zd_update* update);
+
+/* Release a writer */
+void zd_update_free(zd_update* update);
+
+#endif /* !_LDNS_ZONEDIFF_DNS_ZONEUPDATE_H */
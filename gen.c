@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Generator for pairs of synthetic zones with a controlled amount of
+ * differences, for benchmarking and testing without real zone data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "dns_zonegen.h"
+
+void usage(void)
+{
+	printf("ldns-zonediff-gen\n");
+	printf("Copyright (C) 2018 SURFnet bv\n");
+	printf("All rights reserved (see LICENSE for more information)\n\n");
+	printf("Usage:\n");
+	printf("\tldns-zonediff-gen [-n <records>] [-t <shape>] [-a <pct>] [-r <pct>] [-T <pct>] [-b <bump>] [-s <seed>] [-o <origin>] <left-zone> <right-zone>\n");
+	printf("\tldns-zonediff-gen -h\n");
+	printf("\n");
+	printf("\tldns-zonediff-gen writes a synthetic zone to <left-zone>, and\n");
+	printf("\ta changed version of it to <right-zone>. The same arguments\n");
+	printf("\talways produce the same zones.\n");
+	printf("\n");
+	printf("Optional arguments:\n");
+	printf("\t-n   Write about <records> records (default: 100000)\n");
+	printf("\t-t   Shape of the zone (default: hosts):\n");
+	printf("\t       hosts  - A, AAAA, MX and TXT records per host\n");
+	printf("\t       tld    - delegations with glue and DS records\n");
+	printf("\t       rrsets - few owners with large A RRsets\n");
+	printf("\t       txt    - owners with long TXT records\n");
+	printf("\t       signed - hosts with RRSIG and NSEC3 records\n");
+	printf("\t-a   Percentage of records added to the right zone\n");
+	printf("\t-r   Percentage of records removed from the right zone\n");
+	printf("\t-T   Percentage of records with a different TTL in\n");
+	printf("\t     the right zone\n");
+	printf("\t-b   Add <bump> to the SOA serial of the right zone,\n");
+	printf("\t     which may be zero or negative (default: 1)\n");
+	printf("\t-s   Seed for the generator (default: 0)\n");
+	printf("\t-o   Origin of the zones (default: example.)\n");
+	printf("\t-h   Print this help message\n");
+}
+
+/* Parse a percentage with up to two decimals; returns hundredths or -1 if invalid */
+static int parse_ratio(const char* str)
+{
+	char*	end	= NULL;
+	double	pct	= strtod(str, &end);
+
+	if ((end == str) || (*end != '\0') || (pct < 0) || (pct > 100)) return -1;
+
+	return (int) (pct * 100 + 0.5);
+}
+
+int main(int argc, char* argv[])
+{
+	zd_gen_opts	opts		= { 0 };
+	char*		origin		= NULL;
+	char*		end		= NULL;
+	FILE*		left		= NULL;
+	FILE*		right		= NULL;
+	int		c		= 0;
+	int		rv		= 0;
+
+	opts.shape = ZD_GEN_HOSTS;
+	opts.records = 100000;
+	opts.serial_bump = 1;
+
+	while ((c = getopt(argc, argv, "n:t:a:r:T:b:s:o:h")) != -1)
+	{
+		switch(c)
+		{
+		case 'n':
+			opts.records = strtoul(optarg, &end, 10);
+
+			if ((end == optarg) || (*end != '\0'))
+			{
+				fprintf(stderr, "Invalid number of records specified\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 't':
+			opts.shape = zd_gen_shape_by_name(optarg);
+
+			if (opts.shape < 0)
+			{
+				fprintf(stderr, "Unknown zone shape %s\n", optarg);
+				usage();
+				exit(1);
+			}
+			break;
+		case 'a':
+		case 'r':
+		case 'T':
+			rv = parse_ratio(optarg);
+
+			if (rv < 0)
+			{
+				fprintf(stderr, "Invalid percentage specified\n");
+				usage();
+				exit(1);
+			}
+
+			if (c == 'a') opts.add_ratio = rv;
+			if (c == 'r') opts.del_ratio = rv;
+			if (c == 'T') opts.ttl_ratio = rv;
+
+			rv = 0;
+			break;
+		case 'b':
+			opts.serial_bump = (int32_t) strtol(optarg, &end, 10);
+
+			if ((end == optarg) || (*end != '\0'))
+			{
+				fprintf(stderr, "Invalid serial bump specified\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 's':
+			opts.seed = strtoull(optarg, &end, 10);
+
+			if ((end == optarg) || (*end != '\0'))
+			{
+				fprintf(stderr, "Invalid seed specified\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 'o':
+			if (origin != NULL) free(origin);
+
+			/* The origin must be absolute */
+			origin = (char*) malloc(strlen(optarg) + 2);
+
+			if (origin == NULL)
+			{
+				fprintf(stderr, "Memory allocation error\n");
+				exit(1);
+			}
+
+			strcpy(origin, optarg);
+
+			if ((strlen(origin) == 0) || (origin[strlen(origin) - 1] != '.')) strcat(origin, ".");
+			break;
+		case 'h':
+		default:
+			usage();
+			return 0;
+		}
+	}
+
+	if ((argc - optind) != 2)
+	{
+		fprintf(stderr, "Missing zone file arguments\n");
+		usage();
+		return 1;
+	}
+
+	if (opts.del_ratio + opts.ttl_ratio > 10000)
+	{
+		fprintf(stderr, "More than 100%% of the records would be removed or changed\n");
+		return 1;
+	}
+
+	opts.origin = (origin != NULL) ? origin : "example.";
+
+	if ((left = fopen(argv[optind], "w")) == NULL)
+	{
+		fprintf(stderr, "Failed to create %s\n", argv[optind]);
+		rv = 1;
+	}
+	else if ((right = fopen(argv[optind + 1], "w")) == NULL)
+	{
+		fprintf(stderr, "Failed to create %s\n", argv[optind + 1]);
+		rv = 1;
+	}
+	else if (zd_gen_zones(&opts, left, right) != 0)
+	{
+		fprintf(stderr, "Failed to write the zone files\n");
+		rv = 1;
+	}
+
+	if ((left != NULL) && (fclose(left) != 0)) rv = 1;
+	if ((right != NULL) && (fclose(right) != 0)) rv = 1;
+
+	free(origin);
+
+	return rv;
+}
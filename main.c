@@ -30,6 +30,7 @@
  
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -39,6 +40,54 @@
 #include <openssl/engine.h>
 #include <openssl/conf.h>
 #include "dns_zonediff.h"
+#include "dns_zonehash.h"
+#include "dns_zonestats.h"
+#include "dns_zonebatch.h"
+#include "dns_zoneout.h"
+
+/* Parse a size in bytes with an optional K, M or G suffix; returns 0 if invalid */
+static size_t parse_size(const char* str)
+{
+	char*			end	= NULL;
+	unsigned long long	size	= 0;
+	int			shifts	= 0;
+
+	/* strtoull() would skip white space and accept a sign */
+	if ((*str < '0') || (*str > '9')) return 0;
+
+	errno = 0;
+	size = strtoull(str, &end, 10);
+
+	if (errno == ERANGE) return 0;
+
+	switch(*end)
+	{
+	case 'G':
+	case 'g':
+		shifts = 3;
+		end++;
+		break;
+	case 'M':
+	case 'm':
+		shifts = 2;
+		end++;
+		break;
+	case 'K':
+	case 'k':
+		shifts = 1;
+		end++;
+		break;
+	}
+
+	for (; shifts > 0; shifts--)
+	{
+		if (size > SIZE_MAX / 1024) return 0;
+
+		size *= 1024;
+	}
+
+	return ((*end == '\0') && (size <= SIZE_MAX)) ? (size_t) size : 0;
+}
 
 void usage(void)
 {
@@ -46,13 +95,15 @@ void usage(void)
 	printf("Copyright (C) 2018 SURFnet bv\n");
 	printf("All rights reserved (see LICENSE for more information)\n\n");
 	printf("Usage:\n");
-	printf("\tldns-zonediff [-S] [-K] [-N] [-d] [-k] [-k] [-o <origin>] <left-zone> <right-zone>\n");
+	printf("\tldns-zonediff [-S] [-K] [-N] [-d] [-k] [-k] [-f <format>] [-j <threads>] [-H <hash>] [-R] [-L] [-A] [-c] [-m <size>] [-x] [-t <format>] [-q] [-Z] [-o <origin>] <left-zone> <right-zone>\n");
+	printf("\tldns-zonediff [options] -b <manifest> [-O <dir>] [-p <workers>]\n");
 	printf("\tldns-zonediff -h\n");
 	printf("\n");
 	printf("\tldns-zonediff will output the differences between <left-zone> and\n");
 	printf("\t<right-zone> and will output textual DNS records that are only in\n");
 	printf("\t<left-zone> prepended by '--', and will output textual DNS records\n");
 	printf("\tthat are only in <right-zone> prepend by '++'.\n");
+	printf("\tZone files may be compressed with gzip, xz or zstd.\n");
 	printf("\n");
 	printf("Optional arguments:\n");
 	printf("\t-o   Set the zone origin explicitly, for zone files\n");
@@ -64,6 +115,49 @@ void usage(void)
 	printf("\t-s   Suppress SOA serial number differences\n");
 	printf("\t-k   Output knotc commands for insertion/removal\n");
 	printf("\t     of records; twice to embed in contextual transaction\n");
+	printf("\t-f   Write the differences in <format>: text (default),\n");
+	printf("\t     ixfr for IXFR response messages (RFC 1995), each\n");
+	printf("\t     preceded by its length in two bytes, nsupdate\n");
+	printf("\t     for an nsupdate script, json for one JSON object\n");
+	printf("\t     per changed record on each line, or binary for\n");
+	printf("\t     length-prefixed records (see dns_zoneout.h); not\n");
+	printf("\t     with -k\n");
+	printf("\t-j   Parse each zone file with <threads> threads\n");
+	printf("\t     in parallel (default: 1)\n");
+	printf("\t-H   Fingerprint records using <hash>, either fp128\n");
+	printf("\t     (fast, default) or sha256\n");
+	printf("\t-R   Fingerprint whole RRsets and only compare the\n");
+	printf("\t     records of RRsets that changed; not with -c or -m\n");
+	printf("\t-L   Parse zone files with ldns only, instead of\n");
+	printf("\t     the built-in tokenizer for common record types\n");
+	printf("\t-A   Both zones are AXFR data: DNS messages, each\n");
+	printf("\t     preceded by its length in two bytes, as dumped\n");
+	printf("\t     by a secondary; a zone of - is read from stdin\n");
+	printf("\t-c   Both zones are in DNSSEC canonical order (e.g. from\n");
+	printf("\t     ldns-read-zone -s); compare them while reading,\n");
+	printf("\t     without loading them into memory\n");
+	printf("\t-m   Use at most <size> bytes of memory for zone data,\n");
+	printf("\t     spilling sorted runs to $TMPDIR beyond that; the\n");
+	printf("\t     size may end in K, M or G (minimum: 1M)\n");
+	printf("\t-x   Keep a binary index of each zone file in\n");
+	printf("\t     <zone-file>.zdx and load from it while the\n");
+	printf("\t     zone file is unchanged\n");
+	printf("\t-t   Write runtime statistics to stderr, with <format>\n");
+	printf("\t     either text or json\n");
+	printf("\t-q   Print nothing and stop at the first difference;\n");
+	printf("\t     only the exit code tells if the zones differ\n");
+	printf("\t-Z   Compute the SIMPLE/SHA384 digest of each zone and\n");
+	printf("\t     check it against its ZONEMD record (RFC 8976);\n");
+	printf("\t     not with -c, -m or -x\n");
+	printf("\t-b   Compare every pair of zones listed in <manifest>,\n");
+	printf("\t     one \"<left-zone> <right-zone> [<origin>]\" per line;\n");
+	printf("\t     the exit code and zone files of each pair are\n");
+	printf("\t     reported on a line of their own\n");
+	printf("\t-O   With -b, write the differences of each pair to\n");
+	printf("\t     <dir>/<origin>.diff (or the right zone's file name)\n");
+	printf("\t     instead of stdout\n");
+	printf("\t-p   With -b, compare <workers> pairs at the same\n");
+	printf("\t     time (default: 1)\n");
 	printf("\n");
 	printf("\t-h   Print this help message\n");
 }
@@ -84,38 +178,128 @@ int main(int argc, char* argv[])
 	char*	left_zone		= NULL;
 	char*	right_zone		= NULL;
 	char*	origin			= NULL;
+	char*	manifest		= NULL;
+	char*	out_dir			= NULL;
+	int	workers			= 1;
 	int	c			= 0;
-	int	include_sigs		= 0;
-	int	include_keys		= 0;
-	int	include_nsecs		= 0;
-	int	include_delegs		= 1;
-	int	include_serial		= 1;
-	int	output_knotc_commands	= 0;
+	zd_opts	opts			= { 0 };
 	int	rv			= 0;
 	int	diffcount		= 0;
+
+	opts.include_delegs = 1;
+	opts.include_serial = 1;
+	opts.threads = 1;
+	opts.hash_alg = ZD_HASH_FP128;
 	
-	while ((c = getopt(argc, argv, "-SKNdsko:h")) != -1)
+	while ((c = getopt(argc, argv, "-SKNdskf:j:H:RLAcm:xt:qZb:O:p:o:h")) != -1)
 	{
 		switch(c)
 		{
 		case 'S':
-			include_sigs = 1;
+			opts.include_sigs = 1;
 			break;
 		case 'K':
-			include_keys = 1;
+			opts.include_keys = 1;
 			break;
 		case 'N':
-			include_nsecs = 1;
+			opts.include_nsecs = 1;
 			break;
 		case 'd':
-			include_delegs = 0;
+			opts.include_delegs = 0;
 			break;
 		case 's':
-			include_serial = 0;
+			opts.include_serial = 0;
 			break;
 		case 'k':
 			// May be used twice; second form suppresses zone-begin, -commit
-			output_knotc_commands++;
+			opts.output_knotc_commands++;
+			break;
+		case 'f':
+			opts.output_format = zd_out_format_by_name(optarg);
+
+			if (opts.output_format < 0)
+			{
+				fprintf(stderr, "Unknown output format %s\n", optarg);
+				usage();
+				exit(1);
+			}
+			break;
+		case 'j':
+			opts.threads = atoi(optarg);
+
+			if (opts.threads < 1)
+			{
+				fprintf(stderr, "Invalid number of threads specified\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 'H':
+			opts.hash_alg = zd_hash_by_name(optarg);
+
+			if (opts.hash_alg < 0)
+			{
+				fprintf(stderr, "Unknown fingerprint algorithm %s\n", optarg);
+				usage();
+				exit(1);
+			}
+			break;
+		case 'R':
+			opts.rrsets = 1;
+			break;
+		case 'L':
+			opts.ldns_parser = 1;
+			break;
+		case 'A':
+			opts.axfr_input = 1;
+			break;
+		case 'c':
+			opts.sorted_input = 1;
+			break;
+		case 'm':
+			opts.max_memory = parse_size(optarg);
+
+			if (opts.max_memory < 1024 * 1024)
+			{
+				fprintf(stderr, "Invalid memory limit specified\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 'x':
+			opts.use_index = 1;
+			break;
+		case 't':
+			opts.stats = zd_stats_by_name(optarg);
+
+			if (opts.stats < 0)
+			{
+				fprintf(stderr, "Unknown statistics format %s\n", optarg);
+				usage();
+				exit(1);
+			}
+			break;
+		case 'q':
+			opts.quiet = 1;
+			break;
+		case 'Z':
+			opts.zonemd = 1;
+			break;
+		case 'b':
+			manifest = strdup(optarg);
+			break;
+		case 'O':
+			out_dir = strdup(optarg);
+			break;
+		case 'p':
+			workers = atoi(optarg);
+
+			if (workers < 1)
+			{
+				fprintf(stderr, "Invalid number of workers specified\n");
+				usage();
+				exit(1);
+			}
 			break;
 		case 'o':
 			origin = strdup(optarg);
@@ -143,6 +327,76 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	/* RRsets are grouped after loading the entire zone into memory */
+	if (opts.rrsets && (opts.sorted_input || (opts.max_memory > 0)))
+	{
+		fprintf(stderr, "RRset fingerprints (-R) cannot be combined with -c or -m\n");
+
+		usage();
+
+		return EINVAL;
+	}
+
+	/* Zone digests cover records that are neither streamed nor indexed */
+	if (opts.zonemd && (opts.sorted_input || (opts.max_memory > 0) || opts.use_index))
+	{
+		fprintf(stderr, "Zone digests (-Z) cannot be combined with -c, -m or -x\n");
+
+		usage();
+
+		return EINVAL;
+	}
+
+	if (opts.output_knotc_commands && (opts.output_format != ZD_OUT_TEXT))
+	{
+		fprintf(stderr, "Knot commands (-k) can only be written as text\n");
+
+		usage();
+
+		return EINVAL;
+	}
+
+	/* AXFR data is in no particular order, and stdin can only be read once */
+	if (opts.axfr_input && opts.sorted_input)
+	{
+		fprintf(stderr, "AXFR input (-A) cannot be combined with -c\n");
+
+		usage();
+
+		return EINVAL;
+	}
+
+	if (opts.axfr_input && (left_zone != NULL) && (right_zone != NULL) && (strcmp(left_zone, "-") == 0) && (strcmp(right_zone, "-") == 0))
+	{
+		fprintf(stderr, "Only one zone can be read from stdin\n");
+
+		usage();
+
+		return EINVAL;
+	}
+
+	/* Compare a batch of zone pairs in one process */
+	if (manifest != NULL)
+	{
+		if ((left_zone != NULL) || (origin != NULL))
+		{
+			fprintf(stderr, "Zone files and origins are taken from the manifest in batch mode\n");
+
+			usage();
+
+			return EINVAL;
+		}
+
+		rv = zd_batch(manifest, &opts, out_dir, workers);
+
+		cleanup_openssl();
+
+		free(manifest);
+		free(out_dir);
+
+		return rv;
+	}
+
 	/* Check arguments */
 	if ((left_zone == NULL) || (right_zone == NULL))
 	{
@@ -154,7 +408,9 @@ int main(int argc, char* argv[])
 	}
 
 	/* Perform the comparision */
-	rv = do_zonediff(left_zone, right_zone, origin, include_sigs, include_keys, include_nsecs, include_delegs, include_serial, output_knotc_commands, &diffcount);
+	opts.origin = origin;
+
+	rv = do_zonediff(left_zone, right_zone, &opts, &diffcount);
 
 	cleanup_openssl();
 
@@ -0,0 +1,659 @@
+/*
+ * Copyright (c) 2018 SURFnet bv
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * - Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Resident mode; keeps every watched zone loaded and, whenever one of the
+ * zone files is rewritten, loads only the new version and writes the
+ * differences with the version it has in memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <ldns/ldns.h>
+#include "dns_zonediff.h"
+#include "dns_zonehash.h"
+#include "dns_zoneout.h"
+
+/* Most clients that can be connected to the socket at the same time */
+#define ZD_WATCH_MAX_CLIENTS	16
+
+/* How long a client may take to make room for more output, in milliseconds */
+#define ZD_WATCH_SEND_TIMEOUT	1000
+
+/* A zone file that is watched, with the version that was loaded last */
+typedef struct _zd_watch_zone
+{
+	char*		zone_file;
+	char*		dir;
+	char*		base;
+	int		wd;
+	zd_zone*	zone;
+}
+zd_watch_zone;
+
+/* Where the differences go */
+typedef struct _zd_watch_out
+{
+	const char*	out_dir;
+	int		listen_fd;
+	int		clients[ZD_WATCH_MAX_CLIENTS];
+	int		client_count;
+}
+zd_watch_out;
+
+/* Where zd_watch_change() writes the differences */
+typedef struct _zd_watch_ctx
+{
+	zd_out*		out;
+	const char*	zone_name;
+	int		output_knotc_commands;
+	int		diffcount;
+}
+zd_watch_ctx;
+
+static volatile sig_atomic_t	zd_watch_stop	= 0;
+
+void usage(void)
+{
+	printf("ldns-zonediff-watch\n");
+	printf("Copyright (C) 2018 SURFnet bv\n");
+	printf("All rights reserved (see LICENSE for more information)\n\n");
+	printf("Usage:\n");
+	printf("\tldns-zonediff-watch [-S] [-K] [-N] [-d] [-s] [-k] [-k] [-j <threads>] [-H <hash>] [-R] [-L] [-o <origin>] [-O <dir>] [-U <socket>] <zone> ...\n");
+	printf("\tldns-zonediff-watch -h\n");
+	printf("\n");
+	printf("\tldns-zonediff-watch keeps each <zone> loaded and waits for the\n");
+	printf("\tzone files to be rewritten. It then loads the new version and\n");
+	printf("\twrites the differences with the previous version in the same\n");
+	printf("\tformat as ldns-zonediff.\n");
+	printf("\n");
+	printf("Optional arguments:\n");
+	printf("\t-S, -K, -N, -d, -s, -k, -j, -H, -R, -L and -o are the same as\n");
+	printf("\tfor ldns-zonediff\n");
+	printf("\t-O   Write the differences for each new version to\n");
+	printf("\t     <dir>/<zone-file>.<serial>.diff, or to\n");
+	printf("\t     <dir>/<zone-file>.<serial>.<n>.diff for the n-th\n");
+	printf("\t     new version with the same serial\n");
+	printf("\t-U   Listen on UNIX socket <socket> and send the differences\n");
+	printf("\t     to every connected client, each followed by a line\n");
+	printf("\t     \"; End of differences in <zone-file>\"; clients\n");
+	printf("\t     that stop reading are disconnected\n");
+	printf("\t-h   Print this help message\n");
+}
+
+static void zd_watch_signal(int sig)
+{
+	(void) sig;
+
+	zd_watch_stop = 1;
+}
+
+/* Write a difference in the output format */
+static int zd_watch_change(const int change, const ldns_rr* old_rr, const ldns_rr* new_rr, void* arg)
+{
+	zd_watch_ctx*	ctx	= (zd_watch_ctx*) arg;
+
+	if (old_rr != NULL) zd_out_rr(ctx->out, ctx->zone_name, old_rr, 1, ctx->output_knotc_commands);
+	if (new_rr != NULL) zd_out_rr(ctx->out, ctx->zone_name, new_rr, 0, ctx->output_knotc_commands);
+
+	ctx->diffcount += zd_change_diffcount(change, old_rr, new_rr);
+
+	return 0;
+}
+
+/*
+ * Copy a file to a socket client; returns 0 on success. Clients do not
+ * block, so one that stops reading only holds up the others for as long
+ * as ZD_WATCH_SEND_TIMEOUT before it is given up on.
+ */
+static int zd_watch_send(const int fd, const int client)
+{
+	char	buf[65536];
+	ssize_t	len	= 0;
+
+	if (lseek(fd, 0, SEEK_SET) != 0) return errno;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+	{
+		char*	p	= buf;
+
+		while (len > 0)
+		{
+			ssize_t	written	= write(client, p, len);
+
+			if (written < 0)
+			{
+				struct pollfd	pfd	= { client, POLLOUT, 0 };
+				int		ready	= 0;
+
+				if (errno == EINTR) continue;
+
+				if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) return errno;
+
+				/* Wait a while for the client to read some of its output */
+				while (((ready = poll(&pfd, 1, ZD_WATCH_SEND_TIMEOUT)) < 0) && (errno == EINTR));
+
+				if (ready <= 0)
+				{
+					fprintf(stderr, "Dropping a client that stopped reading\n");
+
+					return EAGAIN;
+				}
+
+				continue;
+			}
+
+			p += written;
+			len -= written;
+		}
+	}
+
+	return (len < 0) ? errno : 0;
+}
+
+/*
+ * Compare the new version of a zone with the one in memory and write the
+ * differences to a temporary file, which is then moved into the output
+ * directory and sent to the socket clients
+ */
+static int zd_watch_diff(zd_watch_zone* wz, zd_zone* zone, const zd_opts* opts, zd_watch_out* wo)
+{
+	zd_out		out		= { 0 };
+	zd_watch_ctx	ctx		= { 0 };
+	char		tmp_name[PATH_MAX];
+	char		out_name[PATH_MAX];
+	char		serial[16]	= "0";
+	const char*	tmp_dir		= (wo->out_dir != NULL) ? wo->out_dir : getenv("TMPDIR");
+	int		fd		= -1;
+	int		rv		= 0;
+	int		i		= 0;
+	unsigned int	seq		= 0;
+
+	if (tmp_dir == NULL) tmp_dir = "/tmp";
+
+	snprintf(tmp_name, sizeof(tmp_name), "%s/.%s.XXXXXX", tmp_dir, wz->base);
+
+	if ((fd = mkstemp(tmp_name)) < 0)
+	{
+		rv = errno;
+
+		fprintf(stderr, "Failed to create a temporary file in %s\n", tmp_dir);
+
+		return rv;
+	}
+
+	if ((rv = zd_out_init(&out, fd)) != 0)
+	{
+		goto cleanup;
+	}
+
+	ctx.out = &out;
+	ctx.zone_name = zd_zone_name(wz->zone);
+	ctx.output_knotc_commands = opts->output_knotc_commands;
+
+	if (ctx.zone_name == NULL)
+	{
+		fprintf(stderr, "Failed to determine domain name of %s from zone or explicit origin.\n", wz->zone_file);
+
+		rv = EINVAL;
+		goto cleanup;
+	}
+
+	if (ctx.output_knotc_commands == 1)
+	{
+		zd_out_printf(&out, "zone-begin %s\n", ctx.zone_name);
+	}
+
+	if ((rv = zd_diff_zones(wz->zone, zone, opts, zd_watch_change, &ctx)) != 0)
+	{
+		goto cleanup;
+	}
+
+	if (ctx.output_knotc_commands == 1)
+	{
+		zd_out_printf(&out, "zone-commit %s\n", ctx.zone_name);
+	}
+
+	if (wo->listen_fd >= 0)
+	{
+		zd_out_printf(&out, "; End of differences in %s\n", wz->zone_file);
+	}
+
+	if ((rv = zd_out_free(&out)) != 0)
+	{
+		fprintf(stderr, "Failed to write the differences in %s\n", wz->zone_file);
+
+		goto cleanup;
+	}
+
+	if (wo->out_dir != NULL)
+	{
+		snprintf(serial, sizeof(serial), "%u", ldns_rdf2native_int32(ldns_rr_rdf(zd_zone_soa(zone), 2)));
+		snprintf(out_name, sizeof(out_name), "%s/%s.%s.diff", wo->out_dir, wz->base, serial);
+
+		if (fsync(fd) != 0)
+		{
+			rv = errno;
+
+			fprintf(stderr, "Failed to write %s\n", out_name);
+
+			goto cleanup;
+		}
+
+		/*
+		 * A zone can be rewritten without a new serial; link() never
+		 * replaces an earlier version, which then gets a sequence number
+		 */
+		for (seq = 1; link(tmp_name, out_name) != 0; seq++)
+		{
+			if (errno != EEXIST)
+			{
+				rv = errno;
+
+				fprintf(stderr, "Failed to write %s\n", out_name);
+
+				goto cleanup;
+			}
+
+			snprintf(out_name, sizeof(out_name), "%s/%s.%s.%u.diff", wo->out_dir, wz->base, serial, seq);
+		}
+
+		unlink(tmp_name);
+		tmp_name[0] = '\0';
+
+		fprintf(stderr, "Wrote %d differences in %s to %s\n", ctx.diffcount, wz->zone_file, out_name);
+	}
+
+	/*
+	 * Clients only get differences that made it to the output directory,
+	 * if any; those that can no longer be written to are dropped
+	 */
+	for (i = 0; i < wo->client_count; i++)
+	{
+		if (zd_watch_send(fd, wo->clients[i]) != 0)
+		{
+			close(wo->clients[i]);
+
+			wo->clients[i--] = wo->clients[--wo->client_count];
+		}
+	}
+
+cleanup:
+	zd_out_free(&out);
+	close(fd);
+
+	if (tmp_name[0] != '\0') unlink(tmp_name);
+
+	return rv;
+}
+
+/* Load the new version of a zone and replace the one in memory with it */
+static void zd_watch_reload(zd_watch_zone* wz, const zd_opts* opts, zd_watch_out* wo)
+{
+	zd_zone*	zone	= NULL;
+
+	if (zd_zone_load(wz->zone_file, opts, &zone) != 0)
+	{
+		fprintf(stderr, "Failed to load %s, keeping the previous version\n", wz->zone_file);
+
+		return;
+	}
+
+	if (zd_zone_soa(zone) == NULL)
+	{
+		fprintf(stderr, "Zone file %s does not have a valid SOA record, keeping the previous version\n", wz->zone_file);
+
+		zd_zone_free(zone);
+
+		return;
+	}
+
+	/*
+	 * Differences that were not delivered must not be lost, so the next
+	 * version is compared with the last one that was delivered
+	 */
+	if (zd_watch_diff(wz, zone, opts, wo) != 0)
+	{
+		fprintf(stderr, "Failed to compare %s with its previous version, keeping the previous version\n", wz->zone_file);
+
+		zd_zone_free(zone);
+
+		return;
+	}
+
+	zd_zone_free(wz->zone);
+	wz->zone = zone;
+}
+
+/* Open the UNIX socket clients connect to */
+static int zd_watch_listen(const char* path)
+{
+	struct sockaddr_un	addr;
+	int			fd	= -1;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Socket path %s is too long\n", path);
+
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+
+	if (((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) ||
+	    (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) ||
+	    (listen(fd, ZD_WATCH_MAX_CLIENTS) != 0))
+	{
+		fprintf(stderr, "Failed to listen on %s (%s)\n", path, strerror(errno));
+
+		if (fd >= 0) close(fd);
+
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Handle the events read from inotify */
+static void zd_watch_events(const int in_fd, zd_watch_zone* zones, const int zone_count, const zd_opts* opts, zd_watch_out* wo)
+{
+	char				buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event*	ev	= NULL;
+	ssize_t				len	= 0;
+	char*				p	= NULL;
+	int				i	= 0;
+
+	while ((len = read(in_fd, buf, sizeof(buf))) > 0)
+	{
+		for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len)
+		{
+			ev = (const struct inotify_event*) p;
+
+			if (ev->len == 0) continue;
+
+			for (i = 0; i < zone_count; i++)
+			{
+				if ((zones[i].wd == ev->wd) && (strcmp(zones[i].base, ev->name) == 0))
+				{
+					zd_watch_reload(&zones[i], opts, wo);
+				}
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	zd_opts		opts		= { 0 };
+	zd_watch_out	wo		= { 0 };
+	zd_watch_zone*	zones		= NULL;
+	int		zone_count	= 0;
+	const char*	socket_path	= NULL;
+	struct pollfd	fds[2];
+	int		in_fd		= -1;
+	int		c		= 0;
+	int		i		= 0;
+	int		rv		= 0;
+
+	opts.include_delegs = 1;
+	opts.include_serial = 1;
+	opts.threads = 1;
+	opts.hash_alg = ZD_HASH_FP128;
+
+	wo.listen_fd = -1;
+
+	while ((c = getopt(argc, argv, "SKNdskj:H:RLo:O:U:h")) != -1)
+	{
+		switch(c)
+		{
+		case 'S':
+			opts.include_sigs = 1;
+			break;
+		case 'K':
+			opts.include_keys = 1;
+			break;
+		case 'N':
+			opts.include_nsecs = 1;
+			break;
+		case 'd':
+			opts.include_delegs = 0;
+			break;
+		case 's':
+			opts.include_serial = 0;
+			break;
+		case 'k':
+			opts.output_knotc_commands++;
+			break;
+		case 'j':
+			opts.threads = atoi(optarg);
+
+			if (opts.threads < 1)
+			{
+				fprintf(stderr, "Invalid number of threads specified\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 'H':
+			opts.hash_alg = zd_hash_by_name(optarg);
+
+			if (opts.hash_alg < 0)
+			{
+				fprintf(stderr, "Unknown fingerprint algorithm %s\n", optarg);
+				usage();
+				exit(1);
+			}
+			break;
+		case 'R':
+			opts.rrsets = 1;
+			break;
+		case 'L':
+			opts.ldns_parser = 1;
+			break;
+		case 'o':
+			opts.origin = optarg;
+			break;
+		case 'O':
+			wo.out_dir = optarg;
+			break;
+		case 'U':
+			socket_path = optarg;
+			break;
+		case 'h':
+		default:
+			usage();
+			return 0;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		fprintf(stderr, "You must specify at least one zone file to watch\n");
+		usage();
+		return 1;
+	}
+
+	if ((wo.out_dir == NULL) && (socket_path == NULL))
+	{
+		fprintf(stderr, "You must specify an output directory, a socket or both\n");
+		usage();
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, zd_watch_signal);
+	signal(SIGTERM, zd_watch_signal);
+
+	if ((socket_path != NULL) && ((wo.listen_fd = zd_watch_listen(socket_path)) < 0))
+	{
+		return 1;
+	}
+
+	if ((in_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+	{
+		fprintf(stderr, "Failed to initialise inotify (%s)\n", strerror(errno));
+
+		rv = 1;
+		goto cleanup;
+	}
+
+	zone_count = argc - optind;
+
+	if ((zones = (zd_watch_zone*) calloc(zone_count, sizeof(zd_watch_zone))) == NULL)
+	{
+		fprintf(stderr, "Memory allocation error\n");
+
+		rv = 1;
+		goto cleanup;
+	}
+
+	/* Rewrites often replace the file, so the directories are watched */
+	for (i = 0; i < zone_count; i++)
+	{
+		char*	dir_copy	= strdup(argv[optind + i]);
+		char*	base_copy	= strdup(argv[optind + i]);
+
+		zones[i].zone_file = argv[optind + i];
+		zones[i].dir = (dir_copy != NULL) ? strdup(dirname(dir_copy)) : NULL;
+		zones[i].base = (base_copy != NULL) ? strdup(basename(base_copy)) : NULL;
+
+		free(dir_copy);
+		free(base_copy);
+
+		if ((zones[i].dir == NULL) || (zones[i].base == NULL))
+		{
+			fprintf(stderr, "Memory allocation error\n");
+
+			rv = 1;
+			goto cleanup;
+		}
+
+		if ((zones[i].wd = inotify_add_watch(in_fd, zones[i].dir, IN_CLOSE_WRITE | IN_MOVED_TO)) < 0)
+		{
+			fprintf(stderr, "Failed to watch %s (%s)\n", zones[i].dir, strerror(errno));
+
+			rv = 1;
+			goto cleanup;
+		}
+
+		if ((zd_zone_load(zones[i].zone_file, &opts, &zones[i].zone) != 0) || (zd_zone_soa(zones[i].zone) == NULL))
+		{
+			fprintf(stderr, "Failed to load %s\n", zones[i].zone_file);
+
+			rv = 1;
+			goto cleanup;
+		}
+
+		fprintf(stderr, "Loaded %d records from %s\n", zd_zone_count(zones[i].zone), zones[i].zone_file);
+	}
+
+	while (!zd_watch_stop)
+	{
+		int	nfds	= 0;
+
+		fds[nfds].fd = in_fd;
+		fds[nfds++].events = POLLIN;
+
+		if ((wo.listen_fd >= 0) && (wo.client_count < ZD_WATCH_MAX_CLIENTS))
+		{
+			fds[nfds].fd = wo.listen_fd;
+			fds[nfds++].events = POLLIN;
+		}
+
+		if (poll(fds, nfds, -1) < 0)
+		{
+			if (errno == EINTR) continue;
+
+			fprintf(stderr, "Failed to wait for events (%s)\n", strerror(errno));
+
+			rv = 1;
+			break;
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			zd_watch_events(in_fd, zones, zone_count, &opts, &wo);
+		}
+
+		if ((nfds > 1) && (fds[1].revents & POLLIN))
+		{
+			int	client	= accept(wo.listen_fd, NULL, NULL);
+
+			if ((client >= 0) && (fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK) != 0))
+			{
+				close(client);
+				client = -1;
+			}
+
+			if (client >= 0) wo.clients[wo.client_count++] = client;
+		}
+	}
+
+cleanup:
+	for (i = 0; (zones != NULL) && (i < zone_count); i++)
+	{
+		zd_zone_free(zones[i].zone);
+		free(zones[i].dir);
+		free(zones[i].base);
+	}
+
+	free(zones);
+
+	for (i = 0; i < wo.client_count; i++)
+	{
+		close(wo.clients[i]);
+	}
+
+	if (wo.listen_fd >= 0)
+	{
+		close(wo.listen_fd);
+		unlink(socket_path);
+	}
+
+	if (in_fd >= 0) close(in_fd);
+
+	return rv;
+}